@@ -0,0 +1,508 @@
+#include "EntryName.h"
+#include "Fat32Recoverer.h"
+#include "FatIndex.h"
+#include "SyntheticImage.h"
+#include <benchmark/benchmark.h>
+#include <charconv>
+#include <cstdlib>
+#include <map>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <unistd.h>
+
+// Benchmark suite over synthetic images (see SyntheticImage), generated on first use into the temporary directory
+// and removed on exit. Run "FAT32R_bench generate <path> [options]" to write one of them out for hand checks.
+
+namespace
+{
+  struct GeneratedImage
+  {
+    std::unique_ptr<SyntheticImage> image{};
+    std::string path{};
+  };
+
+  // Images by name, written once and removed when the program ends.
+  class ImageCache
+  {
+  private:
+    std::map<std::string, GeneratedImage> images{};
+
+  public:
+    ~ImageCache()
+    {
+      std::error_code error{};
+      for (const auto &[name, generated] : images)
+        std::filesystem::remove(generated.path, error);
+    }
+
+    const GeneratedImage &get(const std::string &name, const SyntheticImage::Options &options)
+    {
+      auto found{images.find(name)};
+      if (found != images.end())
+        return found->second;
+
+      GeneratedImage generated{std::make_unique<SyntheticImage>(options), (std::filesystem::temp_directory_path() / ("fat32r_bench_" + name + ".img")).string()};
+      generated.image->write(generated.path);
+      return images.emplace(name, std::move(generated)).first->second;
+    }
+  };
+
+  ImageCache imageCache{};
+
+  // Mixed volume: small files over a few directories, a quarter deleted, half with long names, some fragmented.
+  const GeneratedImage &mixedImage()
+  {
+    SyntheticImage::Options options{};
+    options.fileCount = 4000;
+    options.directoryCount = 16;
+    options.fragmentation = 0.05;
+    return imageCache.get("mixed", options);
+  }
+
+  // Mostly empty 2 GiB volume, so FAT access dominates: one FAT entry per cluster whatever the cluster size.
+  const GeneratedImage &emptyImage(const uint32_t bytesPerCluster)
+  {
+    SyntheticImage::Options options{};
+    options.bytesPerCluster = bytesPerCluster;
+    options.fileCount = 64;
+    options.freeClusters = static_cast<uint32_t>((2ULL << 30) / bytesPerCluster);
+    return imageCache.get("empty" + std::to_string(bytesPerCluster), options);
+  }
+
+  // Deleted files placed past the 4 GiB mark (sparse below), every one with a long name in the root directory.
+  const GeneratedImage &highClusterImage()
+  {
+    SyntheticImage::Options options{};
+    options.fileCount = 32;
+    options.directoryCount = 0;
+    options.maxFileSize = 1 << 20;
+    options.deletedRatio = 1.0;
+    options.longNameRatio = 1.0;
+    options.firstFileCluster = static_cast<uint32_t>((5ULL << 30) / options.bytesPerCluster);
+    return imageCache.get("high", options);
+  }
+
+  // One large deleted file, for the memory use of streamed recovery.
+  const GeneratedImage &largeFileImage()
+  {
+    SyntheticImage::Options options{};
+    options.fileCount = 1;
+    options.directoryCount = 0;
+    options.maxFileSize = 256 << 20;
+    options.deletedRatio = 1.0;
+    options.longNameRatio = 1.0;
+    options.seed = 3; // Draws a file of about 240 MiB.
+    return imageCache.get("large", options);
+  }
+
+  // Deleted photo folders: every subdirectory deleted with its files, one cluster of entries each
+  // (a deleted directory's zeroed chain only leaves its first cluster).
+  const GeneratedImage &deletedFoldersImage()
+  {
+    SyntheticImage::Options options{};
+    options.bytesPerCluster = 32768;
+    options.fileCount = 1200;
+    options.directoryCount = 8;
+    options.maxFileSize = 256 << 10;
+    options.deletedRatio = 0.0;
+    options.deletedDirectoryRatio = 1.0;
+    options.longNameRatio = 0.8;
+    return imageCache.get("folders", options);
+  }
+
+  std::string outputDirectory(const std::string &name)
+  {
+    return (std::filesystem::temp_directory_path() / ("fat32r_bench_" + name)).string();
+  }
+
+  // Peak resident set size of the process in KiB (VmHWM), and a reset of it to the current size.
+  uint64_t peakResidentKiB()
+  {
+    std::ifstream status{"/proc/self/status"};
+    std::string line{};
+    while (std::getline(status, line))
+      if (line.starts_with("VmHWM:"))
+        return std::stoull(line.substr(6));
+    return 0;
+  }
+
+  void resetPeakResident()
+  {
+    std::ofstream{"/proc/self/clear_refs"} << "5";
+  }
+
+  // Dropping the clean page cache pages of a file or block device, so the next run reads it cold.
+  void dropPageCache(const std::string &path)
+  {
+    int fd{open(path.c_str(), O_RDONLY | O_CLOEXEC)};
+    if (fd < 0)
+      return;
+    posix_fadvise(fd, 0, 0, POSIX_FADV_DONTNEED);
+    close(fd);
+  }
+
+  // Bytes of a file or block device held in the page cache, from mincore() over a mapping of it.
+  uint64_t pageCachedBytes(const std::string &path)
+  {
+    int fd{open(path.c_str(), O_RDONLY | O_CLOEXEC)};
+    if (fd < 0)
+      return 0;
+    off_t size{lseek(fd, 0, SEEK_END)};
+    void *mapping{size > 0 ? mmap(nullptr, static_cast<std::size_t>(size), PROT_READ, MAP_SHARED, fd, 0) : MAP_FAILED};
+    close(fd);
+    if (mapping == MAP_FAILED)
+      return 0;
+
+    uint64_t pageSize{static_cast<uint64_t>(sysconf(_SC_PAGESIZE))};
+    std::vector<unsigned char> resident((static_cast<uint64_t>(size) + pageSize - 1) / pageSize);
+    uint64_t cached{0};
+    if (mincore(mapping, static_cast<std::size_t>(size), resident.data()) == 0)
+      for (const auto page : resident)
+        cached += (page & 1) * pageSize;
+    munmap(mapping, static_cast<std::size_t>(size));
+    return cached;
+  }
+
+  // Count of deleted files whose recovered content differs from the image's, or that are missing, under outputDir.
+  std::size_t countMismatches(const SyntheticImage &image, const std::string &outputDir)
+  {
+    std::size_t mismatches{0};
+    std::vector<uint8_t> expected(1 << 20);
+    std::vector<uint8_t> actual(1 << 20);
+    for (std::size_t index{0}; index < image.getFiles().size(); ++index)
+    {
+      const auto &file{image.getFiles()[index]};
+      if (!file.deleted)
+        continue;
+      std::ifstream in{std::filesystem::path{outputDir} / image.getDirectoryName(file.directory) / file.name, std::ios::binary};
+      bool matches{in.good()};
+      for (uint64_t offset{0}; matches && offset < file.size; offset += expected.size())
+      {
+        std::size_t chunk{static_cast<std::size_t>(std::min<uint64_t>(expected.size(), file.size - offset))};
+        image.fillContent(index, offset, std::span<uint8_t>{expected.data(), chunk});
+        in.read(reinterpret_cast<char *>(actual.data()), static_cast<std::streamsize>(chunk));
+        matches = in.gcount() == static_cast<std::streamsize>(chunk) && std::memcmp(expected.data(), actual.data(), chunk) == 0;
+      }
+      if (!matches)
+        ++mismatches;
+    }
+    return mismatches;
+  }
+
+  // Opening a device: boot sector, geometry and root directory, FAT left to be paged in.
+  void BM_BootSectorParse(benchmark::State &state)
+  {
+    const auto &generated{mixedImage()};
+    for (auto _ : state)
+    {
+      Fat32Device device{generated.path, BlockSource::Mode::File};
+      benchmark::DoNotOptimize(device.getClusterCount());
+    }
+  }
+  BENCHMARK(BM_BootSectorParse);
+
+  // Opening a device with the FAT loaded whole (eager) or paged in later (lazy), by cluster size.
+  void BM_FatLoad(benchmark::State &state)
+  {
+    const auto &generated{emptyImage(static_cast<uint32_t>(state.range(0)))};
+    bool eager{state.range(1) == 0};
+    for (auto _ : state)
+    {
+      Fat32Device device{};
+      device.setFatAccess(eager ? FatTable::Mode::Eager : FatTable::Mode::Lazy);
+      device.readDevice(generated.path, BlockSource::Mode::File);
+      benchmark::DoNotOptimize(device.getFatTable().size());
+    }
+    state.SetLabel(eager ? "eager" : "lazy");
+    if (eager)
+      state.SetBytesProcessed(static_cast<int64_t>(state.iterations() * generated.image->getFatByteSize()));
+  }
+  BENCHMARK(BM_FatLoad)->ArgsProduct({{512, 4096, 32768}, {0, 1}})->Unit(benchmark::kMillisecond);
+
+  // One pass over the FAT building the free cluster index.
+  void BM_FatIndexBuild(benchmark::State &state)
+  {
+    const auto &generated{emptyImage(4096)};
+    Fat32Device device{};
+    device.setFatAccess(FatTable::Mode::Eager);
+    device.readDevice(generated.path, BlockSource::Mode::File);
+    for (auto _ : state)
+    {
+      FatIndex index{};
+      index.build(device.getFatTable(), device.getClusterCount());
+      benchmark::DoNotOptimize(index.getFreeClusterCount());
+    }
+    state.SetItemsProcessed(static_cast<int64_t>(state.iterations() * device.getClusterCount()));
+  }
+  BENCHMARK(BM_FatIndexBuild)->Unit(benchmark::kMillisecond);
+
+  // Whole directory tree scan for deleted entries, by thread count (0: one per hardware thread)
+  // and with the cluster cache off or at its default size.
+  void BM_DirectoryScan(benchmark::State &state)
+  {
+    const auto &generated{mixedImage()};
+    Fat32Recoverer recoverer{};
+    recoverer.setThreadCount(static_cast<std::size_t>(state.range(0)));
+    recoverer.setClusterCache(state.range(1) != 0 ? Fat32Device::defaultClusterCacheBudget : 0);
+    recoverer.readDevice(generated.path, BlockSource::Mode::File);
+    for (auto _ : state)
+    {
+      recoverer.readDeletedEntries();
+      benchmark::DoNotOptimize(recoverer.getDeletedEntryCount());
+    }
+    if (recoverer.getDeletedEntryCount() != generated.image->getDeletedFileCount())
+      state.SkipWithError("Wrong deleted entry count");
+    ClusterCache::Stats cacheStats{recoverer.getClusterCacheStats()};
+    state.counters["cache_hits"] = static_cast<double>(cacheStats.hits);
+    state.counters["cache_misses"] = static_cast<double>(cacheStats.misses);
+    state.SetItemsProcessed(static_cast<int64_t>(state.iterations() * generated.image->getFiles().size()));
+  }
+  BENCHMARK(BM_DirectoryScan)->ArgsProduct({{1, 0}, {0, 1}})->ArgNames({"threads", "cache"})->Unit(benchmark::kMillisecond)->UseRealTime();
+
+  // Long and short name decoding to UTF-8, straight from directory entries in memory.
+  void BM_NameDecode(benchmark::State &state)
+  {
+    const auto &generated{mixedImage()};
+    std::vector<std::vector<FAT32Entry>> directories{};
+    for (uint32_t directory{0}; directory <= generated.image->getOptions().directoryCount; ++directory)
+      directories.push_back(generated.image->getDirectoryEntries(directory));
+
+    std::string name{};
+    std::size_t names{0};
+    for (auto _ : state)
+    {
+      for (const auto &entries : directories)
+      {
+        std::size_t start{0};
+        for (std::size_t i{0}; i < entries.size(); ++i)
+        {
+          if (entries[i].attributes == 0x0F)
+            continue;
+          name.clear();
+          appendEntryName(std::span<const FAT32Entry>{entries}.subspan(start, i + 1 - start), name);
+          benchmark::DoNotOptimize(name.data());
+          start = i + 1;
+          ++names;
+        }
+      }
+    }
+    state.SetItemsProcessed(static_cast<int64_t>(names));
+  }
+  BENCHMARK(BM_NameDecode);
+
+  // Recovery of every deleted file of the mixed image, by thread count (0: one per hardware thread).
+  void BM_FileRecovery(benchmark::State &state)
+  {
+    const auto &generated{mixedImage()};
+    std::string outputDir{outputDirectory("recovery")};
+    Fat32Recoverer recoverer{};
+    recoverer.setThreadCount(static_cast<std::size_t>(state.range(0)));
+    recoverer.readDevice(generated.path, BlockSource::Mode::Auto);
+    for (auto _ : state)
+    {
+      std::vector<std::size_t> failed{recoverer.recoverDeletedEntries([](const DeletedEntryCatalogue &, const std::size_t)
+                                                                      { return true; },
+                                                                      outputDir)};
+      state.PauseTiming();
+      if (!failed.empty())
+        state.SkipWithError("Recovery failed");
+      std::filesystem::remove_all(outputDir);
+      state.ResumeTiming();
+    }
+    state.SetBytesProcessed(static_cast<int64_t>(state.iterations() * generated.image->getDeletedBytes()));
+  }
+  BENCHMARK(BM_FileRecovery)->Arg(1)->Arg(0)->Unit(benchmark::kMillisecond)->UseRealTime();
+
+  // Recovery of files past the 4 GiB mark, checked byte for byte against the image once timed.
+  void BM_HighClusterRecovery(benchmark::State &state)
+  {
+    const auto &generated{highClusterImage()};
+    std::string outputDir{outputDirectory("high")};
+    Fat32Recoverer recoverer{generated.path, BlockSource::Mode::File};
+    for (auto _ : state)
+    {
+      state.PauseTiming();
+      std::filesystem::remove_all(outputDir);
+      state.ResumeTiming();
+      recoverer.recoverDeletedEntries([](const DeletedEntryCatalogue &, const std::size_t)
+                                      { return true; },
+                                      outputDir);
+    }
+    if (countMismatches(*generated.image, outputDir) != 0)
+      state.SkipWithError("Recovered content differs from the image");
+    std::filesystem::remove_all(outputDir);
+    state.SetBytesProcessed(static_cast<int64_t>(state.iterations() * generated.image->getDeletedBytes()));
+  }
+  BENCHMARK(BM_HighClusterRecovery)->Unit(benchmark::kMillisecond)->UseRealTime();
+
+  // Recovery of deleted directories with their whole subtree, checked byte for byte against the image once timed.
+  void BM_DeletedDirectoryRecovery(benchmark::State &state)
+  {
+    const auto &generated{deletedFoldersImage()};
+    std::string outputDir{outputDirectory("folders")};
+    Fat32Recoverer recoverer{};
+    recoverer.setThreadCount(static_cast<std::size_t>(state.range(0)));
+    recoverer.readDevice(generated.path, BlockSource::Mode::Auto);
+    for (auto _ : state)
+    {
+      state.PauseTiming();
+      std::filesystem::remove_all(outputDir);
+      state.ResumeTiming();
+      std::vector<std::size_t> failed{recoverer.recoverDeletedEntries([](const DeletedEntryCatalogue &entries, const std::size_t index)
+                                                                      { return entries.isDirectory(index); },
+                                                                      outputDir)};
+      if (!failed.empty())
+        state.SkipWithError("Recovery failed");
+    }
+    if (countMismatches(*generated.image, outputDir) != 0)
+      state.SkipWithError("Recovered content differs from the image");
+    std::filesystem::remove_all(outputDir);
+    state.SetBytesProcessed(static_cast<int64_t>(state.iterations() * generated.image->getDeletedBytes()));
+  }
+  BENCHMARK(BM_DeletedDirectoryRecovery)->Arg(1)->Arg(0)->Unit(benchmark::kMillisecond)->UseRealTime();
+
+  // Peak resident memory of the whole process while streaming one large file out, which has to stay
+  // far below the file's size (read through pread, so mapped pages of the image do not count).
+  void BM_StreamedRecoveryMemory(benchmark::State &state)
+  {
+    const auto &generated{largeFileImage()};
+    std::string outputDir{outputDirectory("large")};
+    Fat32Recoverer recoverer{generated.path, BlockSource::Mode::File};
+    uint64_t peak{0};
+    for (auto _ : state)
+    {
+      state.PauseTiming();
+      std::filesystem::remove_all(outputDir);
+      std::filesystem::create_directories(outputDir);
+      resetPeakResident();
+      state.ResumeTiming();
+      recoverer.recoverDeletedEntry(0, outputDir);
+      state.PauseTiming();
+      peak = std::max(peak, peakResidentKiB());
+      state.ResumeTiming();
+    }
+    if (countMismatches(*generated.image, outputDir) != 0)
+      state.SkipWithError("Recovered content differs from the image");
+    std::filesystem::remove_all(outputDir);
+    state.counters["peak_resident_KiB"] = static_cast<double>(peak);
+    state.SetBytesProcessed(static_cast<int64_t>(state.iterations() * generated.image->getDeletedBytes()));
+  }
+  BENCHMARK(BM_StreamedRecoveryMemory)->Unit(benchmark::kMillisecond)->UseRealTime();
+
+  // Cold scan and recovery of every deleted file, buffered (0) or with direct I/O (1), with how much of the device
+  // was left in the page cache. Runs on the mixed image, or on FAT32R_BENCH_DEVICE when set
+  // (e.g. a loop device over an image from "generate", to measure a real block device).
+  void BM_DeviceAccess(benchmark::State &state)
+  {
+    const char *devicePath{std::getenv("FAT32R_BENCH_DEVICE")};
+    const GeneratedImage *generated{devicePath == nullptr ? &mixedImage() : nullptr};
+    std::string path{devicePath == nullptr ? generated->path : devicePath};
+    BlockSource::Mode mode{state.range(0) != 0 ? BlockSource::Mode::Direct : BlockSource::Mode::File};
+    std::string outputDir{outputDirectory("access")};
+    uint64_t cached{0};
+    std::size_t deletedEntries{0};
+    for (auto _ : state)
+    {
+      state.PauseTiming();
+      std::filesystem::remove_all(outputDir);
+      dropPageCache(path);
+      state.ResumeTiming();
+      Fat32Recoverer recoverer{path, mode};
+      std::vector<std::size_t> failed{recoverer.recoverDeletedEntries([](const DeletedEntryCatalogue &, const std::size_t)
+                                                                      { return true; },
+                                                                      outputDir)};
+      state.PauseTiming();
+      if (!failed.empty())
+        state.SkipWithError("Recovery failed");
+      deletedEntries = recoverer.getDeletedEntryCount();
+      cached = std::max(cached, pageCachedBytes(path));
+      state.ResumeTiming();
+    }
+    if (generated != nullptr && deletedEntries != generated->image->getDeletedFileCount())
+      state.SkipWithError("Wrong deleted entry count");
+    std::filesystem::remove_all(outputDir);
+    state.counters["page_cached_KiB"] = static_cast<double>(cached >> 10);
+    state.counters["entries"] = static_cast<double>(deletedEntries);
+  }
+  BENCHMARK(BM_DeviceAccess)->ArgName("direct")->Arg(0)->Arg(1)->Unit(benchmark::kMillisecond)->UseRealTime();
+
+  template <typename Value>
+  bool parseNumber(const std::string_view text, Value &value)
+  {
+    auto [end, error]{std::from_chars(text.data(), text.data() + text.size(), value)};
+    return error == std::errc{} && end == text.data() + text.size();
+  }
+
+  // "generate <path> [options]": writes one synthetic image.
+  int generate(const int argc, char **argv)
+  {
+    if (argc < 3)
+    {
+      std::cerr << "Usage: " << argv[0] << " generate <path> [--cluster-size <bytes>] [--files <n>] [--directories <n>] [--max-size <bytes>]\n"
+                << "         [--deleted <ratio>] [--deleted-directories <ratio>] [--fragmentation <ratio>] [--long-names <ratio>] [--first-cluster <n>] [--free <clusters>] [--seed <n>]\n";
+      return 2;
+    }
+
+    SyntheticImage::Options options{};
+    for (int i{3}; i < argc; i += 2)
+    {
+      std::string_view option{argv[i]};
+      std::string_view value{i + 1 < argc ? argv[i + 1] : ""};
+      bool valid{false};
+      if (option == "--cluster-size")
+        valid = parseNumber(value, options.bytesPerCluster);
+      else if (option == "--files")
+        valid = parseNumber(value, options.fileCount);
+      else if (option == "--directories")
+        valid = parseNumber(value, options.directoryCount);
+      else if (option == "--max-size")
+        valid = parseNumber(value, options.maxFileSize);
+      else if (option == "--deleted")
+        valid = parseNumber(value, options.deletedRatio);
+      else if (option == "--deleted-directories")
+        valid = parseNumber(value, options.deletedDirectoryRatio);
+      else if (option == "--fragmentation")
+        valid = parseNumber(value, options.fragmentation);
+      else if (option == "--long-names")
+        valid = parseNumber(value, options.longNameRatio);
+      else if (option == "--first-cluster")
+        valid = parseNumber(value, options.firstFileCluster);
+      else if (option == "--free")
+        valid = parseNumber(value, options.freeClusters);
+      else if (option == "--seed")
+        valid = parseNumber(value, options.seed);
+      if (!valid)
+      {
+        std::cerr << "Invalid option " << option << "\n";
+        return 2;
+      }
+    }
+
+    try
+    {
+      SyntheticImage image{options};
+      image.write(argv[2]);
+      std::cout << "- Wrote " << image.getFiles().size() << " files (" << image.getDeletedFileCount() << " deleted) over "
+                << image.getClusterCount() << " clusters to " << argv[2] << ".\n";
+      return 0;
+    }
+    catch (const std::runtime_error &error)
+    {
+      std::cerr << error.what() << "\n";
+      return 1;
+    }
+  }
+}
+
+int main(int argc, char **argv)
+{
+  if (argc >= 2 && std::string_view{argv[1]} == "generate")
+    return generate(argc, argv);
+
+  benchmark::Initialize(&argc, argv);
+  if (benchmark::ReportUnrecognizedArguments(argc, argv))
+    return 1;
+  benchmark::RunSpecifiedBenchmarks();
+  benchmark::Shutdown();
+  return 0;
+}
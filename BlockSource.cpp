@@ -0,0 +1,427 @@
+#include "BlockSource.h"
+#include "Instrumentation.h"
+#if defined(FAT32R_HAVE_IO_URING)
+#include "UringBlockSource.h"
+#endif
+#include <algorithm>
+#include <cerrno>
+#include <cstring>
+#include <vector>
+#include <fcntl.h>
+#include <climits>
+#include <linux/fs.h>
+#include <new>
+#include <sys/ioctl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/uio.h>
+#include <unistd.h>
+
+namespace
+{
+  // Size of a regular file or block device, lseek() covers both.
+  uint64_t fileDescriptorSize(const int fd)
+  {
+    off_t end{lseek(fd, 0, SEEK_END)};
+    if (end < 0)
+      throw std::runtime_error{"Failed to determine device size"};
+    return static_cast<uint64_t>(end);
+  }
+}
+
+std::span<const uint8_t> BlockSource::view(const uint64_t, const std::size_t)
+{
+  return {};
+}
+
+void BlockSource::prefetch(const uint64_t, const std::size_t)
+{
+}
+
+void BlockSource::readBatch(std::span<const ReadRequest> requests)
+{
+  for (const auto &request : requests)
+    read(request.offset, request.buffer);
+}
+
+FileBlockSource::FileBlockSource(const std::string &path)
+{
+  fd = open(path.c_str(), O_RDONLY | O_CLOEXEC);
+  if (fd < 0)
+    throw std::runtime_error{"Failed to open device"};
+
+  try
+  {
+    byteSize = fileDescriptorSize(fd);
+  }
+  catch (const std::runtime_error &)
+  {
+    close(fd);
+    throw;
+  }
+}
+
+FileBlockSource::~FileBlockSource()
+{
+  if (fd >= 0)
+    close(fd);
+}
+
+void FileBlockSource::read(const uint64_t offset, std::span<uint8_t> buffer)
+{
+  FAT32R_NOTE_READ(offset, buffer.size());
+  std::size_t done{0};
+
+  // pread() may return less than asked for, keep going until the buffer is full.
+  while (done < buffer.size())
+  {
+    ssize_t count{pread(fd, buffer.data() + done, buffer.size() - done, static_cast<off_t>(offset + done))};
+    if (count < 0 && errno == EINTR)
+      continue;
+    if (count <= 0)
+      throw std::runtime_error{"Error reading device"};
+    done += static_cast<std::size_t>(count);
+  }
+}
+
+void FileBlockSource::readBatch(std::span<const ReadRequest> requests)
+{
+  std::vector<iovec> vectors{};
+
+  for (std::size_t first{0}; first < requests.size();)
+  {
+    // Gather requests that continue exactly where the previous one ended into one preadv() call.
+    vectors.clear();
+    uint64_t offset{requests[first].offset};
+    uint64_t expected{offset};
+    std::size_t last{first};
+    while (last < requests.size() && requests[last].offset == expected && vectors.size() < IOV_MAX)
+    {
+      vectors.push_back({requests[last].buffer.data(), requests[last].buffer.size()});
+      expected += requests[last].buffer.size();
+      ++last;
+    }
+
+    std::size_t total{static_cast<std::size_t>(expected - offset)};
+    FAT32R_NOTE_READ(offset, total);
+    ssize_t count{};
+    do
+      count = preadv(fd, vectors.data(), static_cast<int>(vectors.size()), static_cast<off_t>(offset));
+    while (count < 0 && errno == EINTR);
+
+    if (count < 0)
+      throw std::runtime_error{"Error reading device"};
+
+    // A short vectored read is finished request by request with plain reads.
+    if (static_cast<std::size_t>(count) < total)
+    {
+      std::size_t skipped{static_cast<std::size_t>(count)};
+      for (std::size_t i{first}; i < last; ++i)
+      {
+        std::size_t size{requests[i].buffer.size()};
+        if (skipped >= size)
+        {
+          skipped -= size;
+          continue;
+        }
+        read(requests[i].offset + skipped, requests[i].buffer.subspan(skipped));
+        skipped = 0;
+      }
+    }
+
+    first = last;
+  }
+}
+
+void FileBlockSource::prefetch(const uint64_t offset, const std::size_t length)
+{
+  posix_fadvise(fd, static_cast<off_t>(offset), static_cast<off_t>(length), POSIX_FADV_WILLNEED);
+}
+
+MmapBlockSource::MmapBlockSource(const std::string &path)
+{
+  fd = open(path.c_str(), O_RDONLY | O_CLOEXEC);
+  if (fd < 0)
+    throw std::runtime_error{"Failed to open device"};
+
+  try
+  {
+    byteSize = fileDescriptorSize(fd);
+    if (byteSize == 0)
+      throw std::runtime_error{"Failed to map empty device"};
+
+    void *address{mmap(nullptr, byteSize, PROT_READ, MAP_SHARED, fd, 0)};
+    if (address == MAP_FAILED)
+      throw std::runtime_error{"Failed to map device"};
+    mapping = static_cast<const uint8_t *>(address);
+  }
+  catch (const std::runtime_error &)
+  {
+    close(fd);
+    throw;
+  }
+}
+
+MmapBlockSource::~MmapBlockSource()
+{
+  if (mapping != nullptr)
+    munmap(const_cast<uint8_t *>(mapping), byteSize);
+  if (fd >= 0)
+    close(fd);
+}
+
+void MmapBlockSource::read(const uint64_t offset, std::span<uint8_t> buffer)
+{
+  std::span<const uint8_t> data{view(offset, buffer.size())};
+  if (data.size() != buffer.size())
+    throw std::runtime_error{"Error reading device"};
+  std::memcpy(buffer.data(), data.data(), buffer.size());
+}
+
+std::span<const uint8_t> MmapBlockSource::view(const uint64_t offset, const std::size_t length)
+{
+  if (offset > byteSize || length > byteSize - offset)
+    throw std::runtime_error{"Error reading device"};
+  FAT32R_NOTE_READ(offset, length);
+  return {mapping + offset, length};
+}
+
+void MmapBlockSource::prefetch(const uint64_t offset, const std::size_t length)
+{
+  if (offset >= byteSize)
+    return;
+
+  // madvise() wants a page-aligned start address.
+  uint64_t pageSize{static_cast<uint64_t>(sysconf(_SC_PAGESIZE))};
+  uint64_t start{offset - offset % pageSize};
+  uint64_t end{std::min(byteSize, offset + length)};
+  madvise(const_cast<uint8_t *>(mapping) + start, end - start, MADV_WILLNEED);
+}
+
+void DirectBlockSource::AlignedDelete::operator()(uint8_t *buffer) const
+{
+  ::operator delete[](buffer, std::align_val_t{alignment});
+}
+
+DirectBlockSource::DirectBlockSource(const std::string &path)
+{
+  fd = open(path.c_str(), O_RDONLY | O_CLOEXEC | O_DIRECT);
+  if (fd < 0)
+    throw std::runtime_error{errno == EINVAL ? "Direct I/O not supported by device" : "Failed to open device"};
+
+  try
+  {
+    byteSize = fileDescriptorSize(fd);
+
+    // Page alignment suits memory and any common logical block size, block devices may ask for more.
+    alignment = static_cast<std::size_t>(sysconf(_SC_PAGESIZE));
+    struct stat status{};
+    int logicalBlockSize{};
+    if (fstat(fd, &status) == 0 && S_ISBLK(status.st_mode) && ioctl(fd, BLKSSZGET, &logicalBlockSize) == 0)
+      alignment = std::max(alignment, static_cast<std::size_t>(logicalBlockSize));
+  }
+  catch (const std::runtime_error &)
+  {
+    close(fd);
+    throw;
+  }
+}
+
+DirectBlockSource::~DirectBlockSource()
+{
+  if (fd >= 0)
+    close(fd);
+}
+
+DirectBlockSource::AlignedBuffer DirectBlockSource::acquireBuffer()
+{
+  {
+    std::lock_guard lock{poolMutex};
+    if (!pool.empty())
+    {
+      AlignedBuffer buffer{std::move(pool.back())};
+      pool.pop_back();
+      return buffer;
+    }
+  }
+
+  try
+  {
+    return AlignedBuffer{static_cast<uint8_t *>(::operator new[](bufferSize, std::align_val_t{alignment})), AlignedDelete{alignment}};
+  }
+  catch (...)
+  {
+    throw std::runtime_error{"Error allocating direct I/O buffer"};
+  }
+}
+
+void DirectBlockSource::releaseBuffer(AlignedBuffer buffer)
+{
+  std::lock_guard lock{poolMutex};
+  if (pool.size() < maxIdleBuffers)
+    pool.push_back(std::move(buffer));
+}
+
+std::size_t DirectBlockSource::readAligned(const uint64_t offset, std::span<uint8_t> buffer)
+{
+  FAT32R_NOTE_READ(offset, buffer.size());
+  std::size_t done{0};
+
+  while (done < buffer.size())
+  {
+    ssize_t count{pread(fd, buffer.data() + done, buffer.size() - done, static_cast<off_t>(offset + done))};
+    if (count < 0 && errno == EINTR)
+      continue;
+    if (count < 0)
+      throw std::runtime_error{"Error reading device"};
+    done += static_cast<std::size_t>(count);
+
+    // Direct reads only come back short at the end of the device, or unaligned, where no further read is allowed.
+    if (count == 0 || done % alignment != 0)
+      break;
+  }
+  return done;
+}
+
+void DirectBlockSource::read(const uint64_t offset, std::span<uint8_t> buffer)
+{
+  // Aligned destinations over aligned ranges are read in place, anything else goes through the pool.
+  if (offset % alignment == 0 && buffer.size() % alignment == 0 && reinterpret_cast<uintptr_t>(buffer.data()) % alignment == 0)
+  {
+    if (readAligned(offset, buffer) != buffer.size())
+      throw std::runtime_error{"Error reading device"};
+    return;
+  }
+
+  ReadRequest request{offset, buffer};
+  readBatch(std::span<const ReadRequest>{&request, 1});
+}
+
+void DirectBlockSource::readBatch(std::span<const ReadRequest> requests)
+{
+  AlignedBuffer buffer{acquireBuffer()};
+
+  try
+  {
+    for (std::size_t first{0}; first < requests.size();)
+    {
+      // Requests that continue exactly where the previous one ended are read as one range.
+      uint64_t start{requests[first].offset};
+      uint64_t end{start};
+      std::size_t last{first};
+      while (last < requests.size() && requests[last].offset == end)
+        end += requests[last++].buffer.size();
+
+      // Read the range a buffer at a time, from the aligned block holding its start,
+      // and scatter the bytes of each buffer over the requests they belong to.
+      std::size_t request{first};
+      for (uint64_t position{start}; position < end;)
+      {
+        uint64_t alignedStart{position - position % alignment};
+        uint64_t alignedEnd{(end + alignment - 1) / alignment * alignment};
+        std::size_t length{static_cast<std::size_t>(std::min<uint64_t>(bufferSize, alignedEnd - alignedStart))};
+        uint64_t available{alignedStart + readAligned(alignedStart, std::span<uint8_t>{buffer.get(), length})};
+        if (available <= position)
+          throw std::runtime_error{"Error reading device"};
+
+        uint64_t stop{std::min(end, available)};
+        while (position < stop)
+        {
+          const ReadRequest &target{requests[request]};
+          uint64_t inside{position - target.offset};
+          if (inside >= target.buffer.size())
+          {
+            ++request;
+            continue;
+          }
+          std::size_t count{static_cast<std::size_t>(std::min<uint64_t>(target.buffer.size() - inside, stop - position))};
+          std::memcpy(target.buffer.data() + inside, buffer.get() + (position - alignedStart), count);
+          position += count;
+        }
+      }
+
+      first = last;
+    }
+  }
+  catch (const std::runtime_error &)
+  {
+    releaseBuffer(std::move(buffer));
+    throw;
+  }
+
+  releaseBuffer(std::move(buffer));
+}
+
+OffsetBlockSource::OffsetBlockSource(std::unique_ptr<BlockSource> underlying, const uint64_t rangeOffset, const uint64_t rangeSize)
+    : source{std::move(underlying)}, offset{rangeOffset}
+{
+  uint64_t available{source->size()};
+  if (offset >= available || rangeSize > available - offset)
+    throw std::runtime_error{"Volume range outside of device"};
+  byteSize = rangeSize != 0 ? rangeSize : available - offset;
+}
+
+uint64_t OffsetBlockSource::translate(const uint64_t rangeOffset, const std::size_t length) const
+{
+  if (rangeOffset > byteSize || length > byteSize - rangeOffset)
+    throw std::runtime_error{"Error reading device"};
+  return offset + rangeOffset;
+}
+
+void OffsetBlockSource::read(const uint64_t rangeOffset, std::span<uint8_t> buffer)
+{
+  source->read(translate(rangeOffset, buffer.size()), buffer);
+}
+
+void OffsetBlockSource::readBatch(std::span<const ReadRequest> requests)
+{
+  std::vector<ReadRequest> shifted{};
+  shifted.reserve(requests.size());
+  for (const auto &request : requests)
+    shifted.push_back({translate(request.offset, request.buffer.size()), request.buffer});
+  source->readBatch(shifted);
+}
+
+std::span<const uint8_t> OffsetBlockSource::view(const uint64_t rangeOffset, const std::size_t length)
+{
+  return source->view(translate(rangeOffset, length), length);
+}
+
+void OffsetBlockSource::prefetch(const uint64_t rangeOffset, const std::size_t length)
+{
+  if (rangeOffset >= byteSize)
+    return;
+  source->prefetch(offset + rangeOffset, static_cast<std::size_t>(std::min<uint64_t>(length, byteSize - rangeOffset)));
+}
+
+std::unique_ptr<BlockSource> openBlockSource(const std::string_view path, const BlockSource::Mode mode)
+{
+  std::string pathString{path};
+
+  switch (mode)
+  {
+  case BlockSource::Mode::Mmap:
+    return std::make_unique<MmapBlockSource>(pathString);
+  case BlockSource::Mode::File:
+    return std::make_unique<FileBlockSource>(pathString);
+  case BlockSource::Mode::Uring:
+#if defined(FAT32R_HAVE_IO_URING)
+    return std::make_unique<UringBlockSource>(pathString);
+#else
+    throw std::runtime_error{"io_uring support not compiled in"};
+#endif
+  case BlockSource::Mode::Direct:
+    return std::make_unique<DirectBlockSource>(pathString);
+  case BlockSource::Mode::Auto:
+  default:
+    try
+    {
+      return std::make_unique<MmapBlockSource>(pathString);
+    }
+    catch (const std::runtime_error &)
+    {
+      // Some devices (character devices, pipes, ...) cannot be mapped, plain reads still work.
+      return std::make_unique<FileBlockSource>(pathString);
+    }
+  }
+}
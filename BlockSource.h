@@ -0,0 +1,190 @@
+#pragma once
+#include <cstdint>
+#include <cstddef>
+#include <span>
+#include <string>
+#include <string_view>
+#include <memory>
+#include <mutex>
+#include <stdexcept>
+#include <vector>
+
+// Abstract source of raw bytes backing a Fat32Device,
+// so the device can be read through a plain file descriptor, a memory mapping, ...
+// Every method takes absolute byte offsets and is safe to call from multiple threads.
+class BlockSource
+{
+public:
+  // Ways of opening a device/partition/disk/..., Auto tries a memory mapping first
+  // and falls back to plain reads when the path cannot be mapped.
+  enum class Mode
+  {
+    Auto,
+    Mmap,
+    File,
+    Uring,  // Only available when built with FAT32R_WITH_IO_URING.
+    Direct, // pread() bypassing the page cache (O_DIRECT), never picked by Auto.
+  };
+
+  // One range of a batched read.
+  struct ReadRequest
+  {
+    uint64_t offset{};
+    std::span<uint8_t> buffer{};
+  };
+
+  virtual ~BlockSource() = default;
+
+  // Public method returning the size in bytes of the device/partition/disk/...
+  virtual uint64_t size() const = 0;
+
+  // Public method copying buffer.size() bytes starting at offset into buffer.
+  // Throws if the range cannot be read completely.
+  virtual void read(const uint64_t offset, std::span<uint8_t> buffer) = 0;
+
+  // Public method reading several ranges in one go, sources may merge adjacent ranges
+  // and keep many of them in flight at once. Throws if any range cannot be read completely.
+  virtual void readBatch(std::span<const ReadRequest> requests);
+
+  // Public method telling whether view() can hand out zero-copy views.
+  virtual bool supportsViews() const { return false; }
+
+  // Public method returning a zero-copy view of length bytes starting at offset.
+  // Sources unable to provide views return an empty span, callers then fall back to read().
+  virtual std::span<const uint8_t> view(const uint64_t offset, const std::size_t length);
+
+  // Public method hinting that a range will be read soon, so the source can start fetching it.
+  // Purely advisory, sources without read-ahead support ignore it.
+  virtual void prefetch(const uint64_t offset, const std::size_t length);
+};
+
+// Block source reading through pread() on a file descriptor, no seek state is shared between calls.
+class FileBlockSource : public BlockSource
+{
+private:
+  int fd{-1};
+  uint64_t byteSize{};
+
+public:
+  FileBlockSource(const std::string &path);
+
+  // Disabled copy and move semantics.
+  FileBlockSource(const FileBlockSource &) = delete;
+  FileBlockSource &operator=(const FileBlockSource &) = delete;
+
+  // Destructor.
+  ~FileBlockSource() override;
+
+  uint64_t size() const override { return byteSize; }
+  void read(const uint64_t offset, std::span<uint8_t> buffer) override;
+  void readBatch(std::span<const ReadRequest> requests) override;
+  void prefetch(const uint64_t offset, const std::size_t length) override;
+};
+
+// Block source mapping the whole device/partition/disk/... read-only into memory,
+// reads become memcpy() and views point straight into the mapping.
+class MmapBlockSource : public BlockSource
+{
+private:
+  int fd{-1};
+  uint64_t byteSize{};
+  const uint8_t *mapping{nullptr};
+
+public:
+  MmapBlockSource(const std::string &path);
+
+  // Disabled copy and move semantics.
+  MmapBlockSource(const MmapBlockSource &) = delete;
+  MmapBlockSource &operator=(const MmapBlockSource &) = delete;
+
+  // Destructor.
+  ~MmapBlockSource() override;
+
+  uint64_t size() const override { return byteSize; }
+  void read(const uint64_t offset, std::span<uint8_t> buffer) override;
+  bool supportsViews() const override { return true; }
+  std::span<const uint8_t> view(const uint64_t offset, const std::size_t length) override;
+  void prefetch(const uint64_t offset, const std::size_t length) override;
+};
+
+// Block source reading through pread() on a descriptor opened with O_DIRECT, so scanning a whole card
+// does not fill the page cache and evict the working sets of everything else running on the machine.
+// Direct reads must start, end and land on aligned boundaries, so any range is read through a pool of aligned buffers,
+// reused across calls and threads, and only the requested bytes are copied out of them.
+class DirectBlockSource : public BlockSource
+{
+private:
+  // Frees buffers from the aligned operator new.
+  struct AlignedDelete
+  {
+    std::size_t alignment{};
+    void operator()(uint8_t *buffer) const;
+  };
+  using AlignedBuffer = std::unique_ptr<uint8_t[], AlignedDelete>;
+
+  int fd{-1};
+  uint64_t byteSize{};
+  std::size_t alignment{}; // Of offsets, lengths and memory, a multiple of the device's logical block size.
+  std::mutex poolMutex{};
+  std::vector<AlignedBuffer> pool{}; // Idle buffers, each read in progress holds one.
+
+  // Private methods taking a buffer from the pool (allocating one when it is empty) and giving it back.
+  AlignedBuffer acquireBuffer();
+  void releaseBuffer(AlignedBuffer buffer);
+
+  // Private method reading an aligned range into an aligned buffer, returns the bytes read, short only at the end of the device.
+  std::size_t readAligned(const uint64_t offset, std::span<uint8_t> buffer);
+
+public:
+  // Size of the pooled buffers, the most read by one pread() call, and how many idle ones are kept.
+  static constexpr std::size_t bufferSize{1 << 20};
+  static constexpr std::size_t maxIdleBuffers{8};
+
+  DirectBlockSource(const std::string &path);
+
+  // Disabled copy and move semantics.
+  DirectBlockSource(const DirectBlockSource &) = delete;
+  DirectBlockSource &operator=(const DirectBlockSource &) = delete;
+
+  // Destructor.
+  ~DirectBlockSource() override;
+
+  uint64_t size() const override { return byteSize; }
+  void read(const uint64_t offset, std::span<uint8_t> buffer) override;
+  void readBatch(std::span<const ReadRequest> requests) override;
+};
+
+// Block source exposing a byte range of another one (a partition of a whole disk, ...) as if it started at byte #0.
+// Reads are shifted and checked against the range, views still point straight into the underlying source.
+class OffsetBlockSource : public BlockSource
+{
+private:
+  std::unique_ptr<BlockSource> source{nullptr};
+  uint64_t offset{};
+  uint64_t byteSize{};
+
+  // Private method shifting a range into the underlying source, throws if it leaves this one.
+  uint64_t translate(const uint64_t rangeOffset, const std::size_t length) const;
+
+public:
+  // Take the underlying source, where the range starts on it and how long it is, 0 meaning up to its end.
+  // Throws if the range does not fit.
+  OffsetBlockSource(std::unique_ptr<BlockSource> underlying, const uint64_t rangeOffset, const uint64_t rangeSize = 0);
+
+  // Disabled copy and move semantics.
+  OffsetBlockSource(const OffsetBlockSource &) = delete;
+  OffsetBlockSource &operator=(const OffsetBlockSource &) = delete;
+
+  // Destructor.
+  ~OffsetBlockSource() override = default;
+
+  uint64_t size() const override { return byteSize; }
+  void read(const uint64_t rangeOffset, std::span<uint8_t> buffer) override;
+  void readBatch(std::span<const ReadRequest> requests) override;
+  bool supportsViews() const override { return source->supportsViews(); }
+  std::span<const uint8_t> view(const uint64_t rangeOffset, const std::size_t length) override;
+  void prefetch(const uint64_t rangeOffset, const std::size_t length) override;
+};
+
+// Open a device/partition/disk/... as a block source with the requested mode.
+std::unique_ptr<BlockSource> openBlockSource(const std::string_view path, const BlockSource::Mode mode = BlockSource::Mode::Auto);
@@ -0,0 +1,115 @@
+#include "ClusterCache.h"
+#include "Instrumentation.h"
+#include <algorithm>
+#include <cstring>
+#include <stdexcept>
+
+void ClusterCache::configure(const std::size_t clusterBytes, const std::size_t budget)
+{
+  try
+  {
+    clusterSize = clusterBytes;
+    slotsPerShard = clusterBytes == 0 ? 0 : budget / clusterBytes / shardCount;
+
+    for (auto &shard : shards)
+    {
+      std::lock_guard lock{shard.mutex};
+      shard.slotOf.clear();
+      shard.slotOf.reserve(slotsPerShard);
+      shard.slotClusters.assign(slotsPerShard, 0);
+      shard.referenced.assign(slotsPerShard, 0);
+      shard.data.reset(slotsPerShard == 0 ? nullptr : new uint8_t[slotsPerShard * clusterSize]);
+      shard.hand = 0;
+      shard.stats = {};
+    }
+  }
+  catch (...)
+  {
+    throw std::runtime_error{"Error allocating cluster cache"};
+  }
+}
+
+bool ClusterCache::lookup(const uint32_t cluster, std::span<uint8_t> out)
+{
+  if (!isEnabled())
+    return false;
+
+  Shard &shard{shardOf(cluster)};
+  std::lock_guard lock{shard.mutex};
+  auto found{shard.slotOf.find(cluster)};
+  if (found == shard.slotOf.end())
+  {
+    ++shard.stats.misses;
+    FAT32R_COUNT(CacheMisses, 1);
+    return false;
+  }
+
+  std::memcpy(out.data(), shard.data.get() + found->second * clusterSize, std::min(out.size(), clusterSize));
+  shard.referenced[found->second] = 1;
+  ++shard.stats.hits;
+  FAT32R_COUNT(CacheHits, 1);
+  return true;
+}
+
+bool ClusterCache::contains(const uint32_t cluster) const
+{
+  if (!isEnabled())
+    return false;
+
+  const Shard &shard{shards[cluster % shardCount]};
+  std::lock_guard lock{shard.mutex};
+  return shard.slotOf.contains(cluster);
+}
+
+void ClusterCache::insert(const uint32_t cluster, std::span<const uint8_t> content, const bool readAhead)
+{
+  if (!isEnabled() || content.size() < clusterSize)
+    return;
+
+  Shard &shard{shardOf(cluster)};
+  std::lock_guard lock{shard.mutex};
+  auto found{shard.slotOf.find(cluster)};
+  std::size_t slot{};
+  if (found != shard.slotOf.end())
+    slot = found->second;
+  else
+  {
+    // CLOCK: sweep the hand, giving referenced slots a second chance, until an unreferenced (or empty) one comes up.
+    while (shard.referenced[shard.hand] != 0)
+    {
+      shard.referenced[shard.hand] = 0;
+      shard.hand = (shard.hand + 1) % slotsPerShard;
+    }
+    slot = shard.hand;
+    shard.hand = (shard.hand + 1) % slotsPerShard;
+
+    if (shard.slotClusters[slot] != 0)
+    {
+      shard.slotOf.erase(shard.slotClusters[slot]);
+      ++shard.stats.evictions;
+    }
+    shard.slotClusters[slot] = cluster;
+    shard.slotOf.emplace(cluster, slot);
+    ++shard.stats.insertions;
+    if (readAhead)
+      ++shard.stats.readAhead;
+  }
+
+  std::memcpy(shard.data.get() + slot * clusterSize, content.data(), clusterSize);
+  shard.referenced[slot] = 0;
+}
+
+ClusterCache::Stats ClusterCache::getStats() const
+{
+  Stats total{};
+  for (const auto &shard : shards)
+  {
+    std::lock_guard lock{shard.mutex};
+    total.hits += shard.stats.hits;
+    total.misses += shard.stats.misses;
+    total.insertions += shard.stats.insertions;
+    total.readAhead += shard.stats.readAhead;
+    total.evictions += shard.stats.evictions;
+  }
+  return total;
+}
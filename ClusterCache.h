@@ -0,0 +1,77 @@
+#pragma once
+#include <array>
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <mutex>
+#include <span>
+#include <unordered_map>
+#include <vector>
+
+// Thread-safe cache of whole clusters, for devices that cannot be viewed in place (read through pread, io_uring, ...),
+// so clusters read again (directories recovered after the scan found them, candidates of the orphan sweep, ...)
+// or fetched early by read-ahead do not go back to the device.
+// Clusters are spread over shards by number, each with its own lock and CLOCK eviction over a fixed set of slots,
+// so scanning threads rarely contend and neither hits nor insertions allocate.
+class ClusterCache
+{
+public:
+  static constexpr std::size_t shardCount{16};
+
+  // Counters since the cache was last configured.
+  struct Stats
+  {
+    uint64_t hits{};
+    uint64_t misses{};
+    uint64_t insertions{};
+    uint64_t readAhead{}; // Insertions made ahead of any request for them.
+    uint64_t evictions{};
+  };
+
+private:
+  struct Shard
+  {
+    mutable std::mutex mutex{};
+    std::unordered_map<uint32_t, std::size_t> slotOf{}; // Cluster held in each used slot.
+    std::vector<uint32_t> slotClusters{};                // Cluster of each slot, 0 (never a data cluster) when empty.
+    std::vector<uint8_t> referenced{};                   // CLOCK reference bits, set on every hit.
+    std::unique_ptr<uint8_t[]> data{};                   // Slot contents, left uninitialized so unused slots take no memory.
+    std::size_t hand{};
+    Stats stats{};
+  };
+
+  std::array<Shard, shardCount> shards{};
+  std::size_t clusterSize{};
+  std::size_t slotsPerShard{};
+
+  Shard &shardOf(const uint32_t cluster) { return shards[cluster % shardCount]; }
+
+public:
+  // Default constructor, a disabled cache.
+  ClusterCache() = default;
+
+  // Disabled copy and move semantics.
+  ClusterCache(const ClusterCache &) = delete;
+  ClusterCache &operator=(const ClusterCache &) = delete;
+
+  // Destructor.
+  ~ClusterCache() = default;
+
+  // Public method emptying the cache and sizing it for clusters of clusterBytes, holding at most budget bytes of them.
+  // A budget below one cluster per shard disables it. Not safe to call while other threads use the cache.
+  void configure(const std::size_t clusterBytes, const std::size_t budget);
+
+  // Public method copying a cluster into out (one cluster long) if cached, returns whether it was.
+  bool lookup(const uint32_t cluster, std::span<uint8_t> out);
+
+  // Public method checking whether a cluster is cached, without counting a hit or a miss.
+  bool contains(const uint32_t cluster) const;
+
+  // Public method storing a cluster (one cluster long), taking the slot of a cluster not used since the hand last passed.
+  void insert(const uint32_t cluster, std::span<const uint8_t> content, const bool readAhead = false);
+
+  // Public getters.
+  bool isEnabled() const { return slotsPerShard != 0; }
+  std::size_t getCapacity() const { return slotsPerShard * shardCount; } // In clusters.
+  Stats getStats() const;
+};
@@ -0,0 +1,607 @@
+#include "ContentValidator.h"
+#include <algorithm>
+#include <array>
+#include <cctype>
+#include <cstring>
+#include <vector>
+
+namespace
+{
+  uint16_t readBigEndian16(const uint8_t *bytes)
+  {
+    return static_cast<uint16_t>((bytes[0] << 8) | bytes[1]);
+  }
+
+  uint32_t readBigEndian32(const uint8_t *bytes)
+  {
+    return (static_cast<uint32_t>(bytes[0]) << 24) | (static_cast<uint32_t>(bytes[1]) << 16) | (static_cast<uint32_t>(bytes[2]) << 8) | bytes[3];
+  }
+
+  uint16_t readLittleEndian16(const uint8_t *bytes)
+  {
+    return static_cast<uint16_t>(bytes[0] | (bytes[1] << 8));
+  }
+
+  uint32_t readLittleEndian32(const uint8_t *bytes)
+  {
+    return bytes[0] | (static_cast<uint32_t>(bytes[1]) << 8) | (static_cast<uint32_t>(bytes[2]) << 16) | (static_cast<uint32_t>(bytes[3]) << 24);
+  }
+
+  uint64_t readLittleEndian64(const uint8_t *bytes)
+  {
+    return readLittleEndian32(bytes) | (static_cast<uint64_t>(readLittleEndian32(bytes + 4)) << 32);
+  }
+
+  // Validators walking a format made of headers and bodies: a subclass asks for a header of some bytes
+  // (handed whole to onHeader, whatever chunks it arrived in), for a body of some bytes
+  // (streamed to onBody, then onBodyEnd), to scan bytes itself (onScan) or to stop checking.
+  class StructureValidator : public ContentValidator
+  {
+  private:
+    enum class Mode
+    {
+      Header,
+      Body,
+      Scan,
+      Done,
+    };
+
+    Mode mode{Mode::Header};
+    std::vector<uint8_t> header{};
+    std::size_t headerSize{};
+    uint64_t headerOffset{};
+    uint64_t bodyLeft{};
+
+  protected:
+    void expectHeader(const std::size_t size)
+    {
+      mode = Mode::Header;
+      header.clear();
+      headerSize = size;
+    }
+
+    void expectBody(const uint64_t size, const uint64_t offset)
+    {
+      mode = Mode::Body;
+      bodyLeft = size;
+      if (size == 0)
+        onBodyEnd(offset);
+    }
+
+    void startScan() { mode = Mode::Scan; }
+    void stop() { mode = Mode::Done; }
+    bool isDone() const { return mode == Mode::Done; }
+
+    virtual void onHeader(std::span<const uint8_t> bytes, const uint64_t offset) = 0;
+    virtual void onBody(std::span<const uint8_t>, const uint64_t) {}
+    virtual void onBodyEnd(const uint64_t) {}
+    virtual std::size_t onScan(std::span<const uint8_t> data, const uint64_t) { return data.size(); }
+
+    void check(std::span<const uint8_t> data, uint64_t offset) override
+    {
+      while (!data.empty() && isValid() && mode != Mode::Done)
+      {
+        std::size_t consumed{0};
+        switch (mode)
+        {
+        case Mode::Header:
+          if (header.empty())
+            headerOffset = offset;
+          consumed = std::min(headerSize - header.size(), data.size());
+          header.insert(header.end(), data.begin(), data.begin() + static_cast<std::ptrdiff_t>(consumed));
+          if (header.size() == headerSize)
+          {
+            std::vector<uint8_t> bytes{std::move(header)};
+            header.clear();
+            onHeader(bytes, headerOffset);
+          }
+          break;
+        case Mode::Body:
+          consumed = static_cast<std::size_t>(std::min<uint64_t>(bodyLeft, data.size()));
+          onBody(data.first(consumed), offset);
+          bodyLeft -= consumed;
+          if (bodyLeft == 0)
+            onBodyEnd(offset + consumed);
+          break;
+        case Mode::Scan:
+          consumed = onScan(data, offset);
+          break;
+        case Mode::Done:
+          break;
+        }
+        data = data.subspan(consumed);
+        offset += consumed;
+      }
+    }
+  };
+
+  // JPEG: markers and segment lengths from SOI to EOI, and the entropy-coded data after each start of scan,
+  // where 0xFF may only be stuffed (0xFF00), a restart marker in sequence, or the next marker.
+  // Random data breaks one of these within a few hundred bytes.
+  class JpegValidator : public StructureValidator
+  {
+  private:
+    enum class State
+    {
+      Start,
+      Marker,
+      MarkerCode,
+      Length,
+      Segment,
+      ScanHeader,
+    };
+
+    State state{State::Start};
+    uint8_t segmentMarker{};
+    bool pendingFF{false};
+    uint8_t restartCount{};
+
+    static bool isSegmentMarker(const uint8_t code)
+    {
+      return (code >= 0xC0 && code <= 0xCF && code != 0xC8) || (code >= 0xDA && code <= 0xDF) || (code >= 0xE0 && code <= 0xEF) || code == 0xFE;
+    }
+
+    void onMarker(const uint8_t code, const uint64_t offset)
+    {
+      if (code == 0xFF)
+      {
+        state = State::MarkerCode;
+        expectHeader(1);
+      }
+      else if (code == 0xD9)
+        stop();
+      else if (code == 0x01 || (code >= 0xD0 && code <= 0xD7))
+      {
+        state = State::Marker;
+        expectHeader(2);
+      }
+      else if (isSegmentMarker(code))
+      {
+        segmentMarker = code;
+        state = State::Length;
+        expectHeader(2);
+      }
+      else
+        fail(offset, "Invalid JPEG marker");
+    }
+
+  protected:
+    void onHeader(std::span<const uint8_t> bytes, const uint64_t offset) override
+    {
+      switch (state)
+      {
+      case State::Start:
+        if (bytes[0] != 0xFF || bytes[1] != 0xD8)
+          return fail(offset, "Missing JPEG start of image");
+        state = State::Marker;
+        return expectHeader(2);
+      case State::Marker:
+        if (bytes[0] != 0xFF)
+          return fail(offset, "Expected a JPEG marker");
+        return onMarker(bytes[1], offset);
+      case State::MarkerCode:
+        return onMarker(bytes[0], offset);
+      case State::Length:
+      {
+        uint16_t length{readBigEndian16(bytes.data())};
+        if (length < 2)
+          return fail(offset, "Invalid JPEG segment length");
+        state = segmentMarker == 0xDA ? State::ScanHeader : State::Segment;
+        return expectBody(length - 2u, offset + 2);
+      }
+      default:
+        return;
+      }
+    }
+
+    void onBodyEnd(const uint64_t) override
+    {
+      if (state == State::ScanHeader)
+      {
+        pendingFF = false;
+        restartCount = 0;
+        return startScan();
+      }
+      state = State::Marker;
+      expectHeader(2);
+    }
+
+    std::size_t onScan(std::span<const uint8_t> data, const uint64_t offset) override
+    {
+      std::size_t index{0};
+      while (index < data.size())
+      {
+        if (!pendingFF)
+        {
+          const void *found{std::memchr(data.data() + index, 0xFF, data.size() - index)};
+          if (found == nullptr)
+            return data.size();
+          index = static_cast<std::size_t>(static_cast<const uint8_t *>(found) - data.data()) + 1;
+          pendingFF = true;
+          continue;
+        }
+
+        uint8_t code{data[index]};
+        if (code == 0x00 || code == 0xFF)
+        {
+          pendingFF = code == 0xFF;
+          ++index;
+          continue;
+        }
+        pendingFF = false;
+        if (code >= 0xD0 && code <= 0xD7)
+        {
+          if (code != 0xD0 + (restartCount++ & 7))
+          {
+            fail(offset + index - 1, "JPEG restart marker out of sequence");
+            return index;
+          }
+          ++index;
+          continue;
+        }
+
+        // A marker ends the scan, handled as if it came after a segment.
+        onMarker(code, offset + index - 1);
+        return index + 1;
+      }
+      return index;
+    }
+
+    void checkEnd(const uint64_t size) override
+    {
+      if (!isDone())
+        fail(size, "JPEG ends before end of image");
+    }
+
+  public:
+    JpegValidator() { expectHeader(2); }
+  };
+
+  // PNG: signature, then chunks, each one's CRC checked over its type and data, IHDR first and IEND last.
+  class PngValidator : public StructureValidator
+  {
+  private:
+    enum class State
+    {
+      Signature,
+      ChunkHeader,
+      ChunkCrc,
+    };
+
+    static constexpr std::array<uint32_t, 256> crcTable{[]
+                                                        {
+                                                          std::array<uint32_t, 256> table{};
+                                                          for (uint32_t i{0}; i < 256; ++i)
+                                                          {
+                                                            uint32_t crc{i};
+                                                            for (int bit{0}; bit < 8; ++bit)
+                                                              crc = (crc & 1) != 0 ? 0xEDB88320 ^ (crc >> 1) : crc >> 1;
+                                                            table[i] = crc;
+                                                          }
+                                                          return table;
+                                                        }()};
+
+    State state{State::Signature};
+    uint32_t crc{};
+    uint64_t chunkOffset{};
+    bool isFirstChunk{true};
+    bool isLastChunk{false};
+
+    void updateCrc(std::span<const uint8_t> data)
+    {
+      for (const auto byte : data)
+        crc = crcTable[(crc ^ byte) & 0xFF] ^ (crc >> 8);
+    }
+
+  protected:
+    void onHeader(std::span<const uint8_t> bytes, const uint64_t offset) override
+    {
+      switch (state)
+      {
+      case State::Signature:
+        if (std::memcmp(bytes.data(), "\x89PNG\r\n\x1A\n", 8) != 0)
+          return fail(offset, "Missing PNG signature");
+        state = State::ChunkHeader;
+        return expectHeader(8);
+      case State::ChunkHeader:
+      {
+        uint32_t length{readBigEndian32(bytes.data())};
+        std::span<const uint8_t> type{bytes.subspan(4, 4)};
+        if (length > 0x7FFFFFFF || !std::all_of(type.begin(), type.end(), [](const uint8_t character)
+                                                { return std::isalpha(character) != 0; }))
+          return fail(offset, "Invalid PNG chunk header");
+        if (isFirstChunk && std::memcmp(type.data(), "IHDR", 4) != 0)
+          return fail(offset, "PNG does not start with IHDR");
+        isFirstChunk = false;
+        isLastChunk = std::memcmp(type.data(), "IEND", 4) == 0;
+        chunkOffset = offset;
+        crc = 0xFFFFFFFF;
+        updateCrc(type);
+        return expectBody(length, offset + 8);
+      }
+      case State::ChunkCrc:
+        if (readBigEndian32(bytes.data()) != (crc ^ 0xFFFFFFFF))
+          return fail(chunkOffset, "PNG chunk CRC mismatch");
+        if (isLastChunk)
+          return stop();
+        state = State::ChunkHeader;
+        return expectHeader(8);
+      }
+    }
+
+    void onBody(std::span<const uint8_t> data, const uint64_t) override
+    {
+      updateCrc(data);
+    }
+
+    void onBodyEnd(const uint64_t) override
+    {
+      state = State::ChunkCrc;
+      expectHeader(4);
+    }
+
+    void checkEnd(const uint64_t size) override
+    {
+      if (!isDone())
+        fail(size, "PNG ends before IEND");
+    }
+
+  public:
+    PngValidator() { expectHeader(8); }
+  };
+
+  // ZIP: local file records back to back, then the central directory, whose entries have to point
+  // at local records that were seen, then the end of central directory record, which has to point
+  // at the central directory and count its entries.
+  class ZipValidator : public StructureValidator
+  {
+  private:
+    enum class State
+    {
+      Signature,
+      LocalHeader,
+      LocalNames,
+      Descriptor,
+      DescriptorSizes,
+      CentralHeader,
+      Zip64End,
+      EndRecord,
+      SkippedRecord,
+    };
+
+    static constexpr uint8_t descriptorSignature[4]{'P', 'K', 7, 8};
+
+    State state{State::Signature};
+    uint64_t recordOffset{};
+    std::vector<uint64_t> localOffsets{}; // In file order, so sorted.
+    uint64_t centralOffset{UINT64_MAX};
+    uint64_t centralEntries{};
+    bool hasZip64End{false};
+
+    // Current local record.
+    uint16_t flags{};
+    uint64_t compressedSize{};
+    uint16_t namesSize{};
+    bool isZip64{false};
+    uint64_t dataOffset{};
+    std::size_t descriptorMatched{}; // Bytes of the descriptor signature matched so far while scanning.
+    bool descriptorScanned{false};   // Whether the descriptor was found by scanning, its size still has to match.
+
+    void expectSignature()
+    {
+      state = State::Signature;
+      expectHeader(4);
+    }
+
+    void afterData()
+    {
+      // Sizes follow the data when flag bit 3 is set, after an optional signature.
+      if ((flags & 0x08) != 0)
+      {
+        state = State::Descriptor;
+        return expectHeader(4);
+      }
+      expectSignature();
+    }
+
+  protected:
+    void onHeader(std::span<const uint8_t> bytes, const uint64_t offset) override
+    {
+      switch (state)
+      {
+      case State::Signature:
+      {
+        recordOffset = offset;
+        uint32_t signature{readLittleEndian32(bytes.data())};
+        if (signature == 0x04034B50 && centralOffset == UINT64_MAX)
+        {
+          localOffsets.push_back(offset);
+          state = State::LocalHeader;
+          return expectHeader(26);
+        }
+        if (signature == 0x02014B50)
+        {
+          centralOffset = std::min(centralOffset, offset);
+          state = State::CentralHeader;
+          return expectHeader(42);
+        }
+        if (signature == 0x06064B50)
+        {
+          hasZip64End = true;
+          state = State::Zip64End;
+          return expectHeader(8);
+        }
+        if (signature == 0x07064B50)
+        {
+          state = State::SkippedRecord;
+          return expectBody(16, offset + 4);
+        }
+        if (signature == 0x06054B50)
+        {
+          state = State::EndRecord;
+          return expectHeader(18);
+        }
+        return fail(offset, "Unexpected ZIP record signature");
+      }
+      case State::LocalHeader:
+        flags = readLittleEndian16(bytes.data() + 2);
+        compressedSize = readLittleEndian32(bytes.data() + 14);
+        isZip64 = compressedSize == 0xFFFFFFFF;
+        namesSize = static_cast<uint16_t>(readLittleEndian16(bytes.data() + 22) + readLittleEndian16(bytes.data() + 24));
+        state = State::LocalNames;
+        if (namesSize == 0)
+          return onHeader({}, offset + 26);
+        return expectHeader(namesSize);
+      case State::LocalNames:
+      {
+        // ZIP64 sizes are in the extra field (ID 1: uncompressed then compressed size), after the name.
+        if (isZip64)
+        {
+          bool found{false};
+          for (std::size_t position{0}; position + 4 <= bytes.size();)
+          {
+            uint16_t id{readLittleEndian16(bytes.data() + position)};
+            uint16_t size{readLittleEndian16(bytes.data() + position + 2)};
+            if (id == 1 && size >= 16 && position + 4 + size <= bytes.size())
+            {
+              compressedSize = readLittleEndian64(bytes.data() + position + 12);
+              found = true;
+              break;
+            }
+            position += 4 + static_cast<std::size_t>(size);
+          }
+          if (!found && (flags & 0x08) == 0)
+            return fail(recordOffset, "ZIP64 record without its sizes");
+        }
+        dataOffset = offset + bytes.size();
+
+        // Streamed entries only give their size after the data, which then has to be scanned for the descriptor.
+        descriptorScanned = (flags & 0x08) != 0 && compressedSize == 0;
+        if (descriptorScanned)
+        {
+          descriptorMatched = 0;
+          return startScan();
+        }
+        return expectBody(compressedSize, dataOffset);
+      }
+      case State::Descriptor:
+        // Without its signature, these 4 bytes were the CRC already.
+        state = State::DescriptorSizes;
+        return expectHeader(std::memcmp(bytes.data(), descriptorSignature, 4) == 0 ? (isZip64 ? 20 : 12) : (isZip64 ? 16 : 8));
+      case State::DescriptorSizes:
+        // A scanned signature may be a chance match inside the data, then the sizes do not match and scanning goes on.
+        if (descriptorScanned && readLittleEndian32(bytes.data() + 4) != compressedSize)
+          return startScan();
+        return expectSignature();
+      case State::CentralHeader:
+      {
+        uint32_t localOffset{readLittleEndian32(bytes.data() + 38)};
+        if (localOffset != 0xFFFFFFFF && !std::binary_search(localOffsets.begin(), localOffsets.end(), localOffset))
+          return fail(recordOffset, "ZIP central directory entry points at no local record");
+        ++centralEntries;
+        state = State::SkippedRecord;
+        return expectBody(static_cast<uint64_t>(readLittleEndian16(bytes.data() + 24)) + readLittleEndian16(bytes.data() + 26) + readLittleEndian16(bytes.data() + 28), offset + 42);
+      }
+      case State::Zip64End:
+        state = State::SkippedRecord;
+        return expectBody(readLittleEndian64(bytes.data()), offset + 8);
+      case State::EndRecord:
+      {
+        uint16_t entryCount{readLittleEndian16(bytes.data() + 6)};
+        uint32_t directorySize{readLittleEndian32(bytes.data() + 8)};
+        uint32_t directoryOffset{readLittleEndian32(bytes.data() + 12)};
+        uint64_t directoryStart{centralOffset == UINT64_MAX ? recordOffset : centralOffset};
+        if ((entryCount != 0xFFFF && entryCount != centralEntries) || (directoryOffset != 0xFFFFFFFF && directoryOffset != directoryStart) ||
+            (!hasZip64End && directorySize != recordOffset - directoryStart))
+          return fail(recordOffset, "ZIP end of central directory does not match the central directory");
+        return stop();
+      }
+      case State::SkippedRecord:
+        return;
+      }
+    }
+
+    void onBodyEnd(const uint64_t) override
+    {
+      if (state == State::LocalNames)
+        return afterData();
+      expectSignature();
+    }
+
+    std::size_t onScan(std::span<const uint8_t> data, const uint64_t offset) override
+    {
+      // Look for the descriptor signature, carrying a partial match over from the previous chunk.
+      for (std::size_t index{0}; index < data.size(); ++index)
+      {
+        if (data[index] == descriptorSignature[descriptorMatched])
+          ++descriptorMatched;
+        else
+          descriptorMatched = data[index] == descriptorSignature[0] ? 1 : 0;
+
+        if (descriptorMatched == 4)
+        {
+          // Its compressed size is checked against the data length once read, see DescriptorSizes.
+          compressedSize = offset + index + 1 - 4 - dataOffset;
+          descriptorMatched = 0;
+          state = State::DescriptorSizes;
+          expectHeader(isZip64 ? 20 : 12);
+          return index + 1;
+        }
+      }
+      return data.size();
+    }
+
+    void checkEnd(const uint64_t size) override
+    {
+      if (!isDone())
+        fail(size, "ZIP ends before end of central directory");
+    }
+
+  public:
+    ZipValidator() { expectHeader(4); }
+  };
+}
+
+void ContentValidator::fail(const uint64_t offset, std::string reason)
+{
+  if (failed)
+    return;
+  failed = true;
+  failureOffset = offset;
+  failureReason = std::move(reason);
+}
+
+bool ContentValidator::update(std::span<const uint8_t> data)
+{
+  if (!failed)
+    check(data, position);
+  position += data.size();
+  return !failed;
+}
+
+bool ContentValidator::finish()
+{
+  if (!failed)
+    checkEnd(position);
+  return !failed;
+}
+
+std::unique_ptr<ContentValidator> ContentValidator::forFileName(const std::string_view fileName)
+{
+  std::size_t dot{fileName.rfind('.')};
+  if (dot == std::string_view::npos)
+    return nullptr;
+  std::string extension{fileName.substr(dot + 1)};
+  for (auto &character : extension)
+    character = static_cast<char>(std::tolower(static_cast<unsigned char>(character)));
+
+  static constexpr std::array<std::string_view, 4> jpegExtensions{"jpg", "jpeg", "jpe", "jfif"};
+  static constexpr std::array<std::string_view, 12> zipExtensions{"zip", "jar", "apk", "epub", "docx", "xlsx", "pptx", "odt", "ods", "odp", "xpi", "cbz"};
+  if (std::find(jpegExtensions.begin(), jpegExtensions.end(), extension) != jpegExtensions.end())
+    return std::make_unique<JpegValidator>();
+  if (extension == "png")
+    return std::make_unique<PngValidator>();
+  if (std::find(zipExtensions.begin(), zipExtensions.end(), extension) != zipExtensions.end())
+    return std::make_unique<ZipValidator>();
+  return nullptr;
+}
@@ -0,0 +1,59 @@
+#pragma once
+#include <cstdint>
+#include <functional>
+#include <memory>
+#include <span>
+#include <string>
+#include <string_view>
+
+// Checks a recovered file's content while it's streamed out, chunk by chunk as RecoveryWriter writes it,
+// so a file whose data stops making sense is caught at the byte (and so the cluster) where it breaks,
+// without holding the file in memory or reading it back. Validators know one format each,
+// walking its structure and checking whatever that format lets them check along the way.
+class ContentValidator
+{
+public:
+  // Creates the validator for a file name, or none when no validator knows its format.
+  using Factory = std::function<std::unique_ptr<ContentValidator>(std::string_view fileName)>;
+
+private:
+  uint64_t position{};   // Bytes fed so far.
+  bool failed{false};
+  uint64_t failureOffset{};
+  std::string failureReason{};
+
+protected:
+  // Protected method marking the content invalid from offset on, only the first failure is kept.
+  void fail(const uint64_t offset, std::string reason);
+
+  // Protected methods implemented by each format: check the next bytes of the file, starting at offset,
+  // and check the file may end at size. Not called anymore once the content failed.
+  virtual void check(std::span<const uint8_t> data, const uint64_t offset) = 0;
+  virtual void checkEnd(const uint64_t size) = 0;
+
+public:
+  // Default constructor.
+  ContentValidator() = default;
+
+  // Disabled copy and move semantics.
+  ContentValidator(const ContentValidator &) = delete;
+  ContentValidator &operator=(const ContentValidator &) = delete;
+
+  // Destructor.
+  virtual ~ContentValidator() = default;
+
+  // Public method feeding the next bytes of the file, returns whether the content is still valid.
+  bool update(std::span<const uint8_t> data);
+
+  // Public method telling the file ended, returns whether the content is valid.
+  bool finish();
+
+  // Public getters, the failure is only meaningful once isValid returned false.
+  bool isValid() const { return !failed; }
+  uint64_t getFailureOffset() const { return failureOffset; }
+  const std::string &getFailureReason() const { return failureReason; }
+
+  // Public method for the default factory: JPEG marker walk (.jpg, .jpeg, ...), PNG chunk CRCs (.png)
+  // and ZIP records against their central directory (.zip, .docx, .jar, ...), by extension, case-insensitive.
+  static std::unique_ptr<ContentValidator> forFileName(const std::string_view fileName);
+};
@@ -0,0 +1,148 @@
+#include "DeletedEntryCatalogue.h"
+#include "EntryName.h"
+
+uint32_t DeletedEntryCatalogue::addPath(const std::string_view path, const uint32_t directoryCluster)
+{
+  pathOffsets.push_back(pathPool.size());
+  pathLengths.push_back(static_cast<uint32_t>(path.size()));
+  pathPool += path;
+  pathClusters.push_back(directoryCluster);
+  return static_cast<uint32_t>(pathOffsets.size() - 1);
+}
+
+void DeletedEntryCatalogue::add(std::span<const FAT32Entry> entry, const uint32_t pathIndex)
+{
+  if (entry.empty())
+    throw std::runtime_error{"Empty entry added to catalogue"};
+  if (pathIndex >= pathOffsets.size())
+    throw std::runtime_error{"Path of entry not in catalogue"};
+
+  // Name first, it throws for entries that are neither file nor directory.
+  std::size_t nameStart{namePool.size()};
+  appendEntryName(entry, namePool);
+  nameOffsets.push_back(nameStart);
+  nameLengths.push_back(static_cast<uint32_t>(namePool.size() - nameStart));
+
+  const FAT32Entry &mainEntry{entry.back()};
+  slotOffsets.push_back(slots.size());
+  slotCounts.push_back(static_cast<uint32_t>(entry.size()));
+  slots.insert(slots.end(), entry.begin(), entry.end());
+
+  firstClusters.push_back((static_cast<uint32_t>(mainEntry.firstClusterHigh) << 16) | mainEntry.firstClusterLow);
+  sizes.push_back(mainEntry.size);
+  attributes.push_back(mainEntry.attributes);
+  recoverability.push_back(0);
+
+  pathIndices.push_back(pathIndex);
+}
+
+void DeletedEntryCatalogue::removeLast()
+{
+  if (empty())
+    return;
+
+  slots.resize(static_cast<std::size_t>(slotOffsets.back()));
+  slotOffsets.pop_back();
+  slotCounts.pop_back();
+  firstClusters.pop_back();
+  sizes.pop_back();
+  attributes.pop_back();
+  recoverability.pop_back();
+  namePool.resize(static_cast<std::size_t>(nameOffsets.back()));
+  nameOffsets.pop_back();
+  nameLengths.pop_back();
+  pathIndices.pop_back();
+}
+
+void DeletedEntryCatalogue::append(const DeletedEntryCatalogue &other)
+{
+  uint64_t slotBase{slots.size()};
+  uint64_t nameBase{namePool.size()};
+  uint64_t pathBase{pathPool.size()};
+  uint32_t pathIndexBase{static_cast<uint32_t>(pathOffsets.size())};
+
+  slots.insert(slots.end(), other.slots.begin(), other.slots.end());
+  for (const auto offset : other.slotOffsets)
+    slotOffsets.push_back(slotBase + offset);
+  slotCounts.insert(slotCounts.end(), other.slotCounts.begin(), other.slotCounts.end());
+
+  firstClusters.insert(firstClusters.end(), other.firstClusters.begin(), other.firstClusters.end());
+  sizes.insert(sizes.end(), other.sizes.begin(), other.sizes.end());
+  attributes.insert(attributes.end(), other.attributes.begin(), other.attributes.end());
+  recoverability.insert(recoverability.end(), other.recoverability.begin(), other.recoverability.end());
+
+  namePool += other.namePool;
+  for (const auto offset : other.nameOffsets)
+    nameOffsets.push_back(nameBase + offset);
+  nameLengths.insert(nameLengths.end(), other.nameLengths.begin(), other.nameLengths.end());
+
+  for (const auto pathIndex : other.pathIndices)
+    pathIndices.push_back(pathIndexBase + pathIndex);
+  pathPool += other.pathPool;
+  for (const auto offset : other.pathOffsets)
+    pathOffsets.push_back(pathBase + offset);
+  pathLengths.insert(pathLengths.end(), other.pathLengths.begin(), other.pathLengths.end());
+  pathClusters.insert(pathClusters.end(), other.pathClusters.begin(), other.pathClusters.end());
+}
+
+void DeletedEntryCatalogue::score(const FatIndex &freeClusters, const LiveChainIndex &liveChains, const uint32_t bytesPerCluster)
+{
+  if (bytesPerCluster == 0)
+    throw std::runtime_error{"Invalid cluster size for scoring"};
+
+  // One pass over the first cluster, size and attribute columns, two binary searches per entry.
+  for (std::size_t i{0}; i < firstClusters.size(); ++i)
+  {
+    uint32_t first{firstClusters[i]};
+    bool isDir{(attributes[i] & 0x10) == 0x10};
+    uint64_t clusterCount{isDir ? 1 : (static_cast<uint64_t>(sizes[i]) + bytesPerCluster - 1) / bytesPerCluster};
+    if (clusterCount == 0)
+    {
+      recoverability[i] = 100;
+      continue;
+    }
+    if (first < 2 || first >= freeClusters.getEndCluster())
+    {
+      recoverability[i] = 0;
+      continue;
+    }
+
+    // Clusters past the end of the volume are lost either way.
+    uint32_t count{static_cast<uint32_t>(std::min<uint64_t>(clusterCount, freeClusters.getEndCluster() - first))};
+    uint32_t kept{freeClusters.isFree(first) ? freeClusters.countFree(first, count) : count - liveChains.countClaimed(first, count)};
+    recoverability[i] = static_cast<uint8_t>(uint64_t{kept} * 100 / clusterCount);
+  }
+}
+
+void DeletedEntryCatalogue::clear()
+{
+  slots.clear();
+  slotOffsets.clear();
+  slotCounts.clear();
+  firstClusters.clear();
+  sizes.clear();
+  attributes.clear();
+  recoverability.clear();
+  namePool.clear();
+  nameOffsets.clear();
+  nameLengths.clear();
+  pathIndices.clear();
+  pathPool.clear();
+  pathOffsets.clear();
+  pathLengths.clear();
+  pathClusters.clear();
+}
+
+void DeletedEntryCatalogue::reserve(const std::size_t entryCount, const std::size_t slotCount)
+{
+  slots.reserve(slotCount);
+  slotOffsets.reserve(entryCount);
+  slotCounts.reserve(entryCount);
+  firstClusters.reserve(entryCount);
+  sizes.reserve(entryCount);
+  attributes.reserve(entryCount);
+  recoverability.reserve(entryCount);
+  nameOffsets.reserve(entryCount);
+  nameLengths.reserve(entryCount);
+  pathIndices.reserve(entryCount);
+}
@@ -0,0 +1,103 @@
+#pragma once
+#include "Fat32.h"
+#include "FatIndex.h"
+#include "LiveChainIndex.h"
+#include <string>
+
+// Deleted entries found by a scan, stored as a struct of arrays:
+// the raw directory entries of every deleted entry back to back in one arena,
+// one array per decoded field, and names and directory paths in string pools.
+// Adding an entry only appends to these arrays, so a scan costs a handful of allocations overall
+// instead of one per entry, and filtering on a field reads that field's array alone.
+class DeletedEntryCatalogue
+{
+private:
+  // Entry i owns slots [slotOffsets[i], slotOffsets[i] + slotCounts[i]),
+  // long file name entries first and the main file/directory entry last.
+  std::vector<FAT32Entry> slots{};
+  std::vector<uint64_t> slotOffsets{};
+  std::vector<uint32_t> slotCounts{};
+
+  // Decoded from each main entry.
+  std::vector<uint32_t> firstClusters{};
+  std::vector<uint32_t> sizes{};
+  std::vector<uint8_t> attributes{};
+
+  // Percentage of entry i's clusters still free, see score.
+  std::vector<uint8_t> recoverability{};
+
+  // Entry i's name is namePool [nameOffsets[i], nameOffsets[i] + nameLengths[i]).
+  std::string namePool{};
+  std::vector<uint64_t> nameOffsets{};
+  std::vector<uint32_t> nameLengths{};
+
+  // Directory path of entry i is path #pathIndices[i], stored the same way as names.
+  std::vector<uint32_t> pathIndices{};
+  std::string pathPool{};
+  std::vector<uint64_t> pathOffsets{};
+  std::vector<uint32_t> pathLengths{};
+
+  // First cluster of the directory each path was scanned from, tells apart directories shown under the same path
+  // (deleted short names lose their first character).
+  std::vector<uint32_t> pathClusters{};
+
+public:
+  // Default constructor, an empty catalogue.
+  DeletedEntryCatalogue() = default;
+
+  // Public method adding the path of the directory starting at directoryCluster, returns its index for add.
+  uint32_t addPath(const std::string_view path, const uint32_t directoryCluster);
+
+  // Public method adding an entry (long file name entries then main entry) and the index of its directory path,
+  // its name is decoded straight into the name pool.
+  void add(std::span<const FAT32Entry> entry, const uint32_t pathIndex);
+
+  // Public method removing the entry added last, e.g. once its decoded name turned out not to be wanted.
+  void removeLast();
+
+  // Public method appending every entry and path of another catalogue.
+  void append(const DeletedEntryCatalogue &other);
+
+  // Public method scoring how recoverable every entry is, as the percentage of its candidate clusters
+  // (those its size takes from its first cluster on, one for a directory) nobody else holds now.
+  // With its first cluster free, the chain was zeroed and any cluster allocated since (freeClusters) is lost;
+  // with it allocated, the chain may still be the entry's own and only clusters of live entries (liveChains) are lost.
+  // Empty files score 100, entries without a valid first cluster 0. Entries added afterwards score 0 until the next call.
+  void score(const FatIndex &freeClusters, const LiveChainIndex &liveChains, const uint32_t bytesPerCluster);
+
+  // Public method removing every entry and path, keeping allocated memory.
+  void clear();
+
+  // Public method reserving room for entryCount entries made of slotCount directory entries in total.
+  void reserve(const std::size_t entryCount, const std::size_t slotCount);
+
+  // Public getters of one entry, index has to be below size().
+  std::span<const FAT32Entry> getSlots(const std::size_t index) const { return std::span<const FAT32Entry>{slots}.subspan(static_cast<std::size_t>(slotOffsets[index]), slotCounts[index]); }
+  const FAT32Entry &getMainEntry(const std::size_t index) const { return slots[static_cast<std::size_t>(slotOffsets[index]) + slotCounts[index] - 1]; }
+  uint32_t getFirstCluster(const std::size_t index) const { return firstClusters[index]; }
+  uint32_t getSize(const std::size_t index) const { return sizes[index]; }
+  uint8_t getAttributes(const std::size_t index) const { return attributes[index]; }
+  bool isDirectory(const std::size_t index) const { return (attributes[index] & 0x10) == 0x10; }
+  uint8_t getRecoverability(const std::size_t index) const { return recoverability[index]; }
+  std::string_view getName(const std::size_t index) const { return std::string_view{namePool}.substr(static_cast<std::size_t>(nameOffsets[index]), nameLengths[index]); }
+  uint32_t getPathIndex(const std::size_t index) const { return pathIndices[index]; }
+  std::string_view getPath(const std::size_t index) const { return getPathAt(pathIndices[index]); }
+  uint32_t getPathCluster(const std::size_t index) const { return pathClusters[pathIndices[index]]; }
+
+  // Public getters of the path table.
+  std::size_t getPathCount() const { return pathOffsets.size(); }
+  std::string_view getPathAt(const uint32_t pathIndex) const { return std::string_view{pathPool}.substr(static_cast<std::size_t>(pathOffsets[pathIndex]), pathLengths[pathIndex]); }
+  uint32_t getPathClusterAt(const uint32_t pathIndex) const { return pathClusters[pathIndex]; }
+
+  // Public getters of whole columns, for passes over every entry.
+  std::size_t size() const { return firstClusters.size(); }
+  bool empty() const { return firstClusters.empty(); }
+  std::span<const FAT32Entry> getAllSlots() const { return slots; }
+  std::span<const uint64_t> getSlotOffsets() const { return slotOffsets; }
+  std::span<const uint32_t> getSlotCounts() const { return slotCounts; }
+  std::span<const uint32_t> getFirstClusters() const { return firstClusters; }
+  std::span<const uint32_t> getSizes() const { return sizes; }
+  std::span<const uint8_t> getAttributeColumn() const { return attributes; }
+  std::span<const uint8_t> getRecoverabilityColumn() const { return recoverability; }
+  std::span<const uint32_t> getPathIndices() const { return pathIndices; }
+};
@@ -0,0 +1,127 @@
+#include "DirectoryClassifier.h"
+#if defined(__SSE2__)
+#include <emmintrin.h>
+#endif
+
+namespace
+{
+  constexpr std::size_t bytesPerEntry{32};
+
+  // Bit i set when byte i of the 16 bytes at slot is a control character (< 0x20) or a lower-case letter,
+  // neither of which may appear in a short name.
+  uint32_t badShortNameBytes(const uint8_t *slot)
+  {
+#if defined(__SSE2__)
+    // SSE2 only compares signed bytes, flipping the top bit turns them into unsigned comparisons.
+    const __m128i flip{_mm_set1_epi8(static_cast<char>(0x80))};
+    __m128i bytes{_mm_xor_si128(_mm_loadu_si128(reinterpret_cast<const __m128i *>(slot)), flip)};
+    __m128i control{_mm_cmplt_epi8(bytes, _mm_set1_epi8(static_cast<char>(0x20 ^ 0x80)))};
+    __m128i lower{_mm_and_si128(_mm_cmpgt_epi8(bytes, _mm_set1_epi8(static_cast<char>(('a' - 1) ^ 0x80))),
+                                _mm_cmplt_epi8(bytes, _mm_set1_epi8(static_cast<char>(('z' + 1) ^ 0x80))))};
+    return static_cast<uint32_t>(_mm_movemask_epi8(_mm_or_si128(control, lower)));
+#else
+    uint32_t mask{0};
+    for (std::size_t i{0}; i < 16; ++i)
+      if (slot[i] < 0x20 || (slot[i] >= 'a' && slot[i] <= 'z'))
+        mask |= 1u << i;
+    return mask;
+#endif
+  }
+
+  // Whether every byte in [data, data + size) is zero, size being a multiple of 16.
+  bool allZero(const uint8_t *data, const std::size_t size)
+  {
+#if defined(__SSE2__)
+    __m128i accumulated{_mm_setzero_si128()};
+    for (std::size_t i{0}; i < size; i += 16)
+      accumulated = _mm_or_si128(accumulated, _mm_loadu_si128(reinterpret_cast<const __m128i *>(data + i)));
+    return _mm_movemask_epi8(_mm_cmpeq_epi8(accumulated, _mm_setzero_si128())) == 0xFFFF;
+#else
+    for (std::size_t i{0}; i < size; ++i)
+      if (data[i] != 0)
+        return false;
+    return true;
+#endif
+  }
+
+  bool isDotEntry(const uint8_t *slot, const bool dotDot)
+  {
+    static constexpr uint8_t dotName[11]{'.', ' ', ' ', ' ', ' ', ' ', ' ', ' ', ' ', ' ', ' '};
+    static constexpr uint8_t dotDotName[11]{'.', '.', ' ', ' ', ' ', ' ', ' ', ' ', ' ', ' ', ' '};
+    return std::memcmp(slot, dotDot ? dotDotName : dotName, 11) == 0 && (slot[11] & 0x10) == 0x10;
+  }
+}
+
+DirectoryClusterKind classifyDirectoryCluster(std::span<const uint8_t> cluster)
+{
+  std::size_t slotCount{cluster.size() / bytesPerEntry};
+  std::size_t validCount{0};
+  std::size_t deletedCount{0};
+  bool pendingLongName{false};
+  uint8_t pendingChecksum{0};
+
+  if (slotCount < 2)
+    return DirectoryClusterKind::NotDirectory;
+
+  for (std::size_t i{0}; i < slotCount; ++i)
+  {
+    const uint8_t *slot{cluster.data() + i * bytesPerEntry};
+    uint8_t first{slot[0]};
+    uint8_t attributes{slot[11]};
+
+    // End-of-directory marker, formatters and drivers leave everything after it zeroed.
+    if (first == 0x00)
+    {
+      if (!allZero(slot, cluster.size() - i * bytesPerEntry))
+        return DirectoryClusterKind::NotDirectory;
+      break;
+    }
+
+    bool deleted{first == 0xE5};
+    if (deleted)
+      ++deletedCount;
+
+    // Long file name entry: type byte and cluster field are always zero, ordinal is 1 to 20 (0x40 flags the last one).
+    if (attributes == 0x0F)
+    {
+      uint8_t ordinal{static_cast<uint8_t>(first & 0x3F)};
+      if (slot[12] != 0 || slot[26] != 0 || slot[27] != 0)
+        return DirectoryClusterKind::NotDirectory;
+      if (!deleted && (ordinal == 0 || ordinal > 20 || (first & 0x80) != 0))
+        return DirectoryClusterKind::NotDirectory;
+      pendingLongName = true;
+      pendingChecksum = slot[13];
+      ++validCount;
+      continue;
+    }
+
+    // Short name entry: no reserved attribute bits, only the case flags in the reserved byte.
+    if ((attributes & 0xC0) != 0 || (slot[12] & ~0x18) != 0)
+      return DirectoryClusterKind::NotDirectory;
+
+    // Name bytes 1 to 10 (byte 0 may be the deleted marker 0xE5 or the escaped 0x05).
+    if ((badShortNameBytes(slot) & 0x07FE) != 0)
+      return DirectoryClusterKind::NotDirectory;
+    if (!deleted && first != 0x05 && (first < 0x20 || (first >= 'a' && first <= 'z')))
+      return DirectoryClusterKind::NotDirectory;
+
+    // Deleting only overwrites the first name byte, so long file name checksums can only be checked on live entries.
+    if (pendingLongName && !deleted)
+    {
+      uint8_t name[11]{};
+      std::memcpy(name, slot, sizeof(name));
+      if (shortNameChecksum(name) != pendingChecksum)
+        return DirectoryClusterKind::NotDirectory;
+    }
+    pendingLongName = false;
+    ++validCount;
+  }
+
+  if (isDotEntry(cluster.data(), false) && isDotEntry(cluster.data() + bytesPerEntry, true))
+    return DirectoryClusterKind::FirstCluster;
+
+  if (validCount > 0 && deletedCount > 0)
+    return DirectoryClusterKind::Continuation;
+
+  return DirectoryClusterKind::NotDirectory;
+}
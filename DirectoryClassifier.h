@@ -0,0 +1,26 @@
+#pragma once
+#include "Fat32.h"
+
+// What a raw cluster looks like when read as a table of 32-byte directory entries.
+enum class DirectoryClusterKind
+{
+  NotDirectory,
+  FirstCluster, // Starts with "." and ".." entries, i.e. the first cluster of a directory.
+  Continuation, // Only valid entries (at least one of them deleted), a later cluster of some directory.
+};
+
+// Cluster that looks like a directory table, as found by a sweep over raw clusters.
+// Parent cluster comes from the ".." entry of first clusters, 0 for continuation clusters.
+struct DirectoryCandidate
+{
+  uint32_t cluster{};
+  uint32_t parentCluster{};
+  DirectoryClusterKind kind{};
+};
+
+// Classify a raw cluster (any multiple of 32 bytes) as a directory table or not.
+// Every slot up to the end-of-directory marker has to be a well-formed short name or long file name entry
+// (printable upper-case short names, sane attribute and reserved bytes, long file name checksums matching
+// the live short name they belong to), and every slot after the marker has to be zero.
+// Short name bytes are checked 16 at a time with SSE2 when available.
+DirectoryClusterKind classifyDirectoryCluster(std::span<const uint8_t> cluster);
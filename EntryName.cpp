@@ -0,0 +1,227 @@
+#include "EntryName.h"
+#include "Instrumentation.h"
+#include <algorithm>
+#include <array>
+#include <cctype>
+#if defined(__SSE2__)
+#include <emmintrin.h>
+#endif
+
+namespace
+{
+  constexpr uint8_t deletedMarker{0xE5};
+  constexpr uint8_t lastLongEntryFlag{0x40};
+  constexpr std::size_t unitsPerLongEntry{13};
+  constexpr std::size_t maxLongEntries{20}; // 255 characters at most.
+
+  bool isLongFileName(const FAT32Entry &entry)
+  {
+    return entry.attributes == 0x0F;
+  }
+
+  // Whether a byte may start a short name (the one a deleted entry lost).
+  bool isShortNameCharacter(const uint8_t character)
+  {
+    if (character <= 0x20 || character == deletedMarker || (character >= 'a' && character <= 'z'))
+      return false;
+    return std::string_view{"\"*+,./:;<=>?[\\]|"}.find(static_cast<char>(character)) == std::string_view::npos;
+  }
+
+  // Whether the checksum stored in long file name entries matches the main entry's short name.
+  // Checksums of all 256 first characters differ, so for a deleted entry exactly one first character fits.
+  bool checksumMatches(const FAT32Entry &mainEntry, const uint8_t checksum)
+  {
+    if (mainEntry.name[0] != deletedMarker)
+      return shortNameChecksum(mainEntry.name) == checksum;
+
+    uint8_t name[11]{};
+    std::memcpy(name, mainEntry.name, sizeof(name));
+    for (unsigned first{0}; first < 256; ++first)
+    {
+      name[0] = static_cast<uint8_t>(first);
+      if (shortNameChecksum(name) == checksum)
+        return isShortNameCharacter(name[0]);
+    }
+    return false;
+  }
+
+  void appendUtf8(const char32_t codePoint, char *&output)
+  {
+    if (codePoint < 0x80)
+      *output++ = static_cast<char>(codePoint < 0x20 || codePoint == '/' ? '_' : codePoint);
+    else if (codePoint < 0x800)
+    {
+      *output++ = static_cast<char>(0xC0 | (codePoint >> 6));
+      *output++ = static_cast<char>(0x80 | (codePoint & 0x3F));
+    }
+    else if (codePoint < 0x10000)
+    {
+      *output++ = static_cast<char>(0xE0 | (codePoint >> 12));
+      *output++ = static_cast<char>(0x80 | ((codePoint >> 6) & 0x3F));
+      *output++ = static_cast<char>(0x80 | (codePoint & 0x3F));
+    }
+    else
+    {
+      *output++ = static_cast<char>(0xF0 | (codePoint >> 18));
+      *output++ = static_cast<char>(0x80 | ((codePoint >> 12) & 0x3F));
+      *output++ = static_cast<char>(0x80 | ((codePoint >> 6) & 0x3F));
+      *output++ = static_cast<char>(0x80 | (codePoint & 0x3F));
+    }
+  }
+
+  // Convert units [position, end) to UTF-8, a surrogate pair may run up to limit.
+  std::size_t convertScalar(const char16_t *units, std::size_t position, const std::size_t end, const std::size_t limit, char *&output)
+  {
+    while (position < end)
+    {
+      char32_t unit{units[position++]};
+      if (unit >= 0xD800 && unit <= 0xDBFF && position < limit && units[position] >= 0xDC00 && units[position] <= 0xDFFF)
+        unit = 0x10000 + ((unit - 0xD800) << 10) + (units[position++] - 0xDC00);
+      else if (unit >= 0xD800 && unit <= 0xDFFF)
+        unit = 0xFFFD;
+      appendUtf8(unit, output);
+    }
+    return position;
+  }
+
+  // Convert length UTF-16 units to UTF-8 at output, returns the end of what was written (at most 3 bytes per unit).
+  char *convertUnits(const char16_t *units, const std::size_t length, char *output)
+  {
+    std::size_t position{0};
+#if defined(__SSE2__)
+    const __m128i highBits{_mm_set1_epi16(static_cast<short>(0xFF80))};
+    const __m128i lastControl{_mm_set1_epi16(0x1F)};
+    const __m128i slash{_mm_set1_epi16('/')};
+    const __m128i zero{_mm_setzero_si128()};
+    while (position + 8 <= length)
+    {
+      // Printable ASCII other than '/' maps to itself, 8 units narrowed to 8 bytes at once.
+      __m128i block{_mm_loadu_si128(reinterpret_cast<const __m128i *>(units + position))};
+      __m128i ascii{_mm_cmpeq_epi16(_mm_and_si128(block, highBits), zero)};
+      __m128i printable{_mm_and_si128(ascii, _mm_cmpgt_epi16(block, lastControl))};
+      __m128i plain{_mm_andnot_si128(_mm_cmpeq_epi16(block, slash), printable)};
+      if (_mm_movemask_epi8(plain) == 0xFFFF)
+      {
+        _mm_storel_epi64(reinterpret_cast<__m128i *>(output), _mm_packus_epi16(block, block));
+        output += 8;
+        position += 8;
+      }
+      else
+        position = convertScalar(units, position, position + 8, length, output);
+    }
+#endif
+    convertScalar(units, position, length, length, output);
+    return output;
+  }
+
+  // Append the long file name to out, false (out untouched) when no long file name entry belongs to the main entry.
+  bool appendLongFileName(std::span<const FAT32Entry> entry, std::string &out)
+  {
+    const FAT32Entry &mainEntry{entry.back()};
+    std::array<char16_t, maxLongEntries * unitsPerLongEntry> units{};
+    std::size_t unitCount{0};
+    uint8_t checksum{0};
+
+    // Long file name entries come in reverse order in front of the main entry, ordinal #1 right before it.
+    for (std::size_t ordinal{1}; ordinal < entry.size() && ordinal <= maxLongEntries; ++ordinal)
+    {
+      const FAT32Entry &slot{entry[entry.size() - 1 - ordinal]};
+      const uint8_t *bytes{reinterpret_cast<const uint8_t *>(&slot)};
+      if (!isLongFileName(slot))
+        break;
+      if (bytes[0] != deletedMarker && (bytes[0] & ~lastLongEntryFlag) != ordinal)
+        break;
+      if (ordinal == 1 ? !checksumMatches(mainEntry, bytes[13]) : bytes[13] != checksum)
+        break;
+      checksum = bytes[13];
+
+      // Characters sit at offsets 1, 14 and 28 of each entry (5, 6 and 2 of them).
+      std::memcpy(units.data() + unitCount, bytes + 1, 10);
+      std::memcpy(units.data() + unitCount + 5, bytes + 14, 12);
+      std::memcpy(units.data() + unitCount + 11, bytes + 28, 4);
+      unitCount += unitsPerLongEntry;
+
+      if (bytes[0] != deletedMarker && (bytes[0] & lastLongEntryFlag) != 0)
+        break;
+    }
+
+    // The name ends at a NUL unit (padded with 0xFFFF after it), or fills its entries exactly.
+    std::size_t length{0};
+    while (length < unitCount && units[length] != 0)
+      ++length;
+    if (length == 0)
+      return false;
+
+    std::size_t start{out.size()};
+    out.resize(start + length * 3);
+    char *end{convertUnits(units.data(), length, out.data() + start)};
+    out.resize(static_cast<std::size_t>(end - out.data()));
+    return true;
+  }
+
+  // "." and ".." would name the directory itself or its parent once joined to a path.
+  bool isDotName(const std::string_view name)
+  {
+    return name == "." || name == "..";
+  }
+
+  // A short name byte as it goes into a path component, '_' when it cannot ('/', control and other unprintable bytes).
+  char shortNameCharacter(const uint8_t character)
+  {
+    return std::isprint(character) && character != '/' ? static_cast<char>(character) : '_';
+  }
+
+  void appendShortName(const FAT32Entry &mainEntry, std::string &out)
+  {
+    // The deleted marker stands for the lost first character, 0x05 for a first character of 0xE5.
+    uint8_t first{mainEntry.name[0] == 0x05 ? deletedMarker : mainEntry.name[0]};
+    out += mainEntry.name[0] == deletedMarker ? '_' : shortNameCharacter(first);
+
+    // Read first 8 ASCII characters for name.
+    for (std::size_t j{1}; j < 8; ++j)
+    {
+      if (mainEntry.name[j] == ' ')
+        break;
+      out += shortNameCharacter(mainEntry.name[j]);
+    }
+
+    // Read final 3 ASCII characters for extension.
+    bool hasExtension{false};
+    for (std::size_t j{8}; j < 11; ++j)
+    {
+      if (mainEntry.name[j] != ' ')
+      {
+        if (!hasExtension)
+        {
+          out += '.';
+          hasExtension = true;
+        }
+        out += shortNameCharacter(mainEntry.name[j]);
+      }
+    }
+  }
+}
+
+void appendEntryName(std::span<const FAT32Entry> entry, std::string &out)
+{
+  if (entry.empty())
+    return;
+
+  FAT32R_SAMPLE_PHASE(NameDecode);
+  FAT32R_COUNT(NamesDecoded, 1);
+
+  const FAT32Entry &mainEntry{entry.back()};
+  bool isDir{(mainEntry.attributes & 0x10) == 0x10};
+  bool isFile{!isDir && (mainEntry.attributes & 0x08) != 0x08};
+  if (!isDir && !isFile)
+    throw std::runtime_error{"Not a valid chain of entries."};
+
+  std::size_t start{out.size()};
+  if (appendLongFileName(entry, out) && !isDotName(std::string_view{out}.substr(start)))
+    return;
+
+  out.resize(start);
+  appendShortName(mainEntry, out);
+  if (isDotName(std::string_view{out}.substr(start)))
+    std::fill(out.begin() + static_cast<std::ptrdiff_t>(start), out.end(), '_');
+}
@@ -0,0 +1,17 @@
+#pragma once
+#include "Fat32.h"
+#include <string>
+
+// Append the name of an entry (long file name entries at the front, main file/directory entry at the back)
+// to out as UTF-8, without allocating anything but out's own growth, so names can go straight into a string pool.
+// Long file name entries are only used as far as they belong to the main entry: walking back from it,
+// each has to carry the next ordinal (or the deleted marker) and the checksum of the short name.
+// A deleted main entry lost the first byte of its short name, the checksum then has to fit
+// some valid first character. Without any such long file name entry, the short (8.3) name is used,
+// with the deleted marker turned into '_' and a leading 0x05 read as 0xE5.
+// UTF-16 is converted 8 units at a time with SSE2 when available while the name stays ASCII,
+// surrogate pairs become 4-byte sequences, unpaired surrogates U+FFFD.
+// Characters that cannot be in a path component ('/', control characters, unprintable short name bytes) are turned into '_'.
+// A long file name of "." or ".." falls back to the short name, a short name of dots only has them turned into '_'.
+// Throws if the main entry is neither a file nor a directory.
+void appendEntryName(std::span<const FAT32Entry> entry, std::string &out);
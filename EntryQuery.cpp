@@ -0,0 +1,102 @@
+#include "EntryQuery.h"
+#include <cctype>
+#include <fnmatch.h>
+
+namespace
+{
+  std::string toLower(const std::string_view text)
+  {
+    std::string lower{text};
+    for (auto &character : lower)
+      character = static_cast<char>(std::tolower(static_cast<unsigned char>(character)));
+    return lower;
+  }
+}
+
+uint16_t EntryQuery::encodeDate(const unsigned year, const unsigned month, const unsigned day)
+{
+  if (year < 1980 || year > 2107 || month < 1 || month > 12 || day < 1 || day > 31)
+    throw std::runtime_error{"Date out of FAT range"};
+  return static_cast<uint16_t>(((year - 1980) << 9) | (month << 5) | day);
+}
+
+void EntryQuery::setSizeRange(const uint64_t minimum, const uint64_t maximum)
+{
+  if (minimum > maximum)
+    throw std::runtime_error{"Empty size range"};
+  minSize = minimum;
+  maxSize = maximum;
+}
+
+void EntryQuery::setDateRange(const uint16_t first, const uint16_t last, const DateField field)
+{
+  if (first > last)
+    throw std::runtime_error{"Empty date range"};
+  firstDate = first;
+  lastDate = last;
+  dateField = field;
+  hasDateRange = true;
+}
+
+void EntryQuery::setNameRegex(const std::string &pattern)
+{
+  try
+  {
+    nameRegex.emplace(pattern, std::regex::ECMAScript | std::regex::icase | std::regex::optimize);
+  }
+  catch (const std::regex_error &)
+  {
+    throw std::runtime_error{"Invalid name regex"};
+  }
+}
+
+void EntryQuery::setExtensions(const std::vector<std::string> &list)
+{
+  extensions.clear();
+  for (const auto &extension : list)
+    extensions.push_back(toLower(extension.starts_with('.') ? std::string_view{extension}.substr(1) : std::string_view{extension}));
+}
+
+bool EntryQuery::empty() const
+{
+  return type == Type::Any && minSize == 0 && maxSize == UINT64_MAX && !hasDateRange && !needsName();
+}
+
+bool EntryQuery::matchesEntry(const FAT32Entry &mainEntry) const
+{
+  bool isDir{(mainEntry.attributes & 0x10) == 0x10};
+  if ((type == Type::File && isDir) || (type == Type::Directory && !isDir))
+    return false;
+
+  if (mainEntry.size < minSize || mainEntry.size > maxSize)
+    return false;
+
+  // Entries without a date (0) never fall in a range.
+  if (hasDateRange)
+  {
+    uint16_t date{dateField == DateField::Created ? mainEntry.creationDate : mainEntry.lastWrittenDate};
+    if (date == 0 || date < firstDate || date > lastDate)
+      return false;
+  }
+  return true;
+}
+
+bool EntryQuery::matchesName(const std::string_view name) const
+{
+  if (!extensions.empty())
+  {
+    std::size_t dot{name.rfind('.')};
+    if (dot == std::string_view::npos)
+      return false;
+    std::string extension{toLower(name.substr(dot + 1))};
+    if (std::find(extensions.begin(), extensions.end(), extension) == extensions.end())
+      return false;
+  }
+
+  if (!nameGlob.empty() && fnmatch(nameGlob.c_str(), std::string{name}.c_str(), FNM_CASEFOLD) != 0)
+    return false;
+
+  if (nameRegex.has_value() && !std::regex_search(name.begin(), name.end(), *nameRegex))
+    return false;
+  return true;
+}
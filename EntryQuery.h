@@ -0,0 +1,64 @@
+#pragma once
+#include "Fat32.h"
+#include <optional>
+#include <regex>
+#include <string>
+
+// Conditions a deleted entry has to meet to be listed, checked while scanning so entries that do not
+// meet them are never stored. Conditions on the main entry alone (type, size, dates) are checked first,
+// the name is only decoded for entries passing them, and only when some condition needs it.
+// An empty query matches everything.
+class EntryQuery
+{
+public:
+  enum class Type
+  {
+    Any,
+    File,
+    Directory,
+  };
+
+  enum class DateField
+  {
+    LastWritten,
+    Created,
+  };
+
+private:
+  Type type{Type::Any};
+  uint64_t minSize{0};
+  uint64_t maxSize{UINT64_MAX};
+  DateField dateField{DateField::LastWritten};
+  uint16_t firstDate{0};      // FAT-encoded, 0 for no lower bound.
+  uint16_t lastDate{0xFFFF};  // FAT-encoded, inclusive.
+  bool hasDateRange{false};
+
+  std::string nameGlob{};
+  std::optional<std::regex> nameRegex{};
+  std::vector<std::string> extensions{}; // Lower case, without the dot.
+
+public:
+  // Default constructor, a query matching everything.
+  EntryQuery() = default;
+
+  // Public method encoding a date the way FAT stores it (years 1980 to 2107), encoded dates compare in date order.
+  static uint16_t encodeDate(const unsigned year, const unsigned month, const unsigned day);
+
+  // Public setters for each condition.
+  void setType(const Type entryType) { type = entryType; }
+  void setSizeRange(const uint64_t minimum, const uint64_t maximum);
+  void setDateRange(const uint16_t first, const uint16_t last, const DateField field = DateField::LastWritten);
+  void setNameGlob(const std::string_view glob) { nameGlob = glob; } // fnmatch pattern, case-insensitive like FAT.
+  void setNameRegex(const std::string &pattern);                      // ECMAScript, searched in the name, case-insensitive.
+  void setExtensions(const std::vector<std::string> &list);           // Any of them, with or without the dot, case-insensitive.
+
+  // Public method telling whether any condition is set.
+  bool empty() const;
+
+  // Public method telling whether matching needs the decoded name.
+  bool needsName() const { return !nameGlob.empty() || nameRegex.has_value() || !extensions.empty(); }
+
+  // Public methods checking the conditions on the main entry, and on the decoded name.
+  bool matchesEntry(const FAT32Entry &mainEntry) const;
+  bool matchesName(const std::string_view name) const;
+};
@@ -1,10 +1,119 @@
 #include "Fat32.h"
+#include "Instrumentation.h"
+#include <iterator>
+#if defined(__SSE2__)
+#include <emmintrin.h>
+#endif
 
-Fat32Device::Fat32Device(const std::string_view path)
+namespace
+{
+  // Append to ranges the clusters in [firstCluster, firstCluster + count) where primary and mirror differ,
+  // extending the last range when it touches. Equal groups of 4 entries are skipped with one SSE2 compare.
+  void appendDivergentRanges(const uint32_t *primary, const uint32_t *mirror, const std::size_t count, const uint32_t firstCluster, std::vector<ClusterExtent> &ranges)
+  {
+    auto markDivergent{[&ranges](const uint32_t cluster)
+                       {
+                         if (!ranges.empty() && ranges.back().firstCluster + ranges.back().clusterCount == cluster)
+                           ++ranges.back().clusterCount;
+                         else
+                           ranges.push_back({cluster, 1});
+                       }};
+
+    std::size_t i{0};
+#if defined(__SSE2__)
+    for (; i + 4 <= count; i += 4)
+    {
+      __m128i left{_mm_loadu_si128(reinterpret_cast<const __m128i *>(primary + i))};
+      __m128i right{_mm_loadu_si128(reinterpret_cast<const __m128i *>(mirror + i))};
+      int equal{_mm_movemask_ps(_mm_castsi128_ps(_mm_cmpeq_epi32(left, right)))};
+      if (equal == 0xF)
+        continue;
+      for (std::size_t lane{0}; lane < 4; ++lane)
+        if (((equal >> lane) & 1) == 0)
+          markDivergent(firstCluster + static_cast<uint32_t>(i + lane));
+    }
+#endif
+    for (; i < count; ++i)
+      if (primary[i] != mirror[i])
+        markDivergent(firstCluster + static_cast<uint32_t>(i));
+  }
+}
+
+uint8_t shortNameChecksum(const uint8_t (&name)[11])
+{
+  uint8_t checksum{0};
+  for (const uint8_t character : name)
+    checksum = static_cast<uint8_t>(((checksum & 1) << 7) + (checksum >> 1) + character);
+  return checksum;
+}
+
+FAT32BootSector parseBootSector(std::span<const uint8_t> sector)
+{
+  if (sector.size() < 512)
+    throw std::runtime_error{"Boot sector too short"};
+
+  FAT32BootSector bootSector{};
+  std::size_t position{0};
+  auto readField{[&](void *field, const std::size_t fieldSize)
+                 {
+                   std::memcpy(field, sector.data() + position, fieldSize);
+                   position += fieldSize;
+                 }};
+
+  readField(bootSector.jumpBoot, sizeof(bootSector.jumpBoot));
+  readField(bootSector.oemName, sizeof(bootSector.oemName));
+  readField(&bootSector.bytesPerSector, sizeof(bootSector.bytesPerSector));
+  readField(&bootSector.sectorsPerCluster, sizeof(bootSector.sectorsPerCluster));
+  readField(&bootSector.reservedSectorCount, sizeof(bootSector.reservedSectorCount));
+  readField(&bootSector.fatCount, sizeof(bootSector.fatCount));
+  readField(&bootSector.rootEntryCount, sizeof(bootSector.rootEntryCount));
+  readField(&bootSector.sectorCount, sizeof(bootSector.sectorCount));
+  readField(&bootSector.mediaDescriptor, sizeof(bootSector.mediaDescriptor));
+  readField(&bootSector.sectorsPerFatUnused, sizeof(bootSector.sectorsPerFatUnused));
+  readField(&bootSector.sectorPerTrack, sizeof(bootSector.sectorPerTrack));
+  readField(&bootSector.headCount, sizeof(bootSector.headCount));
+  readField(&bootSector.hiddenSectorCount, sizeof(bootSector.hiddenSectorCount));
+  readField(&bootSector.sectorTotal, sizeof(bootSector.sectorTotal));
+  readField(&bootSector.sectorsPerFat, sizeof(bootSector.sectorsPerFat));
+  readField(&bootSector.flags, sizeof(bootSector.flags));
+  readField(&bootSector.driveVersion, sizeof(bootSector.driveVersion));
+  readField(&bootSector.rootDirStartCluster, sizeof(bootSector.rootDirStartCluster));
+  readField(&bootSector.fsInfoSector, sizeof(bootSector.fsInfoSector));
+  readField(&bootSector.backupBootSector, sizeof(bootSector.backupBootSector));
+  readField(bootSector.reserved, sizeof(bootSector.reserved));
+  readField(&bootSector.driveNumber, sizeof(bootSector.driveNumber));
+  readField(&bootSector.unused, sizeof(bootSector.unused));
+  readField(&bootSector.bootSignature, sizeof(bootSector.bootSignature));
+  readField(&bootSector.volumeId, sizeof(bootSector.volumeId));
+  readField(bootSector.volumeLabel, sizeof(bootSector.volumeLabel));
+  readField(bootSector.fatName, sizeof(bootSector.fatName));
+  readField(bootSector.executableCode, sizeof(bootSector.executableCode));
+
+  // The executable code field only holds the start of the boot code, the signature always closes the sector.
+  std::memcpy(bootSector.bootRecordSignature, sector.data() + 510, sizeof(bootSector.bootRecordSignature));
+  return bootSector;
+}
+
+bool isFat32BootSector(const FAT32BootSector &bootSector)
+{
+  auto isPowerOfTwo{[](const uint32_t value)
+                    { return value != 0 && (value & (value - 1)) == 0; }};
+
+  bool jump{(bootSector.jumpBoot[0] == 0xEB && bootSector.jumpBoot[2] == 0x90) || bootSector.jumpBoot[0] == 0xE9};
+  bool signature{bootSector.bootRecordSignature[0] == 0x55 && bootSector.bootRecordSignature[1] == 0xAA};
+  bool sectors{isPowerOfTwo(bootSector.bytesPerSector) && bootSector.bytesPerSector >= 512 && bootSector.bytesPerSector <= 4096};
+  bool clusters{isPowerOfTwo(bootSector.sectorsPerCluster) && static_cast<uint32_t>(bootSector.bytesPerSector) * bootSector.sectorsPerCluster <= 65536};
+  bool fats{bootSector.fatCount >= 1 && bootSector.fatCount <= 4 && bootSector.sectorsPerFat != 0 && bootSector.reservedSectorCount != 0};
+  bool fat32Only{bootSector.rootEntryCount == 0 && bootSector.sectorCount == 0 && bootSector.sectorsPerFatUnused == 0};
+
+  return jump && signature && sectors && clusters && fats && fat32Only && bootSector.sectorTotal != 0 && bootSector.rootDirStartCluster >= 2;
+}
+
+Fat32Device::Fat32Device(const std::string_view path, const BlockSource::Mode mode)
 try
     : devicePath{path}
 {
-  readDevice(devicePath);
+  readDevice(devicePath, mode);
 }
 catch (const std::runtime_error &)
 {
@@ -13,8 +122,9 @@ catch (const std::runtime_error &)
 
 Fat32Device::~Fat32Device()
 {
-  if (device.is_open())
-    device.close();
+  // Read-ahead tasks read from the device, let them finish first.
+  readAhead.reset();
+  device.reset();
 }
 
 bool Fat32Device::isFat32()
@@ -22,27 +132,36 @@ bool Fat32Device::isFat32()
   if(bootSector==nullptr)
     return false;
 
-  if (std::string_view(reinterpret_cast<char *>(bootSector->fatName)) != "FAT32   ")
-    return false;
-
-  return true;
+  return isFat32BootSector(*bootSector);
 }
 
-void Fat32Device::readDevice(const std::string_view path)
+void Fat32Device::readDevice(const std::string_view path, const BlockSource::Mode mode)
 {
   try
   {
     devicePath = path;
-    device.open(devicePath, std::ios::binary | std::ios::in);
-    if (!device.is_open())
-      throw std::runtime_error{"Failed to open device"};
+    readAhead.reset();
+    device = openBlockSource(devicePath, mode);
+    if (volumeOffset != 0 || volumeSize != 0)
+      device = std::make_unique<OffsetBlockSource>(std::move(device), volumeOffset, volumeSize);
 
     readBootSector();
 
     if (!isFat32())
       throw std::runtime_error{"Path is not a FAT32 device"};
 
+    computeGeometry();
     readFatTable();
+
+    clusterCache.configure(bytesPerCluster, device->supportsViews() ? 0 : clusterCacheBudget);
+    readAheadPending.clear();
+    if (clusterCache.isEnabled())
+      readAhead = std::make_unique<ThreadPool>(1);
+
+    mirrorFats.clear();
+    fatDivergences.clear();
+    if (fatCrossCheck)
+      crossCheckFats();
     readRootEntries();
   }
   catch (const std::runtime_error &)
@@ -53,45 +172,31 @@ void Fat32Device::readDevice(const std::string_view path)
 
 void Fat32Device::readBootSector()
 {
+  FAT32R_TIME_PHASE(BootSector);
   try
   {
-    bootSector.reset(new FAT32BootSector{});
-
-    // Boot Sector starts at byte #0
-    device.seekg(0);
-    device.read(reinterpret_cast<char *>(bootSector->jumpBoot), sizeof(bootSector->jumpBoot));
-    device.read(reinterpret_cast<char *>(bootSector->oemName), sizeof(bootSector->oemName));
-    device.read(reinterpret_cast<char *>(&bootSector->bytesPerSector), sizeof(bootSector->bytesPerSector));
-    device.read(reinterpret_cast<char *>(&bootSector->sectorsPerCluster), sizeof(bootSector->sectorsPerCluster));
-    device.read(reinterpret_cast<char *>(&bootSector->reservedSectorCount), sizeof(bootSector->reservedSectorCount));
-    device.read(reinterpret_cast<char *>(&bootSector->fatCount), sizeof(bootSector->fatCount));
-    device.read(reinterpret_cast<char *>(&bootSector->rootEntryCount), sizeof(bootSector->rootEntryCount));
-    device.read(reinterpret_cast<char *>(&bootSector->sectorCount), sizeof(bootSector->sectorCount));
-    device.read(reinterpret_cast<char *>(&bootSector->mediaDescriptor), sizeof(bootSector->mediaDescriptor));
-    device.read(reinterpret_cast<char *>(&bootSector->sectorsPerFatUnused), sizeof(bootSector->sectorsPerFatUnused));
-    device.read(reinterpret_cast<char *>(&bootSector->sectorPerTrack), sizeof(bootSector->sectorPerTrack));
-    device.read(reinterpret_cast<char *>(&bootSector->headCount), sizeof(bootSector->headCount));
-    device.read(reinterpret_cast<char *>(&bootSector->hiddenSectorCount), sizeof(bootSector->hiddenSectorCount));
-    device.read(reinterpret_cast<char *>(&bootSector->sectorTotal), sizeof(bootSector->sectorTotal));
-    device.read(reinterpret_cast<char *>(&bootSector->sectorsPerFat), sizeof(bootSector->sectorsPerFat));
-    device.read(reinterpret_cast<char *>(&bootSector->flags), sizeof(bootSector->flags));
-    device.read(reinterpret_cast<char *>(&bootSector->driveVersion), sizeof(bootSector->driveVersion));
-    device.read(reinterpret_cast<char *>(&bootSector->rootDirStartCluster), sizeof(bootSector->rootDirStartCluster));
-    device.read(reinterpret_cast<char *>(&bootSector->fsInfoSector), sizeof(bootSector->fsInfoSector));
-    device.read(reinterpret_cast<char *>(&bootSector->backupBootSector), sizeof(bootSector->backupBootSector));
-    device.read(reinterpret_cast<char *>(bootSector->reserved), sizeof(bootSector->reserved));
-    device.read(reinterpret_cast<char *>(&bootSector->driveNumber), sizeof(bootSector->driveNumber));
-    device.read(reinterpret_cast<char *>(&bootSector->unused), sizeof(bootSector->unused));
-    device.read(reinterpret_cast<char *>(&bootSector->bootSignature), sizeof(bootSector->bootSignature));
-    device.read(reinterpret_cast<char *>(&bootSector->volumeId), sizeof(bootSector->volumeId));
-    device.read(reinterpret_cast<char *>(bootSector->volumeLabel), sizeof(bootSector->volumeLabel));
-    device.read(reinterpret_cast<char *>(bootSector->fatName), sizeof(bootSector->fatName));
-    device.read(reinterpret_cast<char *>(bootSector->executableCode), sizeof(bootSector->executableCode));
-    device.read(reinterpret_cast<char *>(bootSector->bootRecordSignature), sizeof(bootSector->bootRecordSignature));
-    device.seekg(0);
-
-    if (!device)
-      throw std::runtime_error{"Error reading boot sector"};
+    // Boot Sector starts at byte #0, read the whole sector once then pick fields from it.
+    std::vector<uint8_t> sector(512);
+    device->read(0, sector);
+    bootSector.reset(new FAT32BootSector{parseBootSector(sector)});
+    backupBootSectorUsed = false;
+    if (isFat32BootSector(*bootSector))
+      return;
+
+    // A damaged Boot Sector may still have its backup copy, at sector #6 of 512 or 4096-byte sectors.
+    for (const uint64_t sectorSize : {512, 4096})
+    {
+      if (device->size() < 7 * sectorSize)
+        break;
+      device->read(6 * sectorSize, sector);
+      FAT32BootSector backup{parseBootSector(sector)};
+      if (isFat32BootSector(backup) && backup.bytesPerSector == sectorSize && backup.backupBootSector == 6)
+      {
+        *bootSector = backup;
+        backupBootSectorUsed = true;
+        return;
+      }
+    }
   }
   catch (const std::runtime_error &)
   {
@@ -103,21 +208,45 @@ void Fat32Device::readBootSector()
   }
 }
 
+void Fat32Device::computeGeometry()
+{
+  if (bootSector->bytesPerSector == 0 || bootSector->sectorsPerCluster == 0)
+    throw std::runtime_error{"Invalid boot sector geometry"};
+
+  uint64_t bytesPerSector{bootSector->bytesPerSector};
+  uint64_t firstDataSector{static_cast<uint64_t>(bootSector->reservedSectorCount) + static_cast<uint64_t>(bootSector->fatCount) * bootSector->sectorsPerFat};
+
+  // First FAT table starts after reserved sectors, which is after boot sector, data region starts after all FAT tables.
+  fatByteOffset = static_cast<uint64_t>(bootSector->reservedSectorCount) * bytesPerSector;
+  fatByteSize = static_cast<uint64_t>(bootSector->sectorsPerFat) * bytesPerSector;
+  dataByteOffset = firstDataSector * bytesPerSector;
+  bytesPerCluster = static_cast<uint32_t>(bootSector->bytesPerSector) * static_cast<uint32_t>(bootSector->sectorsPerCluster);
+
+  uint64_t totalSectors{bootSector->sectorTotal != 0 ? bootSector->sectorTotal : bootSector->sectorCount};
+  if (totalSectors <= firstDataSector)
+    throw std::runtime_error{"Invalid boot sector geometry"};
+
+  // The FAT itself can only address as many clusters as it has entries (minus the two reserved ones).
+  uint64_t dataClusters{(totalSectors - firstDataSector) / bootSector->sectorsPerCluster};
+  uint64_t fatClusters{fatByteSize / sizeof(uint32_t) > 2 ? fatByteSize / sizeof(uint32_t) - 2 : 0};
+  clusterCount = static_cast<uint32_t>(std::min({dataClusters, fatClusters, static_cast<uint64_t>(0x0FFFFFF5)}));
+}
+
+uint64_t Fat32Device::clusterByteOffset(const uint32_t cluster) const
+{
+  // Cluster starts from #2, not #0, so accounting for that is needed.
+  if (!isDataCluster(cluster))
+    throw std::runtime_error{"Cluster out of range"};
+
+  return dataByteOffset + static_cast<uint64_t>(cluster - 2) * bytesPerCluster;
+}
+
 void Fat32Device::readFatTable()
 {
+  FAT32R_TIME_PHASE(FatTable);
   try
   {
-    fatTable.clear();
-
-    // First FAT table starts after reserved sectors, which is after boot sector.
-    uint32_t fatTableSize{bootSector->sectorsPerFat * static_cast<uint32_t>(bootSector->bytesPerSector)};
-    uint32_t fatOffset{static_cast<uint32_t>(bootSector->reservedSectorCount) * static_cast<uint32_t>(bootSector->bytesPerSector)};
-    fatTable.resize(fatTableSize / sizeof(uint32_t));
-    device.seekg(fatOffset);
-    device.read(reinterpret_cast<char *>(fatTable.data()), fatTableSize);
-    device.seekg(0);
-    if (!device)
-      throw std::runtime_error{"Error reading fat table"};
+    fatTable.open(*device, fatByteOffset, fatByteSize, fatMode, fatCacheBudget);
   }
   catch (const std::runtime_error &)
   {
@@ -129,6 +258,84 @@ void Fat32Device::readFatTable()
   }
 }
 
+void Fat32Device::crossCheckFats()
+{
+  try
+  {
+    constexpr std::size_t chunkEntries{64 * 1024};
+    std::size_t entryCount{std::min<std::size_t>(static_cast<std::size_t>(clusterCount) + 2, fatTable.size())};
+    std::vector<uint32_t> primaryChunk(chunkEntries);
+    std::vector<uint32_t> mirrorChunk(chunkEntries);
+
+    for (uint32_t copy{1}; copy < bootSector->fatCount; ++copy)
+    {
+      auto mirror{std::make_unique<FatTable>()};
+      mirror->open(*device, fatByteOffset + copy * fatByteSize, fatByteSize, FatTable::Mode::Lazy, fatCacheBudget);
+
+      std::vector<ClusterExtent> ranges{};
+      for (std::size_t first{0}; first < entryCount; first += chunkEntries)
+      {
+        std::size_t count{std::min(chunkEntries, entryCount - first)};
+        fatTable.copyEntries(static_cast<uint32_t>(first), std::span<uint32_t>{primaryChunk.data(), count});
+        mirror->copyEntries(static_cast<uint32_t>(first), std::span<uint32_t>{mirrorChunk.data(), count});
+        appendDivergentRanges(primaryChunk.data(), mirrorChunk.data(), count, static_cast<uint32_t>(first), ranges);
+      }
+
+      // Merge this copy's ranges into the ones found so far (both sorted), joining overlapping or touching ranges.
+      std::vector<ClusterExtent> merged{};
+      std::merge(fatDivergences.begin(), fatDivergences.end(), ranges.begin(), ranges.end(), std::back_inserter(merged), [](const ClusterExtent &left, const ClusterExtent &right)
+                 { return left.firstCluster < right.firstCluster; });
+      fatDivergences.clear();
+      for (const auto &range : merged)
+      {
+        if (!fatDivergences.empty() && fatDivergences.back().firstCluster + fatDivergences.back().clusterCount >= range.firstCluster)
+        {
+          uint32_t end{std::max(fatDivergences.back().firstCluster + fatDivergences.back().clusterCount, range.firstCluster + range.clusterCount)};
+          fatDivergences.back().clusterCount = end - fatDivergences.back().firstCluster;
+        }
+        else
+          fatDivergences.push_back(range);
+      }
+
+      mirrorFats.push_back(std::move(mirror));
+    }
+  }
+  catch (const std::runtime_error &)
+  {
+    throw;
+  }
+  catch (...)
+  {
+    throw std::runtime_error{"Error cross-checking fat tables"};
+  }
+}
+
+uint32_t Fat32Device::nextCluster(const uint32_t cluster) const
+{
+  uint32_t value{fatTable[cluster] & 0x0FFFFFFF};
+  if (fatDivergences.empty())
+    return value;
+
+  // Whether a FAT entry can be part of a chain: a data cluster or the end-of-chain marker.
+  auto isChainValue{[this](const uint32_t entry)
+                    { return entry >= 0x0FFFFFF8 || isDataCluster(entry); }};
+
+  auto range{std::upper_bound(fatDivergences.begin(), fatDivergences.end(), cluster, [](const uint32_t target, const ClusterExtent &extent)
+                              { return target < extent.firstCluster; })};
+  bool divergent{range != fatDivergences.begin() && cluster < std::prev(range)->firstCluster + std::prev(range)->clusterCount};
+  if (!divergent || isChainValue(value))
+    return value;
+
+  // FAT #1 holds a free, bad or out-of-range entry here, take the first copy that still has a chain value.
+  for (const auto &mirror : mirrorFats)
+  {
+    uint32_t mirrorValue{(*mirror)[cluster] & 0x0FFFFFFF};
+    if (isChainValue(mirrorValue))
+      return mirrorValue;
+  }
+  return value;
+}
+
 std::vector<uint8_t> Fat32Device::readClusterData(const uint32_t cluster)
 {
   try
@@ -137,18 +344,14 @@ std::vector<uint8_t> Fat32Device::readClusterData(const uint32_t cluster)
       throw std::runtime_error{"Boot Sector not read, error reading cluster's data"};
 
     // From the start of Data region, calculate the byte offset for the cluster argument, then read based on bytes per cluster.
-    uint32_t firstDataSector{bootSector->reservedSectorCount + (bootSector->fatCount * bootSector->sectorsPerFat)};
-    uint32_t bytesPerCluster{static_cast<uint32_t>(bootSector->bytesPerSector) * static_cast<uint32_t>(bootSector->sectorsPerCluster)};
-    uint32_t sectorNumber{firstDataSector + (cluster - 2) * bootSector->sectorsPerCluster}; // Cluster starts from #2, not #0, so accounting for that is needed.
-    uint32_t byteOffset{sectorNumber * bootSector->bytesPerSector};
+    uint64_t byteOffset{clusterByteOffset(cluster)};
 
     std::vector<uint8_t> clusterData(bytesPerCluster);
-    device.seekg(byteOffset);
-    device.read(reinterpret_cast<char *>(clusterData.data()), bytesPerCluster);
-    device.seekg(0);
-
-    if (!device)
-      throw std::runtime_error{"Error reading cluster's data"};
+    std::span<const uint8_t> mapped{device->view(byteOffset, bytesPerCluster)};
+    if (!mapped.empty())
+      std::memcpy(clusterData.data(), mapped.data(), bytesPerCluster);
+    else
+      readCluster(cluster, clusterData);
 
     return clusterData;
   }
@@ -167,19 +370,15 @@ std::vector<FAT32Entry> Fat32Device::readClusterEntries(const uint32_t cluster)
 
     // From the start of Data region, calculate the byte offset for the cluster argument, then read based on bytes per cluster.
     // Really should have read from entries member, maybe later...
-    uint32_t firstDataSector{bootSector->reservedSectorCount + (bootSector->fatCount * bootSector->sectorsPerFat)};
-    uint32_t bytesPerCluster{static_cast<uint32_t>(bootSector->bytesPerSector) * static_cast<uint32_t>(bootSector->sectorsPerCluster)};
-    uint32_t sectorNumber{firstDataSector + (cluster - 2) * bootSector->sectorsPerCluster};
-    uint32_t byteOffset{sectorNumber * bootSector->bytesPerSector};
+    uint64_t byteOffset{clusterByteOffset(cluster)};
     uint8_t bytesPerEntry{32};
 
     std::vector<FAT32Entry> clusterEntries(bytesPerCluster / bytesPerEntry);
-    device.seekg(byteOffset);
-    device.read(reinterpret_cast<char *>(clusterEntries.data()), bytesPerCluster);
-    device.seekg(0);
-
-    if (!device)
-      throw std::runtime_error{"Error reading cluster's entries"};
+    std::span<const uint8_t> mapped{device->view(byteOffset, bytesPerCluster)};
+    if (!mapped.empty())
+      std::memcpy(clusterEntries.data(), mapped.data(), bytesPerCluster);
+    else
+      readCluster(cluster, std::span<uint8_t>{reinterpret_cast<uint8_t *>(clusterEntries.data()), bytesPerCluster});
 
     return clusterEntries;
   }
@@ -189,6 +388,230 @@ std::vector<FAT32Entry> Fat32Device::readClusterEntries(const uint32_t cluster)
   }
 }
 
+std::span<const uint8_t> Fat32Device::viewClusterData(const uint32_t cluster, std::vector<uint8_t> &scratch)
+{
+  try
+  {
+    if (bootSector == nullptr)
+      throw std::runtime_error{"Boot Sector not read, error reading cluster's data"};
+
+    uint64_t byteOffset{clusterByteOffset(cluster)};
+
+    // Memory-mapped devices hand out the cluster in place, anything else is read into scratch.
+    std::span<const uint8_t> clusterData{device->view(byteOffset, bytesPerCluster)};
+    if (!clusterData.empty())
+      return clusterData;
+
+    scratch.resize(bytesPerCluster);
+    readCluster(cluster, scratch);
+    return scratch;
+  }
+  catch (const std::runtime_error &)
+  {
+    throw;
+  }
+}
+
+std::span<const FAT32Entry> Fat32Device::viewClusterEntries(const uint32_t cluster, std::vector<FAT32Entry> &scratch)
+{
+  try
+  {
+    if (bootSector == nullptr)
+      throw std::runtime_error{"Boot sector not read, error reading cluster's entries"};
+
+    uint64_t byteOffset{clusterByteOffset(cluster)};
+    std::size_t entryCount{bytesPerCluster / sizeof(FAT32Entry)};
+
+    // FAT32Entry is packed (alignment 1), so the mapped bytes can be looked at as entries directly.
+    std::span<const uint8_t> clusterData{device->view(byteOffset, bytesPerCluster)};
+    if (!clusterData.empty())
+      return {reinterpret_cast<const FAT32Entry *>(clusterData.data()), entryCount};
+
+    scratch.resize(entryCount);
+    readCluster(cluster, std::span<uint8_t>{reinterpret_cast<uint8_t *>(scratch.data()), bytesPerCluster});
+    return scratch;
+  }
+  catch (const std::runtime_error &)
+  {
+    throw;
+  }
+}
+
+std::span<const uint8_t> Fat32Device::viewClusters(const uint32_t firstCluster, const uint32_t count, std::vector<uint8_t> &scratch)
+{
+  try
+  {
+    if (count == 0)
+      return {};
+
+    if (!isDataCluster(firstCluster) || !isDataCluster(firstCluster + count - 1))
+      throw std::runtime_error{"Cluster out of range"};
+
+    uint64_t byteOffset{clusterByteOffset(firstCluster)};
+    std::size_t byteCount{static_cast<std::size_t>(count) * bytesPerCluster};
+
+    std::span<const uint8_t> clusterData{device->view(byteOffset, byteCount)};
+    if (!clusterData.empty())
+      return clusterData;
+
+    scratch.resize(byteCount);
+    device->read(byteOffset, scratch);
+    return scratch;
+  }
+  catch (const std::runtime_error &)
+  {
+    throw;
+  }
+}
+
+std::span<const uint8_t> Fat32Device::readExtents(std::span<const ClusterExtent> extents, std::vector<uint8_t> &scratch)
+{
+  FAT32R_TIME_PHASE(ClusterRead);
+  try
+  {
+    std::size_t byteCount{0};
+    for (const auto &extent : extents)
+    {
+      if (extent.clusterCount == 0 || !isDataCluster(extent.firstCluster) || !isDataCluster(extent.firstCluster + extent.clusterCount - 1))
+        throw std::runtime_error{"Cluster out of range"};
+      byteCount += static_cast<std::size_t>(extent.clusterCount) * bytesPerCluster;
+    }
+
+    scratch.resize(byteCount);
+
+    std::vector<BlockSource::ReadRequest> requests{};
+    requests.reserve(extents.size());
+    std::size_t position{0};
+    for (const auto &extent : extents)
+    {
+      std::size_t extentBytes{static_cast<std::size_t>(extent.clusterCount) * bytesPerCluster};
+      requests.push_back({clusterByteOffset(extent.firstCluster), std::span<uint8_t>{scratch}.subspan(position, extentBytes)});
+      position += extentBytes;
+    }
+
+    device->readBatch(requests);
+    return scratch;
+  }
+  catch (const std::runtime_error &)
+  {
+    throw;
+  }
+}
+
+void Fat32Device::readCluster(const uint32_t cluster, std::span<uint8_t> out)
+{
+  FAT32R_TIME_PHASE(ClusterRead);
+  if (!clusterCache.isEnabled())
+  {
+    device->read(clusterByteOffset(cluster), out);
+    return;
+  }
+
+  if (!clusterCache.lookup(cluster, out))
+  {
+    device->read(clusterByteOffset(cluster), out);
+    clusterCache.insert(cluster, out);
+  }
+  noteClusterRead(cluster);
+}
+
+void Fat32Device::noteClusterRead(const uint32_t cluster)
+{
+  // Where the calling thread's chain walk is: the last cluster it read, and how far ahead of it reads were queued.
+  struct ChainWalk
+  {
+    const Fat32Device *device{nullptr};
+    uint32_t lastCluster{};
+    uint32_t aheadCluster{}; // Last cluster queued, lastCluster itself when nothing is.
+    uint32_t aheadCount{};   // Clusters of the chain queued past lastCluster.
+    uint32_t window{};
+  };
+  thread_local ChainWalk walk{};
+
+  bool sequential{walk.device == this && isDataCluster(walk.lastCluster) && nextCluster(walk.lastCluster) == cluster};
+  if (!sequential)
+  {
+    walk = {this, cluster, cluster, 0, 0};
+    return;
+  }
+
+  walk.lastCluster = cluster;
+  if (walk.aheadCount > 0)
+    --walk.aheadCount;
+  else
+    walk.aheadCluster = cluster;
+
+  // Top the window up once half of it was consumed, doubling it each time.
+  if (walk.aheadCount > walk.window / 2)
+    return;
+  // Never more than a quarter of the cache, or read-ahead would evict itself before being read.
+  uint32_t maxWindow{static_cast<uint32_t>(std::min(maxReadAheadSize / bytesPerCluster, clusterCache.getCapacity() / 4))};
+  if (maxWindow == 0)
+    return;
+  walk.window = std::min(maxWindow, walk.window == 0 ? 4 : walk.window * 2);
+
+  std::vector<uint32_t> chain{};
+  while (walk.aheadCount < walk.window)
+  {
+    uint32_t next{nextCluster(walk.aheadCluster)};
+    if (!isDataCluster(next))
+      break;
+    walk.aheadCluster = next;
+    ++walk.aheadCount;
+    chain.push_back(next);
+  }
+
+  // Clusters already cached or queued by another walk are left out.
+  std::vector<ClusterExtent> extents{};
+  {
+    std::lock_guard lock{readAheadMutex};
+    for (const uint32_t next : chain)
+    {
+      if (clusterCache.contains(next) || !readAheadPending.insert(next).second)
+        continue;
+      if (!extents.empty() && extents.back().firstCluster + extents.back().clusterCount == next)
+        ++extents.back().clusterCount;
+      else
+        extents.push_back({next, 1});
+    }
+  }
+  if (extents.empty())
+    return;
+
+  readAhead->submit([this, extents = std::move(extents)]()
+                    {
+                      std::vector<uint8_t> buffer{};
+                      try
+                      {
+                        std::span<const uint8_t> data{readExtents(extents, buffer)};
+                        for (const auto &extent : extents)
+                          for (uint32_t i{0}; i < extent.clusterCount; ++i)
+                          {
+                            clusterCache.insert(extent.firstCluster + i, data.first(bytesPerCluster), true);
+                            data = data.subspan(bytesPerCluster);
+                          }
+                      }
+                      catch (...)
+                      {
+                        // Read-ahead is only a hint, the reader reads the cluster itself when it gets there.
+                      }
+
+                      std::lock_guard lock{readAheadMutex};
+                      for (const auto &extent : extents)
+                        for (uint32_t i{0}; i < extent.clusterCount; ++i)
+                          readAheadPending.erase(extent.firstCluster + i);
+                    });
+}
+
+void Fat32Device::prefetchClusters(const uint32_t firstCluster, const uint32_t count)
+{
+  if (count == 0 || !isDataCluster(firstCluster))
+    return;
+
+  uint32_t available{std::min(count, clusterCount + 2 - firstCluster)};
+  device->prefetch(clusterByteOffset(firstCluster), static_cast<std::size_t>(available) * bytesPerCluster);
+}
+
 void Fat32Device::readRootEntries()
 {
   try
@@ -197,33 +620,18 @@ void Fat32Device::readRootEntries()
 
     // Read from root diretory's starting cluster, follow FAT table cluster chain.
     // Read ALL types of entry.
-    uint32_t firstDataSector{static_cast<uint32_t>(bootSector->reservedSectorCount) + (static_cast<uint32_t>(bootSector->fatCount) * bootSector->sectorsPerFat)};
     uint32_t currentCluster{bootSector->rootDirStartCluster};
-    uint32_t bytesPerCluster{static_cast<uint32_t>(bootSector->bytesPerSector) * static_cast<uint32_t>(bootSector->sectorsPerCluster)};
-    uint8_t bytesPerEntry{32};
-    std::vector<FAT32Entry> cachedEntries(bytesPerCluster / static_cast<uint32_t>(bytesPerEntry));
+    std::vector<FAT32Entry> cachedEntries{}; // Only filled when the device cannot be viewed in place.
 
-    // 0x0FFFFFF8 to 0x0FFFFFFF marks the end of the cluster chain, whereas cluster's numbering starts at #0x2.
-    while (currentCluster >= 0x2 && currentCluster < 0x0FFFFFF8)
+    // 0x0FFFFFF8 to 0x0FFFFFFF marks the end of the cluster chain, anything else outside the data region (free or bad) a broken one.
+    // No chain is longer than the data region, a damaged FAT looping back on itself stops there.
+    for (uint32_t visited{0}; isDataCluster(currentCluster) && visited < clusterCount; ++visited)
     {
-      uint32_t currentSector{firstDataSector + (currentCluster - 2) * static_cast<uint32_t>(bootSector->sectorsPerCluster)}; // Cluster starts from #2, not #0, so accounting for that is needed.
-      uint32_t byteOffset{currentSector * static_cast<uint32_t>(bootSector->bytesPerSector)};
-
-      device.seekg(byteOffset);
-
-      // Read all entry from a cluster in cluster chain into a cached entries,
-      // then push cached entries to store in entries member.
-      device.read(reinterpret_cast<char *>(cachedEntries.data()), bytesPerCluster);
-      device.seekg(0);
-
-      if (!device)
-        throw std::runtime_error{"Error reading an entry"};
-
-      for (const auto &entry : cachedEntries)
-          entries.push_back(entry);
+      // View all entries of a cluster in cluster chain, then push them to store in entries member.
+      std::span<const FAT32Entry> clusterEntries{viewClusterEntries(currentCluster, cachedEntries)};
+      entries.insert(entries.end(), clusterEntries.begin(), clusterEntries.end());
 
-      cachedEntries.clear();
-      currentCluster = fatTable[currentCluster];
+      currentCluster = nextCluster(currentCluster);
     }
   }
   catch (const std::runtime_error &)
@@ -9,6 +9,12 @@
 #include <filesystem>
 #include <algorithm>
 #include <stdexcept>
+#include <span>
+#include "BlockSource.h"
+#include "FatTable.h"
+#include "ClusterCache.h"
+#include "ThreadPool.h"
+#include <unordered_set>
 
 // FAT32 Boot Sector structure.
 struct FAT32BootSector
@@ -62,33 +68,102 @@ struct FAT32Entry
 };
 #pragma pack(pop)
 
+// Run of consecutive clusters, lets a cluster chain be read with one request per run instead of one per cluster.
+struct ClusterExtent
+{
+  uint32_t firstCluster{};
+  uint32_t clusterCount{};
+};
+
+// Checksum of a short (8.3) name, stored in every long file name entry belonging to it.
+uint8_t shortNameChecksum(const uint8_t (&name)[11]);
+
+// Parse a raw boot sector (at least 512 bytes) into its fields, in on-disk order.
+// Throws if the sector is too short.
+FAT32BootSector parseBootSector(std::span<const uint8_t> sector);
+
+// Check that a boot sector describes a FAT32 volume: jump instruction, signature, sector and cluster sizes,
+// FAT count and size, root directory cluster, and the FAT12/16-only fields left at zero.
+// The file system type string is not relied upon, formatting tools do not all write it.
+bool isFat32BootSector(const FAT32BootSector &bootSector);
+
 // Class for reading a Fat32-formatted device/partition/disk/...
 class Fat32Device
 {
 private:
   std::string devicePath{};
-  std::fstream device{}; // Device/partition/disk/... is read as file stream
+  std::unique_ptr<BlockSource> device{nullptr}; // Device/partition/disk/... is read through a block source (mmap, pread, ...)
+
+  // Where the volume starts on the device and how long it is (0: to the end), for partitions of a whole disk.
+  // The block source is then wrapped so every read is shifted, nothing gets copied.
+  uint64_t volumeOffset{};
+  uint64_t volumeSize{};
+  bool backupBootSectorUsed{false};
 
   // Member storing Boot Sector, FAT table and Entries read from device/partition/disk/...
   std::unique_ptr<FAT32BootSector> bootSector{nullptr};
-  std::vector<uint32_t> fatTable{};
+  FatTable fatTable{};
   std::vector<FAT32Entry> entries{};
 
+  // Volume geometry derived once from Boot Sector, all offsets are 64-bit
+  // so clusters past the 4 GiB mark are addressed correctly.
+  uint64_t fatByteOffset{};
+  uint64_t fatByteSize{};
+  uint64_t dataByteOffset{};
+  uint32_t bytesPerCluster{};
+  uint32_t clusterCount{};
+
+  // How FAT table is accessed, lazily paged by default so opening a device does not read the whole table.
+  FatTable::Mode fatMode{FatTable::Mode::Lazy};
+  std::size_t fatCacheBudget{FatTable::defaultCacheBudget};
+
+  // Backup FAT copies (FAT #2, ...) and the cluster ranges where any of them disagrees with FAT #1,
+  // only loaded when cross-checking is enabled.
+  bool fatCrossCheck{false};
+  std::vector<std::unique_ptr<FatTable>> mirrorFats{};
+  std::vector<ClusterExtent> fatDivergences{};
+
+  // Single clusters read (viewClusterData, viewClusterEntries, ...) are kept in a cache when the device cannot be viewed
+  // in place, sized by the next readDevice. Reads following a cluster chain have its next clusters read ahead
+  // by a thread of their own into the cache, in a window doubling as the walk goes on.
+  ClusterCache clusterCache{};
+  std::size_t clusterCacheBudget{defaultClusterCacheBudget};
+  std::unique_ptr<ThreadPool> readAhead{nullptr};
+  std::mutex readAheadMutex{};
+  std::unordered_set<uint32_t> readAheadPending{}; // Clusters queued or being read ahead, guarded by readAheadMutex.
+
+  // Private method reading one cluster into out (one cluster long), through the cluster cache when it's on.
+  void readCluster(const uint32_t cluster, std::span<uint8_t> out);
+
+  // Private method noting a single-cluster read made by the calling thread,
+  // queueing read-ahead of the following clusters once its reads follow a chain.
+  void noteClusterRead(const uint32_t cluster);
+
   // Private methods for reading Boot Sector, FAT table and Root Entries of device/partition/disk/...
   void readBootSector();
   void readFatTable();
   void readRootEntries(); // Do note that this read ALL types of entry.
 
+  // Private method computing volume geometry from Boot Sector, used after checking it's FAT32.
+  void computeGeometry();
+
+  // Private method opening every backup FAT copy and diffing it against FAT #1 into fatDivergences.
+  void crossCheckFats();
+
   // Private method checking if the read device/partition/disk/... is really FAT32-formatted,
-  // used after reading Boot Sector.
+  // used after reading Boot Sector. See isFat32BootSector.
   bool isFat32();
 
 public:
+  // Default cluster cache budget, and the most read ahead of a chain walk at once.
+  static constexpr std::size_t defaultClusterCacheBudget{32 << 20};
+  static constexpr std::size_t maxReadAheadSize{1 << 20};
+
   // Default constructor.
   Fat32Device() = default;
 
   // Take a device/partition/disk/...'s path to start reading Boot Sector, FAT Table and Entries immediately.
-  Fat32Device(const std::string_view path);
+  Fat32Device(const std::string_view path, const BlockSource::Mode mode = BlockSource::Mode::Auto);
 
   // Disabled copy and move semantics.
   Fat32Device(const Fat32Device &) = delete;
@@ -99,12 +174,64 @@ public:
 
   // Public getters for Boot Sector, FAT Table and Root Entries read from device/partition/disk/...
   const std::unique_ptr<FAT32BootSector> &getBootSector() { return bootSector; }
-  const std::vector<uint32_t> &getFatTable() { return fatTable; }
+  const FatTable &getFatTable() { return fatTable; }
   const std::vector<FAT32Entry> &getRootEntries() { return entries; }
 
+  // Public getters for volume geometry.
+  uint32_t getBytesPerCluster() const { return bytesPerCluster; }
+  uint32_t getClusterCount() const { return clusterCount; } // Data clusters, numbered from #2 to #clusterCount + 1.
+
+  // Public method checking whether a cluster number lies inside the data region.
+  bool isDataCluster(const uint32_t cluster) const { return cluster >= 2 && cluster - 2 < clusterCount; }
+
+  // Public method mapping a cluster number to its absolute byte offset on device/partition/disk/...
+  // Throws if the cluster is outside the data region.
+  uint64_t clusterByteOffset(const uint32_t cluster) const;
+
+  // Public method for choosing how FAT table is accessed by the next readDevice: loaded whole up front (eager),
+  // or paged in as chains are walked (lazy) keeping at most cacheBudget bytes of pages for non-mapped devices.
+  void setFatAccess(const FatTable::Mode mode, const std::size_t cacheBudget = FatTable::defaultCacheBudget)
+  {
+    fatMode = mode;
+    fatCacheBudget = cacheBudget;
+  }
+
+  // Public method for choosing where the volume read by the next readDevice starts on the device and how long it is
+  // (0: to the end of the device), e.g. a partition found by PartitionTable.
+  void setVolume(const uint64_t offset, const uint64_t size = 0)
+  {
+    volumeOffset = offset;
+    volumeSize = size;
+  }
+  uint64_t getVolumeOffset() const { return volumeOffset; }
+
+  // Public getter telling whether the last readDevice found the boot sector damaged and used its backup copy.
+  bool usedBackupBootSector() const { return backupBootSectorUsed; }
+
+  // Public method for choosing how many bytes of clusters the next readDevice caches, 0 turns the cache
+  // (and read-ahead) off. Memory-mapped devices never use it, the page cache already holds their clusters.
+  void setClusterCache(const std::size_t budget) { clusterCacheBudget = budget; }
+
+  // Public getter for the cluster cache counters since the last readDevice.
+  ClusterCache::Stats getClusterCacheStats() const { return clusterCache.getStats(); }
+
+  // Public method for enabling the backup FAT cross-check on the next readDevice.
+  // Every FAT copy is then compared against FAT #1, and nextCluster falls back to a copy
+  // where FAT #1 disagrees and holds something that cannot be part of a chain.
+  void setFatCrossCheck(const bool enabled) { fatCrossCheck = enabled; }
+  bool getFatCrossCheck() const { return fatCrossCheck; }
+
+  // Public getter for the cluster ranges where FAT copies disagree, empty unless cross-checking is enabled.
+  const std::vector<ClusterExtent> &getFatDivergences() const { return fatDivergences; }
+
+  // Public method returning the cluster following cluster in its chain (upper 4 bits stripped),
+  // resolved against backup FAT copies where FAT #1 looks damaged. Use this to walk chains.
+  uint32_t nextCluster(const uint32_t cluster) const;
+
   // Public method for reading Boot Sector, FAT Table and Entries device/partition/disk/...,
   // used by constructor, but user can use this as well.
-  void readDevice(const std::string_view path);
+  // The mode picks how the device is accessed, memory-mapped by default with plain reads as fallback.
+  void readDevice(const std::string_view path, const BlockSource::Mode mode = BlockSource::Mode::Auto);
 
   // Public method for reading and returning data from a cluster,
   // useful for getting data region's file's contents.
@@ -115,4 +242,25 @@ public:
   // useful for getting entries from directories.
   // Do note that this does not check whether it's directory's clusters or data clusters, maybe later...
   std::vector<FAT32Entry> readClusterEntries(const uint32_t cluster);
+
+  // Zero-copy variants of readClusterData and readClusterEntries.
+  // The returned span points into the memory-mapped device when possible,
+  // otherwise the cluster is read into scratch (reused between calls, no reallocation once sized)
+  // and the span points there. The span stays valid until scratch or the device is modified.
+  std::span<const uint8_t> viewClusterData(const uint32_t cluster, std::vector<uint8_t> &scratch);
+  std::span<const FAT32Entry> viewClusterEntries(const uint32_t cluster, std::vector<FAT32Entry> &scratch);
+
+  // Zero-copy view of count consecutive clusters starting at firstCluster, read in one go,
+  // useful for sweeping the data region in large blocks. Same scratch rules as viewClusterData.
+  std::span<const uint8_t> viewClusters(const uint32_t firstCluster, const uint32_t count, std::vector<uint8_t> &scratch);
+
+  // Public method reading several extents back to back into scratch with one batched request,
+  // which the block source can turn into vectored or queued reads. Returns the filled bytes.
+  std::span<const uint8_t> readExtents(std::span<const ClusterExtent> extents, std::vector<uint8_t> &scratch);
+
+  // Public method telling whether cluster views point straight into the device, i.e. reading is copy-free.
+  bool viewsInPlace() const { return device != nullptr && device->supportsViews(); }
+
+  // Public method hinting that count clusters starting at firstCluster will be read soon.
+  void prefetchClusters(const uint32_t firstCluster, const uint32_t count);
 };
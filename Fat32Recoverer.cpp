@@ -1,9 +1,24 @@
 #include "Fat32Recoverer.h"
+#include "Instrumentation.h"
+#include <deque>
+#include <unordered_map>
 
-Fat32Recoverer::Fat32Recoverer(const std::string_view path)
+namespace
+{
+  // Extend the last extent when the cluster follows it, start a new one otherwise.
+  void appendChainCluster(std::vector<ClusterExtent> &extents, const uint32_t cluster)
+  {
+    if (!extents.empty() && extents.back().firstCluster + extents.back().clusterCount == cluster)
+      ++extents.back().clusterCount;
+    else
+      extents.push_back({cluster, 1});
+  }
+}
+
+Fat32Recoverer::Fat32Recoverer(const std::string_view path, const BlockSource::Mode mode)
 try
 {
-  device.readDevice(path);
+  device.readDevice(path, mode);
   readDeletedEntries();
 }
 catch (const std::runtime_error &)
@@ -31,11 +46,15 @@ bool Fat32Recoverer::entryisDeleted(const FAT32Entry &entry)
   return entry.name[0] == 0xE5;
 }
 
-void Fat32Recoverer::readDevice(const std::string_view path)
+void Fat32Recoverer::readDevice(const std::string_view path, const BlockSource::Mode mode)
 {
   try
   {
-    device.readDevice(path);
+    device.readDevice(path, mode);
+    {
+      std::lock_guard lock{fatIndexMutex};
+      fatIndexBuilt = false;
+    }
     readDeletedEntries();
   }
   catch (const std::runtime_error &)
@@ -44,35 +63,172 @@ void Fat32Recoverer::readDevice(const std::string_view path)
   }
 }
 
+const FatIndex &Fat32Recoverer::getFatIndex()
+{
+  std::lock_guard lock{fatIndexMutex};
+  if (!fatIndexBuilt)
+  {
+    fatIndex.build(device.getFatTable(), device.getClusterCount());
+    fatIndexBuilt = true;
+  }
+  return fatIndex;
+}
+
+std::vector<ClusterExtent> Fat32Recoverer::reconstructClusterChain(const FAT32Entry &entry)
+{
+  std::vector<ClusterExtent> extents{};
+  uint32_t firstCluster{(static_cast<uint32_t>(entry.firstClusterHigh) << 16) | entry.firstClusterLow};
+  uint32_t bytesPerCluster{device.getBytesPerCluster()};
+  uint64_t clustersLeft{(static_cast<uint64_t>(entry.size) + bytesPerCluster - 1) / bytesPerCluster};
+
+  if (clustersLeft == 0 || !device.isDataCluster(firstCluster))
+    return extents;
+
+  const FatIndex &index{getFatIndex()};
+
+  // Chain is still in FAT table (live entry, or a driver that does not zero chains on delete), follow it.
+  if (!index.isFree(firstCluster))
+  {
+    uint32_t currentCluster{firstCluster};
+    while (clustersLeft > 0 && device.isDataCluster(currentCluster))
+    {
+      appendChainCluster(extents, currentCluster);
+      --clustersLeft;
+      currentCluster = device.nextCluster(currentCluster);
+    }
+    return extents;
+  }
+
+  // Zeroed chain, take the free runs following the first cluster until the size is covered.
+  return freeExtentsFrom(firstCluster, clustersLeft);
+}
+
+void Fat32Recoverer::attachValidator(RecoveryWriter &writer, const std::string_view fileName)
+{
+  if (validation == Validation::Off || !validatorFactory)
+    return;
+  std::unique_ptr<ContentValidator> validator{validatorFactory(fileName)};
+  if (validator != nullptr)
+    writer.setValidator(std::move(validator), validation == Validation::Abort);
+}
+
+void Fat32Recoverer::recordValidation(const RecoveryWriter &writer, const std::vector<ClusterExtent> &extents)
+{
+  const ContentValidator *validator{writer.getValidator()};
+  if (validator == nullptr || validator->isValid())
+    return;
+
+  // Walk the extents to the cluster holding the failing byte.
+  uint64_t clusterIndex{validator->getFailureOffset() / device.getBytesPerCluster()};
+  uint32_t cluster{0};
+  for (const auto &extent : extents)
+  {
+    if (clusterIndex < extent.clusterCount)
+    {
+      cluster = extent.firstCluster + static_cast<uint32_t>(clusterIndex);
+      break;
+    }
+    clusterIndex -= extent.clusterCount;
+  }
+
+  std::lock_guard lock{validationMutex};
+  validationFailures.push_back({writer.getPath(), validator->getFailureOffset(), cluster, validator->getFailureReason()});
+}
+
+std::vector<ClusterExtent> Fat32Recoverer::freeExtentsFrom(const uint32_t firstCluster, uint64_t clusterCount)
+{
+  std::vector<ClusterExtent> extents{};
+  const FatIndex &index{getFatIndex()};
+  for (uint32_t cluster{index.nextFree(firstCluster)}; clusterCount > 0 && cluster != 0; cluster = index.nextFree(cluster))
+  {
+    ClusterExtent run{index.freeRunAt(cluster)};
+    uint32_t count{static_cast<uint32_t>(std::min<uint64_t>(clusterCount, run.clusterCount))};
+    extents.push_back({cluster, count});
+    clusterCount -= count;
+    cluster += count;
+  }
+  return extents;
+}
+
 void Fat32Recoverer ::readDeletedEntries()
 {
   try
   {
-    std::vector<FAT32Entry> cachedDeletedEntries{}; // For caching a vector of long file name entries, and main file/directory entry at the back.
-    for (const auto &entry : device.getRootEntries())
+    deletedEntries.clear();
+
+    // With a scan index, FAT table is hashed first: a fresh index replaces the whole scan,
+    // a stale one still tells which chunks of clusters need sweeping for orphans again.
+    std::vector<uint64_t> fatChunkHashes{};
+    std::vector<DirectoryCandidate> knownCandidates{};
+    std::vector<bool> changedChunks{};
+    if (!indexPath.empty())
     {
-      // If the entry is a long file name,
-      // just cache it until encountering a file/directory because
-      // long file name entries are always at the front of the
-      // entry they support.
-      if (entryisLongFileName(entry))
-      {
-        cachedDeletedEntries.push_back(entry);
-        continue;
-      }
-      // If the entry is a file/directory,
-      // we found the long file name entries and their main entry,
-      // so we push it to deletedEntries member and reset the cache.
-      else if (entryisDir(entry) || entryisFile(entry))
+      fatChunkHashes = ScanIndex::hashFatChunks(device.getFatTable(), static_cast<std::size_t>(device.getClusterCount()) + 2);
+
+      ScanIndex index{};
+      if (index.open(indexPath) && index.getVolumeId() == device.getBootSector()->volumeId &&
+          index.getBytesPerCluster() == device.getBytesPerCluster() && index.getClusterCount() == device.getClusterCount() &&
+          index.getFatChunkHashes().size() == fatChunkHashes.size())
       {
-        if (entryisDeleted(entry))
+        std::span<const uint64_t> indexHashes{index.getFatChunkHashes()};
+        if (index.getFlags() == scanIndexFlags() && std::equal(indexHashes.begin(), indexHashes.end(), fatChunkHashes.begin()))
         {
-          cachedDeletedEntries.push_back(entry);
-          deletedEntries.push_back(cachedDeletedEntries);
+          loadScanIndex(index);
+          deletedEntries.score(getFatIndex(), liveChains, device.getBytesPerCluster());
+          return;
+        }
+
+        if (orphanScan && (index.getFlags() & ScanIndex::orphanScanFlag) != 0)
+        {
+          changedChunks.resize(fatChunkHashes.size());
+          for (std::size_t chunk{0}; chunk < fatChunkHashes.size(); ++chunk)
+            changedChunks[chunk] = indexHashes[chunk] != fatChunkHashes[chunk];
+          for (const auto &candidate : index.getDirectoryCandidates())
+          {
+            std::size_t chunk{candidate.cluster / ScanIndex::fatChunkEntries};
+            if (chunk < changedChunks.size() && !changedChunks[chunk])
+              knownCandidates.push_back(candidate);
+          }
         }
-        cachedDeletedEntries.clear();
       }
     }
+
+    // Start from root directory, scanDirectory queues every subdirectory it meets on the same pool.
+    VolumeScan scan{threadCount};
+    uint32_t rootCluster{device.getBootSector()->rootDirStartCluster};
+    scan.pool.submit([this, &scan, rootCluster]
+                     { scanDirectory(scan, rootCluster, "/", false, true); });
+    scan.pool.wait();
+
+    // Then the deleted directories met in live ones, and whatever they lead to.
+    for (const auto &[firstCluster, path] : scan.deletedDirectories)
+      scan.pool.submit([this, &scan, firstCluster, path]
+                       { scanDirectory(scan, firstCluster, path, true, false); });
+    scan.pool.wait();
+
+    if (orphanScan)
+      sweepOrphanedDirectories(scan, knownCandidates, changedChunks);
+
+    // Directories finish in any order, sort them so the list is the same on every run.
+    std::sort(scan.directories.begin(), scan.directories.end(), [](const ScannedDirectory &left, const ScannedDirectory &right)
+              { return left.path != right.path ? left.path < right.path : left.firstCluster < right.firstCluster; });
+
+    std::size_t entryCount{0};
+    std::size_t slotCount{0};
+    for (const auto &directory : scan.directories)
+    {
+      entryCount += directory.entries.size();
+      slotCount += directory.entries.getAllSlots().size();
+    }
+    deletedEntries.reserve(entryCount, slotCount);
+    for (const auto &directory : scan.directories)
+      deletedEntries.append(directory.entries);
+    liveChains.build(std::move(scan.liveChains));
+    deletedEntries.score(getFatIndex(), liveChains, device.getBytesPerCluster());
+
+    // An index saved with a query would miss the entries it filtered out.
+    if (!indexPath.empty() && query.empty())
+      saveScanIndex(fatChunkHashes, scan.directoryCandidates);
   }
   catch (...)
   {
@@ -80,100 +236,276 @@ void Fat32Recoverer ::readDeletedEntries()
   }
 }
 
-std::string Fat32Recoverer::getEntryNameAscii(const std::vector<FAT32Entry> &entry)
+bool Fat32Recoverer::addMatchingEntry(DeletedEntryCatalogue &catalogue, std::span<const FAT32Entry> entry, const uint32_t pathIndex) const
+{
+  if (!query.matchesEntry(entry.back()))
+    return false;
+
+  // The name is decoded straight into the catalogue, and taken back out when it does not match.
+  catalogue.add(entry, pathIndex);
+  if (query.needsName() && !query.matchesName(catalogue.getName(catalogue.size() - 1)))
+  {
+    catalogue.removeLast();
+    return false;
+  }
+  return true;
+}
+
+uint32_t Fat32Recoverer::scanIndexFlags() const
+{
+  return (orphanScan ? ScanIndex::orphanScanFlag : 0) | (device.getFatCrossCheck() ? ScanIndex::fatCrossCheckFlag : 0);
+}
+
+void Fat32Recoverer::loadScanIndex(const ScanIndex &index)
+{
+  {
+    std::lock_guard lock{fatIndexMutex};
+    fatIndex.assign(index.getFreeBitmap(), static_cast<uint32_t>(std::min<std::size_t>(static_cast<std::size_t>(device.getClusterCount()) + 2, device.getFatTable().size())));
+    fatIndexBuilt = true;
+  }
+  liveChains.assign(index.getLiveChains());
+
+  std::span<const FAT32Entry> slots{index.getEntrySlots()};
+  for (std::size_t i{0}; i < index.getPathCount(); ++i)
+    deletedEntries.addPath(index.getPath(i), index.getPathCluster(i));
+
+  deletedEntries.reserve(index.getEntryRecords().size(), slots.size());
+  for (const auto &record : index.getEntryRecords())
+  {
+    std::span<const FAT32Entry> entry{slots.subspan(static_cast<std::size_t>(record.firstSlot), record.slotCount)};
+    if (addMatchingEntry(deletedEntries, entry, record.pathIndex) && entryListener)
+      entryListener(entry, deletedEntries.getPathAt(record.pathIndex));
+  }
+}
+
+void Fat32Recoverer::saveScanIndex(const std::vector<uint64_t> &fatChunkHashes, const std::vector<DirectoryCandidate> &directoryCandidates)
 {
+  // The index only saves time on the next run, failing to write it must not fail the scan.
   try
   {
-    if (entry.empty())
-      return "";
+    ScanIndex::Contents contents{};
+    contents.volumeId = device.getBootSector()->volumeId;
+    contents.bytesPerCluster = device.getBytesPerCluster();
+    contents.clusterCount = device.getClusterCount();
+    contents.flags = scanIndexFlags();
+    contents.fatChunkHashes = fatChunkHashes;
+    contents.freeBitmap = getFatIndex().getFreeBitmap();
+    contents.directoryCandidates = directoryCandidates;
+    contents.liveChains = liveChains.getRuns();
+    contents.entries = &deletedEntries;
+    ScanIndex::write(indexPath, contents);
+  }
+  catch (const std::runtime_error &error)
+  {
+    std::cerr << "Scan index not saved: " << error.what() << '\n';
+  }
+}
+
+void Fat32Recoverer::scanDirectory(VolumeScan &scan, const uint32_t firstCluster, const std::string path, const bool isDeleted, const bool isLive)
+{
+  FAT32R_TIME_PHASE(DirectoryScan);
+  ScannedDirectory directory{firstCluster, path, {}};
+  uint32_t pathIndex{directory.entries.addPath(path, firstCluster)};
+  std::vector<FAT32Entry> cachedDeletedEntries{}; // For caching a vector of long file name entries, and main file/directory entry at the back.
+  std::vector<FAT32Entry> clusterScratch{};       // Only used when the device cannot be viewed in place.
+  std::vector<ClusterExtent> chains{};            // This directory's chain and its live files' chains, live directories only.
+  uint32_t currentCluster{firstCluster};
+  bool firstClusterRead{false};
+
+  // 0x0FFFFFF8 to 0x0FFFFFFF marks the end of the cluster chain, anything else outside the data region is a broken chain.
+  while (device.isDataCluster(currentCluster))
+  {
+    std::span<const FAT32Entry> clusterEntries{device.viewClusterEntries(currentCluster, clusterScratch)};
 
-    if (!entryisDir(entry.back()) && !entryisFile(entry.back()))
-      throw std::runtime_error{"Not a valid chain of entries."};
+    // A deleted directory's cluster may have been reused by something else since, only trust it if it starts with ".",
+    // and leave it unvisited otherwise.
+    if (isDeleted && !firstClusterRead && (clusterEntries.empty() || !entryisDir(clusterEntries.front()) || clusterEntries.front().name[0] != '.' || clusterEntries.front().name[1] != ' '))
+      return;
+    firstClusterRead = true;
 
-    // Multiple entries exist mean there are long file name entries followed by the main entry they support.
-    if (entry.size() > 1)
     {
-      std::string longFileName{};
+      std::lock_guard lock{scan.mutex};
+      if (!scan.visitedClusters.insert(currentCluster).second)
+        break;
+    }
+    FAT32R_COUNT(ClustersDecoded, 1);
+    if (isLive)
+      appendChainCluster(chains, currentCluster);
 
-      for (long long i{static_cast<long long>(entry.size()) - 2}; i >= 0; --i)
+    for (const auto &entry : clusterEntries)
+    {
+      // If the entry is a long file name,
+      // just cache it until encountering a file/directory because
+      // long file name entries are always at the front of the
+      // entry they support.
+      if (entryisLongFileName(entry))
       {
-        if (!entryisLongFileName(entry[static_cast<std::size_t>(i)]))
-          throw std::runtime_error{"Not a valid chain of entries."};
+        cachedDeletedEntries.push_back(entry);
+        continue;
+      }
 
-          // Read first 5 UTF-16 characters.
-        for (std::size_t j{1}; j < 11; j += 2)
-        {
-          if (entry[static_cast<std::size_t>(i)].name[j] == 0 && entry[static_cast<std::size_t>(i)].name[j + 1] == 0)
-            break;
-          char16_t character{static_cast<char16_t>(entry[static_cast<std::size_t>(i)].name[j] | (entry[static_cast<std::size_t>(i)].name[j + 1] << 8))};
-          if (character > 0 && character <= 127)
-            longFileName += static_cast<char>(character);
-          else if (character != 0xFFFF && character != 0)
-            longFileName += '?';
-        }
+      // Volume labels and other slots support no long file name, drop any cached in front of them.
+      if (!entryisDir(entry) && !entryisFile(entry))
+      {
+        cachedDeletedEntries.clear();
+        continue;
+      }
 
-        // Read next 6 UTF-16 characters.
-        for (std::size_t j{0}; j < 12; j += 2)
+      // Skip the directory itself and its parent, "." and ".." entries.
+      if (entry.name[0] == '.' && (entry.name[1] == ' ' || (entry.name[1] == '.' && entry.name[2] == ' ')))
+      {
+        cachedDeletedEntries.clear();
+        continue;
+      }
+
+      cachedDeletedEntries.push_back(entry);
+
+      // Every subdirectory, live or deleted, is scanned as its own task.
+      uint32_t entryCluster{(static_cast<uint32_t>(entry.firstClusterHigh) << 16) | entry.firstClusterLow};
+      if (entryisDir(entry) && device.isDataCluster(entryCluster))
+      {
+        std::string name{getEntryName(cachedDeletedEntries)};
+        std::string subPath{path == "/" ? path + name : path + "/" + name};
+        bool subDeleted{entryisDeleted(entry)};
+        bool subLive{isLive && !subDeleted};
+        if (isLive && subDeleted)
         {
-          char16_t character{static_cast<char16_t>(*((uint8_t *)(&entry[static_cast<std::size_t>(i)]) + 14 + j) | (*((uint8_t *)(&entry[static_cast<std::size_t>(i)]) + 14 + j + 1) << 8))};
-          if (character > 0 && character <= 127)
-            longFileName += static_cast<char>(character);
-          else if (character != 0xFFFF && character != 0)
-            longFileName += '?';
+          std::lock_guard lock{scan.mutex};
+          scan.deletedDirectories.emplace_back(entryCluster, std::move(subPath));
         }
+        else
+          scan.pool.submit([this, &scan, entryCluster, subPath, subDeleted, subLive]
+                           { scanDirectory(scan, entryCluster, subPath, subDeleted, subLive); });
+      }
 
-        // Read final 2 UTF-16 characters.
-        for (std::size_t j{0}; j < 4; j += 2)
+      // A live file's chain, walked no further than its size.
+      if (isLive && entryisFile(entry) && !entryisDeleted(entry))
+      {
+        uint64_t clustersLeft{(static_cast<uint64_t>(entry.size) + device.getBytesPerCluster() - 1) / device.getBytesPerCluster()};
+        for (uint32_t cluster{entryCluster}; clustersLeft > 0 && device.isDataCluster(cluster); cluster = device.nextCluster(cluster), --clustersLeft)
+          appendChainCluster(chains, cluster);
+      }
+
+      // If the entry is a file/directory,
+      // we found the long file name entries and their main entry,
+      // so we keep it if it's deleted and reset the cache.
+      if (entryisDeleted(entry))
+      {
+        if (addMatchingEntry(directory.entries, cachedDeletedEntries, pathIndex) && entryListener)
         {
-          char16_t character{static_cast<char16_t>(*((uint8_t *)(&entry[static_cast<std::size_t>(i)]) + 28 + j) | (*((uint8_t *)(&entry[static_cast<std::size_t>(i)]) + 28 + j + 1) << 8))};
-          if (character > 0 && character <= 127)
-            longFileName += static_cast<char>(character);
-          else if (character != 0xFFFF && character != 0)
-            longFileName += '?';
+          std::lock_guard lock{entryListenerMutex};
+          entryListener(cachedDeletedEntries, path);
         }
       }
-      return longFileName;
+      cachedDeletedEntries.clear();
     }
 
-    // Fallback to using short file name if there is no long file name entry.
-    std::string shortName{};
+    currentCluster = device.nextCluster(currentCluster);
+  }
 
-    // Check for starting deleted marker
-    if (entry.back().name[0] == 0xE5)
-      shortName += '_';
-    else
-      shortName += static_cast<char>(entry.back().name[0]);
+  std::lock_guard lock{scan.mutex};
+  scan.liveChains.insert(scan.liveChains.end(), chains.begin(), chains.end());
+  if (!directory.entries.empty())
+    scan.directories.push_back(std::move(directory));
+}
 
-    // Read first 8 ASCII characters for name.
-    for (std::size_t j{1}; j < 8; ++j)
-    {
-      if (entry.back().name[j] == ' ')
-        break;
-      if (std::isprint(entry.back().name[j]))
-        shortName += static_cast<char>(entry.back().name[j]);
-    }
+void Fat32Recoverer::sweepOrphanedDirectories(VolumeScan &scan, const std::vector<DirectoryCandidate> &knownCandidates, const std::vector<bool> &changedChunks)
+{
+  uint32_t bytesPerCluster{device.getBytesPerCluster()};
+  uint32_t blockClusters{std::max<uint32_t>(1, static_cast<uint32_t>(orphanSweepBlockSize / bytesPerCluster))};
+  std::vector<uint8_t> blockScratch{}; // Only used when the device cannot be viewed in place.
+  std::vector<DirectoryCandidate> &candidates{scan.directoryCandidates};
+  candidates = knownCandidates;
+  const std::vector<ClusterExtent> &freeRuns{getFatIndex().getFreeRuns()};
 
-    // Read final 3 ASCII characters for extension.
-    bool hasExtension{false};
-    for (std::size_t j{8}; j < 11; ++j)
+  // Allocated clusters belong to live chains, so only free runs are read, front to back in large blocks,
+  // asking for the next block before classifying the current one.
+  for (std::size_t runIndex{0}; runIndex < freeRuns.size(); ++runIndex)
+  {
+    const ClusterExtent &run{freeRuns[runIndex]};
+    for (uint32_t done{0}, count{0}; done < run.clusterCount; done += count)
     {
-      if (entry.back().name[j] != ' ')
+      uint32_t blockStart{run.firstCluster + done};
+      count = std::min(blockClusters, run.clusterCount - done);
+
+      // Blocks stay within one FAT chunk, chunks that did not change since the index was saved are skipped.
+      if (!changedChunks.empty())
       {
-        if (!hasExtension)
+        uint64_t chunk{blockStart / ScanIndex::fatChunkEntries};
+        uint64_t chunkEnd{(chunk + 1) * ScanIndex::fatChunkEntries};
+        count = static_cast<uint32_t>(std::min<uint64_t>(count, chunkEnd - blockStart));
+        if (chunk < changedChunks.size() && !changedChunks[chunk])
+          continue;
+      }
+
+      if (done + count < run.clusterCount)
+        device.prefetchClusters(blockStart + count, std::min(blockClusters, run.clusterCount - done - count));
+      else if (runIndex + 1 < freeRuns.size())
+        device.prefetchClusters(freeRuns[runIndex + 1].firstCluster, std::min(blockClusters, freeRuns[runIndex + 1].clusterCount));
+      std::span<const uint8_t> block{device.viewClusters(blockStart, count, blockScratch)};
+
+      for (uint32_t i{0}; i < count; ++i)
+      {
+        uint32_t cluster{blockStart + i};
+        std::span<const uint8_t> clusterData{block.subspan(static_cast<std::size_t>(i) * bytesPerCluster, bytesPerCluster)};
+        DirectoryClusterKind kind{classifyDirectoryCluster(clusterData)};
+        if (kind == DirectoryClusterKind::NotDirectory)
+          continue;
+
+        uint32_t parentCluster{0};
+        if (kind == DirectoryClusterKind::FirstCluster)
         {
-          shortName += '.';
-          hasExtension = true;
+          const FAT32Entry *dotDot{reinterpret_cast<const FAT32Entry *>(clusterData.data()) + 1};
+          parentCluster = (static_cast<uint32_t>(dotDot->firstClusterHigh) << 16) | dotDot->firstClusterLow;
         }
-        if (std::isprint(entry.back().name[j]))
-          shortName += static_cast<char>(entry.back().name[j]);
+        candidates.push_back({cluster, parentCluster, kind});
       }
     }
-    return shortName;
   }
-  catch (const std::runtime_error &)
+
+  // Candidates kept from a scan index come first, put them back in cluster order.
+  // Clusters already reached from root directory are kept as well (the index stays valid
+  // whatever the tree looks like next time), scanDirectory skips them.
+  std::sort(candidates.begin(), candidates.end(), [](const DirectoryCandidate &left, const DirectoryCandidate &right)
+            { return left.cluster < right.cluster; });
+
+  std::unordered_set<uint32_t> candidateClusters{};
+  for (const auto &candidate : candidates)
+    candidateClusters.insert(candidate.cluster);
+
+  // Scan subtree roots first (directories whose parent is not an orphan as well), so nested orphans
+  // get their real names through their parent's entries.
+  for (const auto &candidate : candidates)
   {
-    throw;
+    if (candidate.kind != DirectoryClusterKind::FirstCluster || candidateClusters.contains(candidate.parentCluster))
+      continue;
+    std::string path{"/orphan_" + std::to_string(candidate.cluster)};
+    scan.pool.submit([this, &scan, candidate, path]
+                     { scanDirectory(scan, candidate.cluster, path, true, false); });
   }
+  scan.pool.wait();
+
+  // Whatever was not reached through a parent (parent entry overwritten, continuation clusters) stands on its own.
+  for (const auto &candidate : candidates)
+  {
+    {
+      std::lock_guard lock{scan.mutex};
+      if (scan.visitedClusters.contains(candidate.cluster))
+        continue;
+    }
+    std::string path{"/orphan_" + std::to_string(candidate.cluster)};
+    bool isFirstCluster{candidate.kind == DirectoryClusterKind::FirstCluster};
+    scan.pool.submit([this, &scan, candidate, path, isFirstCluster]
+                     { scanDirectory(scan, candidate.cluster, path, isFirstCluster, false); });
+  }
+  scan.pool.wait();
+}
+
+std::string Fat32Recoverer::getEntryName(std::span<const FAT32Entry> entry)
+{
+  std::string name{};
+  appendEntryName(entry, name);
+  return name;
 }
 
 void Fat32Recoverer::printDeletedEntriesConsole()
@@ -187,19 +519,18 @@ void Fat32Recoverer::printDeletedEntriesConsole()
     }
 
     std::cout << "Deleted entries:\n";
-    std::size_t count{1};
-    for (const auto &entries : deletedEntries)
+    for (std::size_t index{0}; index < deletedEntries.size(); ++index)
     {
-      std::string entryName{getEntryNameAscii(entries)};
+      std::string_view entryPath{deletedEntries.getPath(index)};
 
-      std::cout << count << ". " << entryName;
-      if (entryisDir(entries.back()))
-        std::cout << " (directory)\n";
-      else if (entryisFile(entries.back()))
-        std::cout << " (file)\n";
+      std::cout << index + 1 << ". " << entryPath << (entryPath == "/" ? "" : "/") << deletedEntries.getName(index);
+      if (entryisDir(deletedEntries.getMainEntry(index)))
+        std::cout << " (directory, ";
+      else if (entryisFile(deletedEntries.getMainEntry(index)))
+        std::cout << " (file, ";
       else
         throw std::runtime_error{"Invalid type of entry when printing deleted entries"};
-      ++count;
+      std::cout << static_cast<unsigned>(deletedEntries.getRecoverability(index)) << "% recoverable)\n";
     }
   }
   catch (const std::runtime_error &)
@@ -210,15 +541,17 @@ void Fat32Recoverer::printDeletedEntriesConsole()
 
 void Fat32Recoverer::recoverDeletedEntry(const std::size_t index, const std::string_view outputDir)
 {
+  FAT32R_TIME_PHASE(Recovery);
   try
   {
     if (index >= deletedEntries.size())
       throw std::runtime_error{"Out of bound when acessing deleted entries"};
 
-    if (entryisDir(deletedEntries[index].back()))
-      recoverDeletedDir(deletedEntries[index], outputDir);
+    validationFailures.clear();
+    if (deletedEntries.isDirectory(index))
+      recoverDeletedDir(deletedEntries.getSlots(index), outputDir);
     else
-      recoverDeletedFile(deletedEntries[index], outputDir);
+      recoverDeletedFile(deletedEntries.getSlots(index), outputDir);
   }
   catch (const std::runtime_error &)
   {
@@ -226,84 +559,364 @@ void Fat32Recoverer::recoverDeletedEntry(const std::size_t index, const std::str
   }
 }
 
-void Fat32Recoverer::writeFileToPath(const std::vector<uint8_t> &fileData, const std::string outputDir)
+std::vector<std::size_t> Fat32Recoverer::recoverDeletedEntries(const std::vector<std::size_t> &indices, const std::string_view outputDir)
 {
+  FAT32R_TIME_PHASE(Recovery);
   try
   {
-    std::ofstream file(outputDir, std::ios::binary | std::ios::out | std::ios::trunc);
+    for (const auto index : indices)
+      if (index >= deletedEntries.size())
+        throw std::runtime_error{"Out of bound when acessing deleted entries"};
 
-    if (!file)
-      throw std::runtime_error{"Failed to open output file for writing"};
+    validationFailures.clear();
+    std::vector<std::size_t> failed{};
 
-    std::size_t chunkSize{4096}; // Write in chunks of 4096 bytes to prevent error from big files.
-    std::size_t bytesLeft{fileData.size()};
-    std::size_t position{0};
+    // Directory of an entry under outputDir, mirroring where the entry was on the volume.
+    auto outputDirOf{[this, outputDir](const std::size_t index)
+                     {
+                       std::filesystem::path directory{std::filesystem::path{outputDir} / std::filesystem::path{deletedEntries.getPath(index)}.relative_path()};
+                       std::filesystem::create_directories(directory);
+                       return directory;
+                     }};
 
-    while (bytesLeft > 0)
-    {
-      std::size_t bytesToWrite{std::min(chunkSize, bytesLeft)}; // Accounts for when bytesLeft < chunkSize to prevent writting out-of-bound.
+    std::unordered_set<std::string> takenPaths{};
+    std::vector<FileJob> jobs{};
+    jobs.reserve(indices.size());
 
-      if (!file.write(reinterpret_cast<const char *>(&fileData[position]), static_cast<std::streamsize>(bytesToWrite)))
-        throw std::runtime_error{"Error writing data to file"};
+    // Directories first, outermost first, each expanded subtree covering the entries read from its directories,
+    // told apart by first cluster since deleted directories often share a path. Entries found in a directory
+    // an expansion read are written by it (and fail with it), they are not recovered a second time.
+    std::vector<std::size_t> directories{};
+    for (const auto index : indices)
+      if (deletedEntries.isDirectory(index))
+        directories.push_back(index);
+    auto depthOf{[this](const std::size_t index)
+                 {
+                   std::string_view path{deletedEntries.getPath(index)};
+                   return path == "/" ? 0 : std::ranges::count(path, '/');
+                 }};
+    std::stable_sort(directories.begin(), directories.end(), [&depthOf](const std::size_t left, const std::size_t right)
+                     { return depthOf(left) < depthOf(right); });
 
-      position += bytesToWrite;
-      bytesLeft -= bytesToWrite;
-    }
+    std::unordered_map<uint32_t, std::size_t> coveringDirectory{}; // Directory cluster read by an expansion, catalogue index of the directory expanded.
+    std::vector<std::pair<std::size_t, std::size_t>> covered{};    // Entry written by an expansion, directory expanded.
+    auto coveredBy{[this, &coveringDirectory, &covered](const std::size_t index)
+                   {
+                     auto position{coveringDirectory.find(deletedEntries.getPathCluster(index))};
+                     if (position == coveringDirectory.end())
+                       return false;
+                     covered.emplace_back(index, position->second);
+                     return true;
+                   }};
 
-    file.flush();
+    for (const auto index : directories)
+    {
+      std::unordered_set<uint32_t> expandedDirectories{};
+      try
+      {
+        if (!coveredBy(index))
+          expandDeletedDir(deletedEntries.getSlots(index), index, outputDirOf(index), takenPaths, jobs, expandedDirectories);
+      }
+      catch (const std::runtime_error &)
+      {
+        failed.push_back(index);
+      }
+      for (const auto cluster : expandedDirectories)
+        coveringDirectory.try_emplace(cluster, index);
+    }
 
-    if (!file)
-      throw std::runtime_error{"Error occurred during file write operation"};
+    for (const auto index : indices)
+    {
+      try
+      {
+        if (deletedEntries.isDirectory(index) || coveredBy(index))
+          continue;
 
-    file.close();
+        FileJob job{index, uniqueOutputPath(outputDirOf(index), std::filesystem::path{deletedEntries.getName(index)}, takenPaths), reconstructClusterChain(deletedEntries.getMainEntry(index)), deletedEntries.getSize(index), 0};
+        for (const auto &extent : job.extents)
+          job.extentBytes += static_cast<uint64_t>(extent.clusterCount) * device.getBytesPerCluster();
+        jobs.push_back(std::move(job));
+      }
+      catch (const std::runtime_error &)
+      {
+        failed.push_back(index);
+      }
+    }
 
-    if (!std::filesystem::exists(outputDir) || std::filesystem::file_size(outputDir) != fileData.size())
-      throw std::runtime_error{"File verification failed after writing"};
+    std::vector<std::size_t> jobsFailed{writeFileJobs(std::move(jobs))};
+    failed.insert(failed.end(), jobsFailed.begin(), jobsFailed.end());
+    std::sort(failed.begin(), failed.end());
+    for (const auto &[index, directory] : covered)
+      if (std::binary_search(failed.begin(), failed.end(), directory))
+        failed.push_back(index);
+    std::sort(failed.begin(), failed.end());
+    failed.erase(std::unique(failed.begin(), failed.end()), failed.end());
+    return failed;
   }
-  catch (const std::exception &)
+  catch (const std::runtime_error &)
   {
     throw;
   }
+  catch (...)
+  {
+    throw std::runtime_error{"Error recovering deleted entries"};
+  }
+}
+
+std::filesystem::path Fat32Recoverer::uniqueOutputPath(const std::filesystem::path &directory, const std::filesystem::path &name, std::unordered_set<std::string> &takenPaths)
+{
+  std::filesystem::path candidate{directory / name};
+  for (unsigned n{1}; takenPaths.contains(candidate.string()) || std::filesystem::exists(candidate); ++n)
+    candidate = directory / (name.stem().string() + "~" + std::to_string(n) + name.extension().string());
+  takenPaths.insert(candidate.string());
+  return candidate;
 }
 
-void Fat32Recoverer::recoverDeletedFile(const std::vector<FAT32Entry> &entry, const std::string_view outputDir)
+std::vector<std::size_t> Fat32Recoverer::writeFileJobs(std::vector<FileJob> jobs)
 {
   try
   {
-    if (!entryisFile(entry.back()))
-      throw std::runtime_error{"Entry is not a file"};
+    std::vector<std::size_t> failed{};
+    std::mutex failedMutex{};
+    auto markFailed{[&failed, &failedMutex](const std::size_t index)
+                    {
+                      std::lock_guard lock{failedMutex};
+                      failed.push_back(index);
+                    }};
 
-    if (deletedEntries.empty())
-      throw std::runtime_error{"No deleted entry to recover file"};
+    std::stable_sort(jobs.begin(), jobs.end(), [](const FileJob &a, const FileJob &b)
+                     { return (a.extents.empty() ? 0 : a.extents.front().firstCluster) < (b.extents.empty() ? 0 : b.extents.front().firstCluster); });
+
+    // Read-ahead accounting, the reading thread blocks while writers are too far behind.
+    std::mutex budgetMutex{};
+    std::condition_variable budgetFreed{};
+    uint64_t bytesInFlight{0};
+
+    // Declared last, so it waits for its tasks before anything they use goes away.
+    ThreadPool pool{threadCount};
+
+    // Small files are read together in one batch of up to extentReadSize bytes,
+    // each then written from its slice of the shared buffer by a pool task.
+    std::vector<FileJob> group{};
+    uint64_t groupBytes{0};
+    auto flushGroup{[&]()
+                    {
+                      if (group.empty())
+                        return;
+
+                      {
+                        std::unique_lock lock{budgetMutex};
+                        budgetFreed.wait(lock, [&]()
+                                         { return bytesInFlight == 0 || bytesInFlight + groupBytes <= recoveryWriteBudget; });
+                        bytesInFlight += groupBytes;
+                      }
+
+                      auto data{std::make_shared<std::vector<uint8_t>>()};
+                      try
+                      {
+                        std::vector<ClusterExtent> extents{};
+                        for (const auto &job : group)
+                          extents.insert(extents.end(), job.extents.begin(), job.extents.end());
+                        if (!extents.empty())
+                          device.readExtents(extents, *data);
+                      }
+                      catch (const std::runtime_error &)
+                      {
+                        for (const auto &job : group)
+                          markFailed(job.index);
+                        {
+                          std::lock_guard lock{budgetMutex};
+                          bytesInFlight -= groupBytes;
+                        }
+                        group.clear();
+                        groupBytes = 0;
+                        return;
+                      }
+
+                      std::size_t position{0};
+                      for (auto &job : group)
+                      {
+                        std::size_t start{position};
+                        position += static_cast<std::size_t>(job.extentBytes);
+                        pool.submit([&, data, start, job = std::move(job)]()
+                                    {
+                                      try
+                                      {
+                                        RecoveryWriter writer{job.outputPath.string()};
+                                        attachValidator(writer, job.outputPath.filename().string());
+                                        try
+                                        {
+                                          writer.write(std::span<const uint8_t>{*data}.subspan(start, static_cast<std::size_t>(std::min(job.size, job.extentBytes))));
+                                          writer.finish();
+                                        }
+                                        catch (...)
+                                        {
+                                          recordValidation(writer, job.extents);
+                                          throw;
+                                        }
+                                        recordValidation(writer, job.extents);
+                                      }
+                                      catch (...)
+                                      {
+                                        markFailed(job.index);
+                                      }
+
+                                      {
+                                        std::lock_guard lock{budgetMutex};
+                                        bytesInFlight -= job.extentBytes;
+                                      }
+                                      budgetFreed.notify_all(); });
+                      }
+                      group.clear();
+                      groupBytes = 0;
+                    }};
+
+    for (auto &job : jobs)
+    {
+      // Files bigger than one batch are streamed straight through, in turn.
+      if (job.extentBytes > extentReadSize)
+      {
+        flushGroup();
+        try
+        {
+          RecoveryWriter writer{job.outputPath.string()};
+          attachValidator(writer, job.outputPath.filename().string());
+          try
+          {
+            streamExtents(job.extents, job.size, writer);
+            writer.finish();
+          }
+          catch (const std::runtime_error &)
+          {
+            recordValidation(writer, job.extents);
+            throw;
+          }
+          recordValidation(writer, job.extents);
+        }
+        catch (const std::runtime_error &)
+        {
+          markFailed(job.index);
+        }
+        continue;
+      }
+
+      if (groupBytes + job.extentBytes > extentReadSize)
+        flushGroup();
+      groupBytes += job.extentBytes;
+      group.push_back(std::move(job));
+    }
+    flushGroup();
+    pool.wait();
+
+    std::sort(failed.begin(), failed.end());
+    failed.erase(std::unique(failed.begin(), failed.end()), failed.end());
+    return failed;
+  }
+  catch (const std::runtime_error &)
+  {
+    throw;
+  }
+  catch (...)
+  {
+    throw std::runtime_error{"Error writing recovered files"};
+  }
+}
+
+std::vector<std::size_t> Fat32Recoverer::recoverDeletedEntries(const std::function<bool(const DeletedEntryCatalogue &entries, const std::size_t index)> &predicate, const std::string_view outputDir)
+{
+  std::vector<std::size_t> indices{};
+  for (std::size_t index{0}; index < deletedEntries.size(); ++index)
+    if (predicate(deletedEntries, index))
+      indices.push_back(index);
+  return recoverDeletedEntries(indices, outputDir);
+}
 
-    std::vector<uint8_t> fileData{};
-    std::string fileName{getEntryNameAscii(entry)};
+void Fat32Recoverer::streamExtents(const std::vector<ClusterExtent> &extents, uint64_t size, RecoveryWriter &writer)
+{
+  std::vector<uint8_t> readScratch{}; // Only used when the device cannot be viewed in place.
+  uint32_t readClusters{std::max<uint32_t>(1, static_cast<uint32_t>(extentReadSize / device.getBytesPerCluster()))};
 
-    uint32_t currentCluster{(static_cast<uint32_t>(entry.back().firstClusterHigh) << 16) | entry.back().firstClusterLow}; // Initilized with the file's starting cluster.
-    uint32_t bytesPerCluster{static_cast<uint32_t>(device.getBootSector()->bytesPerSector) * static_cast<uint32_t>(device.getBootSector()->sectorsPerCluster)};
-    uint32_t remainingSize{entry.back().size};
+  auto writeData{[&](std::span<const uint8_t> data)
+                 {
+                   std::size_t bytesToWrite{static_cast<std::size_t>(std::min<uint64_t>(size, data.size()))};
+                   writer.write(data.first(bytesToWrite));
+                   size -= bytesToWrite;
+                 }};
 
-    // This loop reads data (contents) of the file following its cluster chain in FAT table,
-    // then append the data to fileData vector for writing later.
-    // 0x0FFFFFF8 to 0x0FFFFFFF marks the end of the cluster chain, whereas cluster's numbering starts at #0x2.
-    while (remainingSize > 0 && currentCluster >= 0x2 && currentCluster < 0x0FFFFFF8)
+  if (device.viewsInPlace())
+  {
+    for (const auto &extent : extents)
     {
-      std::vector<uint8_t> clusterData{device.readClusterData(currentCluster)};
-      uint32_t bytesToInsert{std::min(remainingSize, bytesPerCluster)};
+      for (uint32_t done{0}; done < extent.clusterCount && size > 0; done += readClusters)
+      {
+        uint32_t count{std::min(readClusters, extent.clusterCount - done)};
+        writeData(device.viewClusters(extent.firstCluster + done, count, readScratch));
+      }
+    }
+    return;
+  }
+
+  // Pack extents (split when bigger than one read) into batches of at most readClusters clusters.
+  std::vector<ClusterExtent> batch{};
+  uint32_t batchClusters{0};
+  auto flushBatch{[&]()
+                  {
+                    if (batch.empty())
+                      return;
+                    writeData(device.readExtents(batch, readScratch));
+                    batch.clear();
+                    batchClusters = 0;
+                  }};
 
-      if (clusterData.size() != bytesPerCluster)
-        throw std::runtime_error{"Incomplete cluster read"};
+  for (const auto &extent : extents)
+  {
+    for (uint32_t done{0}; done < extent.clusterCount && size > 0;)
+    {
+      uint32_t count{std::min(readClusters - batchClusters, extent.clusterCount - done)};
+      batch.push_back({extent.firstCluster + done, count});
+      batchClusters += count;
+      done += count;
 
-      fileData.insert(fileData.end(), clusterData.begin(), clusterData.begin() + bytesToInsert);
-      remainingSize -= bytesToInsert;
-      currentCluster = device.getFatTable()[currentCluster];
+      // Only read as many clusters as the remaining size needs.
+      if (batchClusters == readClusters || static_cast<uint64_t>(batchClusters) * device.getBytesPerCluster() >= size)
+        flushBatch();
     }
+  }
+  flushBatch();
+}
+
+void Fat32Recoverer::recoverDeletedFile(std::span<const FAT32Entry> entry, const std::string_view outputDir)
+{
+  try
+  {
+    if (!entryisFile(entry.back()))
+      throw std::runtime_error{"Entry is not a file"};
+
+    if (deletedEntries.empty())
+      throw std::runtime_error{"No deleted entry to recover file"};
+
+    std::string fileName{getEntryName(entry)};
 
     // Create the file path by appending its name to the output directory.
     std::filesystem::path currentPath{outputDir};
     std::filesystem::path newOutputPath{currentPath / fileName};
+    RecoveryWriter writer{newOutputPath.string()};
+    attachValidator(writer, fileName);
 
-    writeFileToPath(fileData, newOutputPath.string());
+    // Data (contents) of the file is read one extent (run of consecutive clusters) at a time
+    // and streamed straight to the output file, so memory use does not grow with file size.
+    std::vector<ClusterExtent> extents{reconstructClusterChain(entry.back())};
+    try
+    {
+      streamExtents(extents, entry.back().size, writer);
+      writer.finish();
+    }
+    catch (const std::runtime_error &)
+    {
+      recordValidation(writer, extents);
+      throw;
+    }
+    recordValidation(writer, extents);
   }
   catch (const std::runtime_error &)
   {
@@ -315,80 +928,241 @@ void Fat32Recoverer::recoverDeletedFile(const std::vector<FAT32Entry> &entry, co
   }
 }
 
-void Fat32Recoverer::recoverDeletedDir(const std::vector<FAT32Entry> &entry, const std::string_view outputDir)
+void Fat32Recoverer::recoverDeletedDir(std::span<const FAT32Entry> entry, const std::string_view outputDir)
+{
+  try
+  {
+    if (deletedEntries.empty())
+      throw std::runtime_error{"No deleted entry to recover directory"};
+
+    std::unordered_set<std::string> takenPaths{};
+    std::vector<FileJob> jobs{};
+    std::unordered_set<uint32_t> expandedDirectories{};
+    expandDeletedDir(entry, 0, std::filesystem::path{outputDir}, takenPaths, jobs, expandedDirectories);
+    if (!writeFileJobs(std::move(jobs)).empty())
+      throw std::runtime_error{"Failed to recover some files of the directory"};
+  }
+  catch (const std::runtime_error &)
+  {
+    throw;
+  }
+  catch (...)
+  {
+    throw std::runtime_error{"Error recovering deleted directory"};
+  }
+}
+
+void Fat32Recoverer::expandDeletedDir(std::span<const FAT32Entry> entry, const std::size_t index, const std::filesystem::path &outputDir, std::unordered_set<std::string> &takenPaths,
+                                      std::vector<FileJob> &jobs, std::unordered_set<uint32_t> &expandedDirectories)
 {
   try
   {
     if (!entryisDir(entry.back()))
       throw std::runtime_error{"Entry is not a directory"};
 
-    if (deletedEntries.empty())
-      throw std::runtime_error{"No deleted entry to recover directory"};
+    // A directory of the subtree, still to be read.
+    struct PendingDirectory
+    {
+      uint32_t firstCluster{};
+      std::filesystem::path outputPath{};
+      bool isDeleted{};
+    };
+
+    uint32_t firstCluster{(static_cast<uint32_t>(entry.back().firstClusterHigh) << 16) | entry.back().firstClusterLow};
+    std::deque<PendingDirectory> pending{};
+    pending.push_back({firstCluster, uniqueOutputPath(outputDir, std::filesystem::path{getEntryName(entry)}, takenPaths), true});
 
-    std::string dirName{getEntryNameAscii(entry)};
-    uint32_t currentCluster{(static_cast<uint32_t>(entry.back().firstClusterHigh) << 16) | entry.back().firstClusterLow}; // Initilized with the folder's starting cluster.
-    std::vector<FAT32Entry> dirEntries{};
+    std::unordered_set<uint32_t> visitedClusters{}; // Every directory cluster is read once, protects against looping chains.
+    std::vector<FAT32Entry> cachedEntries{};        // For caching a vector of long file name entries, and main file/directory entry at the back.
+    std::vector<FAT32Entry> clusterScratch{};       // Only used when the device cannot be viewed in place.
+    bool isTop{true};
 
-    // This loop reads all entries of the folder following its cluster chain in FAT table,
-    // then append the data to fileData vector for writing later.
-    // 0x0FFFFFF8 to 0x0FFFFFFF marks the end of the cluster chain, whereas cluster's numbering starts at #0x2.
-    while (currentCluster >= 0x2 && currentCluster < 0x0FFFFFF8)
+    // Directories level by level, each created before anything below it is looked at,
+    // so the whole output hierarchy exists before the first file gets written.
+    while (!pending.empty())
     {
-      std::vector<FAT32Entry> clusterEntries{device.readClusterEntries(currentCluster)};
-      for (const auto &dirEntry : clusterEntries)
+      PendingDirectory directory{std::move(pending.front())};
+      pending.pop_front();
+
+      // A deleted directory's cluster may have been reused by something else since, only trust it if it starts with ".".
+      uint32_t currentCluster{directory.firstCluster};
+      if (directory.isDeleted && device.isDataCluster(currentCluster))
       {
-        // Skip parent folder and the folder itself.
-        if (dirEntry.name[0] == '.' && (dirEntry.name[1] == ' ' || (dirEntry.name[1] == '.' && dirEntry.name[2] == ' '))) // "." and ".." entry
-          continue;
+        std::span<const FAT32Entry> clusterEntries{device.viewClusterEntries(currentCluster, clusterScratch)};
+        if (clusterEntries.empty() || !entryisDir(clusterEntries.front()) || clusterEntries.front().name[0] != '.' || clusterEntries.front().name[1] != ' ')
+        {
+          if (isTop)
+            throw std::runtime_error{"Directory clusters were overwritten"};
+          currentCluster = 0;
+        }
+      }
+      isTop = false;
 
-        // Skip empty entries.
-        if (dirEntry.name[0] == 0x0)
-          continue;
+      if (!std::filesystem::create_directories(directory.outputPath) && !std::filesystem::is_directory(directory.outputPath))
+        throw std::runtime_error{"Failed to create directory when recovering"};
 
-        // Failsafe check for skipping anything that is not a file/directory/long file name entry.
-        if (!entryisFile(dirEntry) && !entryisDir(dirEntry) && !entryisLongFileName(dirEntry))
-          continue;
+      // 0x0FFFFFF8 to 0x0FFFFFFF marks the end of the cluster chain, anything else outside the data region (free or bad) a broken one.
+      cachedEntries.clear();
+      if (device.isDataCluster(currentCluster) && !visitedClusters.contains(currentCluster))
+        expandedDirectories.insert(directory.firstCluster);
+      while (device.isDataCluster(currentCluster) && visitedClusters.insert(currentCluster).second)
+      {
+        FAT32R_COUNT(ClustersDecoded, 1);
+        for (const auto &dirEntry : device.viewClusterEntries(currentCluster, clusterScratch))
+        {
+          // If the entry is a long file name,
+          // just cache it until encountering a file/directory because
+          // long file name entries are always at the front of the
+          // entry they support.
+          if (entryisLongFileName(dirEntry))
+          {
+            cachedEntries.push_back(dirEntry);
+            continue;
+          }
 
-        dirEntries.push_back(dirEntry);
-      }
+          // Skip empty entries, anything that is not a file/directory, and the directory itself and its parent ("." and "..").
+          if (dirEntry.name[0] == 0x0 || (!entryisFile(dirEntry) && !entryisDir(dirEntry)) ||
+              (dirEntry.name[0] == '.' && (dirEntry.name[1] == ' ' || (dirEntry.name[1] == '.' && dirEntry.name[2] == ' '))))
+          {
+            cachedEntries.clear();
+            continue;
+          }
+
+          cachedEntries.push_back(dirEntry);
+          std::filesystem::path outputPath{uniqueOutputPath(directory.outputPath, std::filesystem::path{getEntryName(cachedEntries)}, takenPaths)};
+          uint32_t entryCluster{(static_cast<uint32_t>(dirEntry.firstClusterHigh) << 16) | dirEntry.firstClusterLow};
+          cachedEntries.clear();
+
+          if (entryisDir(dirEntry))
+          {
+            pending.push_back({entryCluster, std::move(outputPath), entryisDeleted(dirEntry)});
+            continue;
+          }
 
-      currentCluster = device.getFatTable()[currentCluster];
+          FileJob job{index, std::move(outputPath), reconstructClusterChain(dirEntry), dirEntry.size, 0};
+          for (const auto &extent : job.extents)
+            job.extentBytes += static_cast<uint64_t>(extent.clusterCount) * device.getBytesPerCluster();
+          jobs.push_back(std::move(job));
+        }
+
+        currentCluster = device.nextCluster(currentCluster);
+      }
     }
+  }
+  catch (const std::runtime_error &)
+  {
+    throw;
+  }
+  catch (...)
+  {
+    throw std::runtime_error{"Error recovering deleted directory"};
+  }
+}
 
-    // Create the folder itself by appending to output path.
-    std::filesystem::path currentPath{outputDir};
-    std::filesystem::path newOutputDir{currentPath / dirName};
-    if (!std::filesystem::create_directory(newOutputDir))
-      throw std::runtime_error{"Failed to create directory when recovering"};
+std::vector<Fat32Recoverer::CarvedFile> Fat32Recoverer::carveFreeClusters(const std::string_view outputDir, const std::vector<FileCarver::Type> &types)
+{
+  FAT32R_TIME_PHASE(Carve);
+  try
+  {
+    const FatIndex &index{getFatIndex()};
+    uint32_t bytesPerCluster{device.getBytesPerCluster()};
+    uint32_t blockClusters{std::max<uint32_t>(1, static_cast<uint32_t>(orphanSweepBlockSize / bytesPerCluster))};
+
+    std::array<bool, FileCarver::typeCount> wanted{};
+    for (const auto type : types)
+      wanted[static_cast<std::size_t>(type)] = true;
+    if (types.empty())
+      wanted.fill(true);
+
+    // Files still listed as deleted entries are recovered from their entry instead.
+    std::vector<uint32_t> entryClusters{deletedEntries.getFirstClusters().begin(), deletedEntries.getFirstClusters().end()};
+    std::sort(entryClusters.begin(), entryClusters.end());
 
-    std::vector<FAT32Entry> cachedDirEntries{}; // For caching a vector of long file name entries, and main file/directory entry at the back.
-    for (const auto &entry : device.getRootEntries())
+    struct Candidate
     {
-      // If the entry is a long file name,
-      // just cache it until encountering a file/directory because
-      // long file name entries are always at the front of the
-      // entry they support.
-      if (entryisLongFileName(entry))
-      {
-        cachedDirEntries.push_back(entry);
-        continue;
-      }
-      // If the entry is a file/directory,
-      // we found the long file name entries and their main entry,
-      // so we call the apropriate method for recovering them.
-      else if (entryisDir(entry))
-      {
-        cachedDirEntries.push_back(entry);
-        recoverDeletedDir(cachedDirEntries, newOutputDir.string());
-        cachedDirEntries.clear();
-      }
-      else
+      uint32_t cluster{};
+      FileCarver::Type type{};
+      std::vector<ClusterExtent> extents{};
+      uint64_t size{};
+    };
+    std::vector<Candidate> candidates{};
+    std::mutex candidatesMutex{};
+
+    // Only free runs can hold files nothing points to, each block of them is matched by its own task.
+    {
+      ThreadPool pool{threadCount};
+      for (const auto &run : index.getFreeRuns())
       {
-        cachedDirEntries.push_back(entry);
-        recoverDeletedFile(cachedDirEntries, newOutputDir.string());
-        cachedDirEntries.clear();
+        for (uint32_t done{0}, count{0}; done < run.clusterCount; done += count)
+        {
+          uint32_t blockStart{run.firstCluster + done};
+          count = std::min(blockClusters, run.clusterCount - done);
+          pool.submit([this, &wanted, &entryClusters, &candidates, &candidatesMutex, blockStart, count, bytesPerCluster]
+                      {
+                        std::vector<uint8_t> blockScratch{}; // Only used when the device cannot be viewed in place.
+                        std::span<const uint8_t> block{device.viewClusters(blockStart, count, blockScratch)};
+                        std::vector<Candidate> found{};
+                        for (uint32_t i{0}; i < count; ++i)
+                        {
+                          std::optional<FileCarver::Type> type{FileCarver::matchHeader(block.subspan(static_cast<std::size_t>(i) * bytesPerCluster, FileCarver::headerSize))};
+                          if (type.has_value() && wanted[static_cast<std::size_t>(*type)] && !std::binary_search(entryClusters.begin(), entryClusters.end(), blockStart + i))
+                            found.push_back({blockStart + i, *type, {}, 0});
+                        }
+                        std::lock_guard lock{candidatesMutex};
+                        candidates.insert(candidates.end(), std::make_move_iterator(found.begin()), std::make_move_iterator(found.end()));
+                      });
+        }
       }
+      pool.wait();
+
+      // Every candidate's end is looked for on its own.
+      std::sort(candidates.begin(), candidates.end(), [](const Candidate &left, const Candidate &right)
+                { return left.cluster < right.cluster; });
+      for (auto &candidate : candidates)
+        pool.submit([this, &candidate, bytesPerCluster]
+                    {
+                      uint64_t maxClusters{(FileCarver::getMaxSize(candidate.type) + bytesPerCluster - 1) / bytesPerCluster};
+                      FileCarver carver{device, freeExtentsFrom(candidate.cluster, maxClusters)};
+                      candidate.size = carver.findEnd(candidate.type);
+                      if (candidate.size != 0)
+                        candidate.extents = freeExtentsFrom(candidate.cluster, (candidate.size + bytesPerCluster - 1) / bytesPerCluster);
+                    });
+      pool.wait();
     }
+
+    // A header inside a file carved already is part of it (a thumbnail, an archived file, ...).
+    std::vector<CarvedFile> carvedFiles{};
+    std::vector<std::vector<ClusterExtent>> carvedExtents{};
+    uint64_t carvedUntil{0}; // One past the last cluster of the last carved file.
+    for (auto &candidate : candidates)
+    {
+      if (candidate.size == 0 || candidate.cluster < carvedUntil)
+        continue;
+      std::string name{"carved_" + std::to_string(candidate.cluster) + "." + std::string{FileCarver::getExtension(candidate.type)}};
+      carvedFiles.push_back({candidate.type, candidate.cluster, candidate.size, (std::filesystem::path{outputDir} / name).string()});
+      carvedUntil = static_cast<uint64_t>(candidate.extents.back().firstCluster) + candidate.extents.back().clusterCount;
+      carvedExtents.push_back(std::move(candidate.extents));
+    }
+
+    // Written the same way recovered files are, one file failing does not stop the others.
+    ThreadPool pool{threadCount};
+    for (std::size_t i{0}; i < carvedFiles.size(); ++i)
+      pool.submit([this, &carvedFiles, &carvedExtents, i]
+                  {
+                    try
+                    {
+                      RecoveryWriter writer{carvedFiles[i].path};
+                      streamExtents(carvedExtents[i], carvedFiles[i].size, writer);
+                      writer.finish();
+                      carvedFiles[i].written = true;
+                    }
+                    catch (...)
+                    {
+                      carvedFiles[i].written = false;
+                    }
+                  });
+    pool.wait();
+    return carvedFiles;
   }
   catch (const std::runtime_error &)
   {
@@ -396,6 +1170,6 @@ void Fat32Recoverer::recoverDeletedDir(const std::vector<FAT32Entry> &entry, con
   }
   catch (...)
   {
-    throw std::runtime_error{"Error recovering deleted directory"};
+    throw std::runtime_error{"Error carving free clusters"};
   }
 }
@@ -1,43 +1,219 @@
 #pragma once
 #include "Fat32.h"
+#include "RecoveryWriter.h"
+#include "ThreadPool.h"
+#include "DirectoryClassifier.h"
+#include "FatIndex.h"
+#include "LiveChainIndex.h"
+#include "ScanIndex.h"
+#include "DeletedEntryCatalogue.h"
+#include "EntryName.h"
+#include "EntryQuery.h"
+#include "FileCarver.h"
 #include "uchar.h"
+#include <functional>
+#include <mutex>
+#include <unordered_set>
 
 // Class for reading a Fat32-formatted device/partition/disk/...
 // and support recovering deleted files/directories as well.
 class Fat32Recoverer
 {
+public:
+  // Callback receiving a deleted entry (long file name entries at the front, main entry at the back)
+  // and the path of the directory holding it.
+  using EntryListener = std::function<void(std::span<const FAT32Entry> entry, std::string_view path)>;
+
+  // What recovery does with files whose content a validator finds broken, see setValidation.
+  enum class Validation
+  {
+    Off,
+    Flag,
+    Abort,
+  };
+
+  // A recovered file whose content broke, at offset bytes in, read from cluster (0 if past its clusters).
+  struct ValidationFailure
+  {
+    std::string path{};
+    uint64_t offset{};
+    uint32_t cluster{};
+    std::string reason{};
+  };
+
+  // A file carved out of free clusters, see carveFreeClusters.
+  struct CarvedFile
+  {
+    FileCarver::Type type{};
+    uint32_t firstCluster{};
+    uint64_t size{};
+    std::string path{};
+    bool written{false}; // False when writing it failed, the others are written all the same.
+  };
+
 private:
   Fat32Device device{}; // Store read device/partition/disk/... here.
 
   // Cached deleted entries (file/directory) for later use.
-  // 2D vector because each valid file/directory entry can have zero to multiple
-  // long file name entries, so each valid entry will take up a vector
-  // with long file name entries at the front and
-  // the main file/directory entry at the back.
-  std::vector<std::vector<FAT32Entry>> deletedEntries{}; 
+  // Each valid file/directory entry can have zero to multiple long file name entries,
+  // kept in front of the main file/directory entry, along with its name and the full path
+  // of the directory holding it ("/" for root directory).
+  DeletedEntryCatalogue deletedEntries{};
 
-  // Private method for retrieving a main entry's name from a set of entries,
-  // with long file name entries at the front and main file/directory entry at the back.
-  // Support both long file name and short file name (as fallback).
-  // Do note that only ASCII characters are supported for now,
-  // other characters from long file name is turned into '?',
-  // and deleted marker of short file name turned into '_'.
-  std::string getEntryNameAscii(const std::vector<FAT32Entry> &entry);
+  // Number of threads scanning directories and writing batch recovered files, 0 means one per hardware thread.
+  std::size_t threadCount{0};
+
+  // Whether readDeletedEntries also sweeps the data region for orphaned directory clusters,
+  // and how much of the data region is read per step of that sweep.
+  bool orphanScan{false};
+  static constexpr std::size_t orphanSweepBlockSize{8 << 20};
+
+  // Largest single read issued for one extent of a recovered file.
+  static constexpr std::size_t extentReadSize{8 << 20};
+
+  // Most bytes batch recovery reads ahead of its output writes.
+  static constexpr std::size_t recoveryWriteBudget{64 << 20};
+
+  // Free cluster bitmap and free runs of FAT table, built on first use after each device read
+  // (it needs a pass over the whole FAT table, which listing deleted entries does not).
+  // Used to guess where a deleted file's zeroed chain used to go, and to only sweep free clusters for orphans.
+  FatIndex fatIndex{};
+  bool fatIndexBuilt{false};
+  std::mutex fatIndexMutex{};
+
+  // Private method returning fatIndex, building it first if needed.
+  const FatIndex &getFatIndex();
+
+  // Cluster chains of every live file and directory, collected by the last readDeletedEntries.
+  // Deleted entries are scored against it (see DeletedEntryCatalogue::score).
+  LiveChainIndex liveChains{};
+
+  // Deleted entries found in a single directory, merged into deletedEntries once every directory is scanned.
+  struct ScannedDirectory
+  {
+    uint32_t firstCluster{};
+    std::string path{};
+    DeletedEntryCatalogue entries{};
+  };
+
+  // Shared state of one full-volume scan, directories are scanned as thread pool tasks.
+  struct VolumeScan
+  {
+    ThreadPool pool;
+    std::mutex mutex{};
+    std::unordered_set<uint32_t> visitedClusters{}; // Every directory cluster is read once, protects against looping chains.
+    std::vector<ScannedDirectory> directories{};
+    std::vector<DirectoryCandidate> directoryCandidates{}; // Every free cluster the orphan sweep found looking like a directory.
+    std::vector<ClusterExtent> liveChains{};               // Extents of live entries' chains, in no particular order.
+
+    // Deleted subdirectories of live directories, scanned once every live directory was: a live directory may have
+    // taken a deleted one's clusters since, and must not find them already visited.
+    std::vector<std::pair<uint32_t, std::string>> deletedDirectories{};
+
+    explicit VolumeScan(const std::size_t threadCount) : pool{threadCount} {}
+  };
+
+  // Conditions deleted entries have to meet to be kept by readDeletedEntries.
+  EntryQuery query{};
+
+  // Private method adding a deleted entry to a catalogue if it matches query, decoding its name only when needed.
+  // Returns whether it was added.
+  bool addMatchingEntry(DeletedEntryCatalogue &catalogue, std::span<const FAT32Entry> entry, const uint32_t pathIndex) const;
+
+  // Called for every deleted entry as soon as a scan finds it, before the final list is sorted.
+  EntryListener entryListener{};
+  std::mutex entryListenerMutex{};
+
+  // Private method scanning one directory's cluster chain for deleted entries,
+  // queueing a new scan for every (live or deleted) subdirectory found, deleted subdirectories of live directories
+  // are left in scan.deletedDirectories instead. Deleted directories are only scanned if their first cluster still starts with a "." entry.
+  // In live directories (reached from root directory through live entries only), the chains of the directory
+  // and of its live files are collected as well.
+  void scanDirectory(VolumeScan &scan, const uint32_t firstCluster, const std::string path, const bool isDeleted, const bool isLive);
+
+  // Private method sweeping the free runs of the data region sequentially for clusters
+  // that look like directory tables but were not reached from root directory,
+  // then scanning them (and whatever subtree they still reference) under "/orphan_<cluster>" paths.
+  // Must run after the tree scan finished, so visited clusters are known.
+  // With changedChunks set (one flag per ScanIndex::fatChunkEntries clusters), only chunks flagged are swept,
+  // knownCandidates stand in for the others.
+  void sweepOrphanedDirectories(VolumeScan &scan, const std::vector<DirectoryCandidate> &knownCandidates = {}, const std::vector<bool> &changedChunks = {});
+
+  // Scan index file readDeletedEntries loads from and saves to, none when empty.
+  std::string indexPath{};
+
+  // Private method filling deletedEntries and fatIndex from a fresh scan index.
+  void loadScanIndex(const ScanIndex &index);
+
+  // Private method saving the current scan result, with the FAT chunk hashes it was made from.
+  void saveScanIndex(const std::vector<uint64_t> &fatChunkHashes, const std::vector<DirectoryCandidate> &directoryCandidates);
+
+  // Private method returning the scan options a scan index has to have been built with.
+  uint32_t scanIndexFlags() const;
 
-  // Private method for supporting writting a file to a path when recovering a file.
-  void writeFileToPath(const std::vector<uint8_t> &fileData, const std::string outputDir);
+  // Content validation of recovered files, and the failures found by the last recovery.
+  Validation validation{Validation::Off};
+  ContentValidator::Factory validatorFactory{ContentValidator::forFileName};
+  std::vector<ValidationFailure> validationFailures{};
+  std::mutex validationMutex{};
+
+  // Private method giving writer a validator for a file name, when validation is on and the factory knows its format.
+  void attachValidator(RecoveryWriter &writer, const std::string_view fileName);
+
+  // Private method recording writer's validation failure, if any, at the cluster of extents it's in.
+  void recordValidation(const RecoveryWriter &writer, const std::vector<ClusterExtent> &extents);
+
+  // Private method rebuilding the clusters holding an entry's data as extents, up to entry's size.
+  // Follows FAT table when the chain is still there, otherwise (FAT32 zeroes a deleted file's chain)
+  // assumes the file was allocated contiguously from its first cluster over clusters that are still free,
+  // skipping clusters allocated since.
+  std::vector<ClusterExtent> reconstructClusterChain(const FAT32Entry &entry);
+
+  // Private method returning the free clusters from firstCluster on, as extents of up to clusterCount clusters in total.
+  std::vector<ClusterExtent> freeExtentsFrom(const uint32_t firstCluster, uint64_t clusterCount);
+
+  // Private method streaming size bytes of extents to writer. Views the device in place when it's memory-mapped,
+  // otherwise groups extents into batched reads of up to extentReadSize so fragmented files
+  // do not cost one request per fragment.
+  void streamExtents(const std::vector<ClusterExtent> &extents, uint64_t size, RecoveryWriter &writer);
+
+  // A file to recover, worked out up front so reads can then go in cluster order.
+  struct FileJob
+  {
+    std::size_t index{}; // Deleted entry the file belongs to: the file itself, or a directory holding it.
+    std::filesystem::path outputPath{};
+    std::vector<ClusterExtent> extents{};
+    uint64_t size{};
+    uint64_t extentBytes{}; // Bytes of all extents, at least size unless the chain is cut short.
+  };
+
+  // Private method returning directory / name, or the first free "name~n" when taken on disk or in takenPaths,
+  // then marking it taken. Deleted entries often share a name (first character of short names is gone).
+  static std::filesystem::path uniqueOutputPath(const std::filesystem::path &directory, const std::filesystem::path &name, std::unordered_set<std::string> &takenPaths);
+
+  // Private method expanding a deleted directory (entry, catalogue #index) breadth-first from its own clusters:
+  // every directory of its subtree is created under outputDir right away, every file becomes a job appended to jobs.
+  // A deleted directory's zeroed chain leaves only its first cluster, which has to still start with a "." entry,
+  // throws if the top one does not. The first cluster of every directory whose entries were read is added to expandedDirectories.
+  void expandDeletedDir(std::span<const FAT32Entry> entry, const std::size_t index, const std::filesystem::path &outputDir, std::unordered_set<std::string> &takenPaths,
+                        std::vector<FileJob> &jobs, std::unordered_set<uint32_t> &expandedDirectories);
+
+  // Private method recovering jobs, the calling thread reading in cluster order (small files grouped into batched reads
+  // of up to extentReadSize, bigger ones streamed in turn) while the thread pool writes, at most recoveryWriteBudget
+  // bytes ahead. Returns the indices of jobs that failed, sorted and unique.
+  std::vector<std::size_t> writeFileJobs(std::vector<FileJob> jobs);
 
   // Private method for recovering a specific type of entry (file/dirrectory).
   // Called by recoverDeletedEntry when the right type is determined.
-  void recoverDeletedFile(const std::vector<FAT32Entry> &entry, const std::string_view outputDir);
-  void recoverDeletedDir(const std::vector<FAT32Entry> &entry, const std::string_view outputDir);
+  void recoverDeletedFile(std::span<const FAT32Entry> entry, const std::string_view outputDir);
+  void recoverDeletedDir(std::span<const FAT32Entry> entry, const std::string_view outputDir);
 
 public:
   // Default constructor.
   Fat32Recoverer() = default;
 
   // Take a device/partition/disk/...'s path to start reading immediately, also read deleted entries.
-  Fat32Recoverer(const std::string_view path);
+  Fat32Recoverer(const std::string_view path, const BlockSource::Mode mode = BlockSource::Mode::Auto);
 
   // Disabled copy and move semantics.
   Fat32Recoverer(const Fat32Recoverer &) = delete;
@@ -48,20 +224,84 @@ public:
 
   // Public method for reading device/partition/disk/... as well as its deleted entries.
   // Used by constructor, but user can use this as well.
-  void readDevice(const std::string_view path);
+  // The mode picks how the device is accessed (memory-mapped, plain reads, io_uring, ...).
+  void readDevice(const std::string_view path, const BlockSource::Mode mode = BlockSource::Mode::Auto);
+
+  // Public method for setting how many threads scan directories and write batch recovered files,
+  // 0 means one per hardware thread. Takes effect on the next readDeletedEntries or recoverDeletedEntries.
+  void setThreadCount(const std::size_t count) { threadCount = count; }
+
+  // Public method for enabling the orphaned directory sweep of the data region in readDeletedEntries,
+  // finds deleted entries whose parent directory chain is gone, at the cost of reading the whole data region.
+  void setOrphanScan(const bool enabled) { orphanScan = enabled; }
+
+  // Public method for setting the conditions deleted entries have to meet, checked during the scan itself
+  // so entries that do not match are never decoded further or kept. Takes effect on the next readDeletedEntries.
+  // A scan index is still loaded (and filtered) with a query set, but only saved without one.
+  void setQuery(EntryQuery entryQuery) { query = std::move(entryQuery); }
+
+  // Public method for setting a scan index file, empty for none. readDeletedEntries then loads deleted entries
+  // from it when it's fresh (same volume, FAT table unchanged), and otherwise scans and saves the result to it.
+  // A stale index still spares sweeping for orphans where FAT table did not change.
+  void setIndexPath(const std::string_view path) { indexPath = path; }
+
+  // Public methods forwarding volume, FAT access and cluster cache options to the device, they take effect on the next readDevice.
+  // See Fat32Device::setVolume, Fat32Device::setFatAccess, Fat32Device::setFatCrossCheck and Fat32Device::setClusterCache.
+  void setVolume(const uint64_t offset, const uint64_t size = 0) { device.setVolume(offset, size); }
+  void setFatAccess(const FatTable::Mode mode, const std::size_t cacheBudget = FatTable::defaultCacheBudget) { device.setFatAccess(mode, cacheBudget); }
+  void setFatCrossCheck(const bool enabled) { device.setFatCrossCheck(enabled); }
+  void setClusterCache(const std::size_t budget) { device.setClusterCache(budget); }
+
+  // Public getter for the cluster ranges where FAT copies disagree, empty unless cross-checking is enabled.
+  const std::vector<ClusterExtent> &getFatDivergences() const { return device.getFatDivergences(); }
+
+  // Public getter telling whether the device's boot sector was damaged and its backup copy used instead.
+  bool usedBackupBootSector() const { return device.usedBackupBootSector(); }
+
+  // Public getter for the device's cluster cache counters.
+  ClusterCache::Stats getClusterCacheStats() const { return device.getClusterCacheStats(); }
+
+  // Public method for validating recovered files' content as it's written, for formats factory has a validator for:
+  // Flag writes files whole and records failures, Abort stops writing a file where it breaks and fails it.
+  // Pinpoints where a reconstructed chain goes wrong (getValidationFailures) instead of writing garbage.
+  void setValidation(const Validation mode, ContentValidator::Factory factory = ContentValidator::forFileName)
+  {
+    validation = mode;
+    validatorFactory = std::move(factory);
+  }
+
+  // Public getter for the validation failures of the last recoverDeletedEntry or recoverDeletedEntries, in no particular order.
+  const std::vector<ValidationFailure> &getValidationFailures() const { return validationFailures; }
+
+  // Public method for streaming deleted entries out while readDeletedEntries is still scanning,
+  // e.g. to report progress on big volumes. The listener is called from scanning threads, one call at a time,
+  // in no particular order, an empty listener turns it off.
+  void setEntryListener(EntryListener listener) { entryListener = std::move(listener); }
+
+  // Public getters for the deleted entries found by the last readDeletedEntries,
+  // indexed the same way as printDeletedEntriesConsole (minus one) and recoverDeletedEntry.
+  const DeletedEntryCatalogue &getDeletedEntries() const { return deletedEntries; }
+  std::size_t getDeletedEntryCount() const { return deletedEntries.size(); }
 
   // Public method for printing deleted entries to console.
   // Useful for console app UI.
   // List starts at #1 for index #0.
   void printDeletedEntriesConsole();
 
+  // Public method for retrieving a main entry's name from a set of entries,
+  // with long file name entries at the front and main file/directory entry at the back.
+  // Support both long file name (as UTF-8) and short file name (as fallback),
+  // deleted marker of short file name turned into '_'. See appendEntryName.
+  std::string getEntryName(std::span<const FAT32Entry> entry);
+
   // Public methods for checking each type/characteristic of an entry.
   bool entryisDir(const FAT32Entry &entry);
   bool entryisFile(const FAT32Entry &entry);
   bool entryisLongFileName(const FAT32Entry &entry);
   bool entryisDeleted(const FAT32Entry &entry);
 
-  // Public method for reading deleted entries, each entry
+  // Public method for reading deleted entries of the whole volume (root directory and
+  // every reachable subdirectory, live or deleted), each entry
   // can be accompanied by multiple long file name entries.
   // Made public for user to refresh deleted entries list in case
   // they recover file/directory to the same device/partition/disk/...,
@@ -71,5 +311,24 @@ public:
   // Public method for recovering a desired deleted entry with its index
   // in deletedEntries member. If used with printDeletedEntriesConsole,
   // element #1 in list becomes 0 in index and so on.
+  // A directory is recovered with its whole subtree, throws if any of its files failed.
   void recoverDeletedEntry(const std::size_t index, const std::string_view outputDir);
+
+  // Public methods for recovering many deleted entries at once, picked by index or by a predicate
+  // called with the catalogue and each index in it. Entries keep their directory path under outputDir,
+  // a name already taken gets a "~n" suffix.
+  // Directories bring their whole subtree along (entries inside one recovered in the same call are not written twice).
+  // Files are read in order of their first cluster, small ones grouped into one batched read,
+  // while the thread pool writes the output files in parallel.
+  // One entry failing does not stop the others, returns the indices of entries that failed.
+  std::vector<std::size_t> recoverDeletedEntries(const std::vector<std::size_t> &indices, const std::string_view outputDir);
+  std::vector<std::size_t> recoverDeletedEntries(const std::function<bool(const DeletedEntryCatalogue &entries, const std::size_t index)> &predicate, const std::string_view outputDir);
+
+  // Public method for carving files of the given types (all when empty) out of free clusters by their content,
+  // for files whose directory entry is gone. Free runs are swept in blocks by the thread pool for headers
+  // at cluster starts (first clusters of deleted entries found by readDeletedEntries excepted, they are
+  // recovered from their entry), each file's end is then found from its format.
+  // Files found inside an earlier carved file are dropped. Each file is written to outputDir as
+  // "carved_<first cluster>.<extension>", returns them in cluster order, those that failed to be written included.
+  std::vector<CarvedFile> carveFreeClusters(const std::string_view outputDir, const std::vector<FileCarver::Type> &types = {});
 };
@@ -0,0 +1,159 @@
+#include "FatIndex.h"
+#include <bit>
+#if defined(__SSE2__)
+#include <emmintrin.h>
+#endif
+
+namespace
+{
+  // Bit i set when FAT entry i of the 64 at entries is free (zero, ignoring the reserved upper 4 bits).
+  uint64_t freeMask64(const uint32_t *entries)
+  {
+    uint64_t mask{0};
+#if defined(__SSE2__)
+    const __m128i valueBits{_mm_set1_epi32(0x0FFFFFFF)};
+    const __m128i zero{_mm_setzero_si128()};
+    for (unsigned i{0}; i < 64; i += 4)
+    {
+      __m128i values{_mm_and_si128(_mm_loadu_si128(reinterpret_cast<const __m128i *>(entries + i)), valueBits)};
+      uint64_t free{static_cast<uint64_t>(_mm_movemask_ps(_mm_castsi128_ps(_mm_cmpeq_epi32(values, zero))))};
+      mask |= free << i;
+    }
+#else
+    for (unsigned i{0}; i < 64; ++i)
+      if ((entries[i] & 0x0FFFFFFF) == 0)
+        mask |= uint64_t{1} << i;
+#endif
+    return mask;
+  }
+}
+
+void FatIndex::build(const FatTable &fatTable, const uint32_t clusterCount)
+{
+  constexpr std::size_t chunkEntries{64 * 1024}; // Multiple of 64, so chunks fill whole bitmap words.
+
+  endCluster = static_cast<uint32_t>(std::min<uint64_t>(static_cast<uint64_t>(clusterCount) + 2, fatTable.size()));
+  freeBitmap.assign((static_cast<std::size_t>(endCluster) + 63) / 64, 0);
+
+  // Whole words first, then the tail entry by entry.
+  std::vector<uint32_t> chunk(chunkEntries);
+  std::size_t fullWords{endCluster / 64};
+  for (std::size_t first{0}; first < fullWords * 64; first += chunkEntries)
+  {
+    std::size_t count{std::min(chunkEntries, fullWords * 64 - first)};
+    fatTable.copyEntries(static_cast<uint32_t>(first), std::span<uint32_t>{chunk.data(), count});
+    for (std::size_t word{0}; word < count / 64; ++word)
+      freeBitmap[first / 64 + word] = freeMask64(chunk.data() + word * 64);
+  }
+  for (uint32_t cluster{static_cast<uint32_t>(fullWords * 64)}; cluster < endCluster; ++cluster)
+    if ((fatTable[cluster] & 0x0FFFFFFF) == 0)
+      freeBitmap[cluster / 64] |= uint64_t{1} << (cluster % 64);
+
+  buildRuns();
+}
+
+void FatIndex::assign(std::span<const uint64_t> bitmap, const uint32_t end)
+{
+  if (bitmap.size() != (static_cast<std::size_t>(end) + 63) / 64)
+    throw std::runtime_error{"Free bitmap does not match cluster count"};
+
+  endCluster = end;
+  freeBitmap.assign(bitmap.begin(), bitmap.end());
+
+  // Bits past endCluster in the last word are not clusters.
+  if (endCluster % 64 != 0)
+    freeBitmap.back() &= (uint64_t{1} << (endCluster % 64)) - 1;
+  buildRuns();
+}
+
+void FatIndex::buildRuns()
+{
+  freeRuns.clear();
+  freeBefore.clear();
+  freeClusterCount = 0;
+
+  // Entries #0 and #1 are reserved, never data clusters.
+  if (!freeBitmap.empty())
+    freeBitmap[0] &= ~uint64_t{3};
+
+  // Walk the bitmap run by run, skipping whole words of allocated or free clusters at once.
+  uint32_t cluster{nextFree(2)};
+  while (cluster != 0)
+  {
+    ClusterExtent run{cluster, 0};
+    std::size_t word{cluster / 64};
+    uint64_t bits{freeBitmap[word] >> (cluster % 64)};
+    uint32_t length{static_cast<uint32_t>(std::countr_one(bits))};
+
+    // A run reaching the end of its word may carry on into the next ones.
+    while (cluster % 64 + length == 64 && ++word < freeBitmap.size())
+    {
+      run.clusterCount += length;
+      cluster = static_cast<uint32_t>(word * 64);
+      length = static_cast<uint32_t>(std::countr_one(freeBitmap[word]));
+    }
+    run.clusterCount += length;
+    run.clusterCount = std::min(run.clusterCount, endCluster - run.firstCluster);
+
+    freeRuns.push_back(run);
+    freeBefore.push_back(freeClusterCount);
+    freeClusterCount += run.clusterCount;
+    cluster = run.firstCluster + run.clusterCount < endCluster ? nextFree(run.firstCluster + run.clusterCount) : 0;
+  }
+}
+
+bool FatIndex::isFree(const uint32_t cluster) const
+{
+  if (cluster < 2 || cluster >= endCluster)
+    return false;
+  return (freeBitmap[cluster / 64] >> (cluster % 64)) & 1;
+}
+
+uint32_t FatIndex::nextFree(const uint32_t cluster) const
+{
+  if (cluster >= endCluster)
+    return 0;
+
+  std::size_t word{cluster / 64};
+  uint64_t bits{freeBitmap[word] & (~uint64_t{0} << (cluster % 64))};
+  while (bits == 0)
+  {
+    if (++word >= freeBitmap.size())
+      return 0;
+    bits = freeBitmap[word];
+  }
+
+  uint32_t found{static_cast<uint32_t>(word * 64 + std::countr_zero(bits))};
+  return found < endCluster ? found : 0;
+}
+
+ClusterExtent FatIndex::freeRunAt(const uint32_t cluster) const
+{
+  if (!isFree(cluster))
+    return {};
+
+  // Last run starting at or before cluster, which has to contain it since cluster is free.
+  auto run{std::upper_bound(freeRuns.begin(), freeRuns.end(), cluster, [](const uint32_t value, const ClusterExtent &extent)
+                            { return value < extent.firstCluster; })};
+  --run;
+  return {cluster, run->firstCluster + run->clusterCount - cluster};
+}
+
+uint32_t FatIndex::countFreeBelow(const uint32_t cluster) const
+{
+  // Last run starting before cluster, runs before it are wholly below cluster.
+  auto run{std::lower_bound(freeRuns.begin(), freeRuns.end(), cluster, [](const ClusterExtent &extent, const uint32_t value)
+                            { return extent.firstCluster < value; })};
+  if (run == freeRuns.begin())
+    return 0;
+  --run;
+  return freeBefore[static_cast<std::size_t>(run - freeRuns.begin())] + std::min(run->clusterCount, cluster - run->firstCluster);
+}
+
+uint32_t FatIndex::countFree(const uint32_t first, const uint32_t count) const
+{
+  if (first >= endCluster)
+    return 0;
+  uint32_t last{static_cast<uint32_t>(std::min<uint64_t>(static_cast<uint64_t>(first) + count, endCluster))};
+  return countFreeBelow(last) - countFreeBelow(first);
+}
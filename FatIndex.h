@@ -0,0 +1,53 @@
+#pragma once
+#include "Fat32.h"
+#include "FatTable.h"
+
+// Compact index over a FAT table: one bit per cluster telling whether it's free,
+// plus the list of free runs (consecutive free clusters) in cluster order.
+// Takes 1/32 of the memory of FAT table itself, built in one (SSE2 when available) pass over it,
+// streamed in chunks so a lazily paged FAT table is never held whole in memory.
+class FatIndex
+{
+private:
+  std::vector<uint64_t> freeBitmap{};       // Cluster #n is bit n, set when free.
+  std::vector<ClusterExtent> freeRuns{};    // Sorted by firstCluster, never adjacent to each other.
+  std::vector<uint32_t> freeBefore{};       // Free clusters in the runs before run #i.
+  uint32_t endCluster{};                    // One past the last data cluster.
+  uint32_t freeClusterCount{};
+
+  // Private method rebuilding freeRuns, freeBefore and freeClusterCount from freeBitmap.
+  void buildRuns();
+
+  // Private method counting the free clusters below cluster.
+  uint32_t countFreeBelow(const uint32_t cluster) const;
+
+public:
+  // Default constructor, an empty index where every cluster is allocated.
+  FatIndex() = default;
+
+  // Public method (re)building the index from FAT table, for data clusters #2 to #clusterCount + 1.
+  void build(const FatTable &fatTable, const uint32_t clusterCount);
+
+  // Public method (re)building the index from a saved free bitmap (see getFreeBitmap) covering clusters up to endCluster.
+  void assign(std::span<const uint64_t> bitmap, const uint32_t end);
+
+  // Public method checking whether a cluster is free, clusters outside the data region never are.
+  bool isFree(const uint32_t cluster) const;
+
+  // Public method returning the first free cluster at or after cluster, 0 if there is none.
+  uint32_t nextFree(const uint32_t cluster) const;
+
+  // Public method returning the free run containing cluster, starting at cluster itself,
+  // an empty extent if cluster is allocated.
+  ClusterExtent freeRunAt(const uint32_t cluster) const;
+
+  // Public method counting the free clusters among count clusters from first, in O(log runs):
+  // free runs and the allocated runs between them (every live chain) are an interval index of the volume.
+  uint32_t countFree(const uint32_t first, const uint32_t count) const;
+
+  // Public getters.
+  const std::vector<ClusterExtent> &getFreeRuns() const { return freeRuns; }
+  uint32_t getFreeClusterCount() const { return freeClusterCount; }
+  const std::vector<uint64_t> &getFreeBitmap() const { return freeBitmap; }
+  uint32_t getEndCluster() const { return endCluster; }
+};
@@ -0,0 +1,111 @@
+#include "FatTable.h"
+#include <algorithm>
+#include <cstring>
+
+void FatTable::open(BlockSource &blockSource, const uint64_t offset, const uint64_t byteSize, const Mode accessMode, const std::size_t cacheBudget)
+{
+  try
+  {
+    std::lock_guard lock{cacheMutex};
+
+    source = &blockSource;
+    byteOffset = offset;
+    entryCount = static_cast<uint32_t>(std::min<uint64_t>(byteSize / sizeof(uint32_t), UINT32_MAX));
+    mode = accessMode;
+    pageBudget = std::max<std::size_t>(1, cacheBudget / pageSize);
+    entries.clear();
+    entries.shrink_to_fit();
+    mapped = nullptr;
+    lru.clear();
+    pages.clear();
+    pageFaults = 0;
+
+    if (mode == Mode::Eager)
+    {
+      entries.resize(entryCount);
+      source->read(byteOffset, std::span<uint8_t>{reinterpret_cast<uint8_t *>(entries.data()), entries.size() * sizeof(uint32_t)});
+    }
+    else if (source->supportsViews())
+    {
+      // FAT starts on a sector boundary, so the mapped entries are properly aligned.
+      mapped = reinterpret_cast<const uint32_t *>(source->view(byteOffset, static_cast<std::size_t>(entryCount) * sizeof(uint32_t)).data());
+    }
+  }
+  catch (const std::runtime_error &)
+  {
+    throw;
+  }
+  catch (...)
+  {
+    throw std::runtime_error{"Error reading fat table"};
+  }
+}
+
+uint32_t FatTable::operator[](const uint32_t cluster) const
+{
+  if (cluster >= entryCount)
+    throw std::runtime_error{"Cluster out of range of fat table"};
+
+  if (mode == Mode::Eager)
+    return entries[cluster];
+  if (mapped != nullptr)
+    return mapped[cluster];
+
+  uint32_t pageIndex{static_cast<uint32_t>(cluster / entriesPerPage)};
+  {
+    std::lock_guard lock{cacheMutex};
+    auto page{pages.find(pageIndex)};
+    if (page != pages.end())
+    {
+      lru.splice(lru.begin(), lru, page->second.lruPosition);
+      return page->second.entries[cluster % entriesPerPage];
+    }
+  }
+
+  // Read the page without the lock, so other threads' lookups do not wait behind the device
+  // (the last page of the table may be short).
+  uint32_t firstEntry{static_cast<uint32_t>(pageIndex * entriesPerPage)};
+  std::size_t count{std::min<std::size_t>(entriesPerPage, entryCount - firstEntry)};
+  CachedPage cachedPage{std::vector<uint32_t>(count), {}};
+  source->read(byteOffset + static_cast<uint64_t>(firstEntry) * sizeof(uint32_t), std::span<uint8_t>{reinterpret_cast<uint8_t *>(cachedPage.entries.data()), count * sizeof(uint32_t)});
+  uint32_t value{cachedPage.entries[cluster % entriesPerPage]};
+
+  // Another thread may have loaded the same page meanwhile, its copy is kept.
+  std::lock_guard lock{cacheMutex};
+  auto page{pages.find(pageIndex)};
+  if (page != pages.end())
+  {
+    lru.splice(lru.begin(), lru, page->second.lruPosition);
+    return value;
+  }
+
+  if (pages.size() >= pageBudget)
+  {
+    pages.erase(lru.back());
+    lru.pop_back();
+  }
+  ++pageFaults;
+  lru.push_front(pageIndex);
+  cachedPage.lruPosition = lru.begin();
+  pages.emplace(pageIndex, std::move(cachedPage));
+  return value;
+}
+
+void FatTable::copyEntries(const uint32_t first, std::span<uint32_t> out) const
+{
+  if (first > entryCount || out.size() > entryCount - first)
+    throw std::runtime_error{"Cluster out of range of fat table"};
+
+  if (mode == Mode::Eager)
+    std::copy_n(entries.begin() + first, out.size(), out.begin());
+  else if (mapped != nullptr)
+    std::memcpy(out.data(), mapped + first, out.size() * sizeof(uint32_t));
+  else
+    source->read(byteOffset + static_cast<uint64_t>(first) * sizeof(uint32_t), std::span<uint8_t>{reinterpret_cast<uint8_t *>(out.data()), out.size() * sizeof(uint32_t)});
+}
+
+uint64_t FatTable::getPageFaults() const
+{
+  std::lock_guard lock{cacheMutex};
+  return pageFaults;
+}
@@ -0,0 +1,72 @@
+#pragma once
+#include "BlockSource.h"
+#include <cstdint>
+#include <list>
+#include <mutex>
+#include <unordered_map>
+#include <vector>
+
+// Read-only access to a FAT table on a block source, either loaded whole up front (eager)
+// or faulted in page by page as clusters are looked up (lazy).
+// Lazy access on a memory-mapped source reads the mapping directly, other sources keep
+// recently used pages in an LRU cache bounded by a byte budget.
+// Lookups are safe to call from multiple threads.
+class FatTable
+{
+public:
+  enum class Mode
+  {
+    Eager,
+    Lazy,
+  };
+
+  // Size of a cached page and default cache budget of lazy mode.
+  static constexpr std::size_t pageSize{4096};
+  static constexpr std::size_t entriesPerPage{pageSize / sizeof(uint32_t)};
+  static constexpr std::size_t defaultCacheBudget{64 << 20};
+
+private:
+  BlockSource *source{nullptr};
+  uint64_t byteOffset{};
+  uint32_t entryCount{};
+  Mode mode{Mode::Lazy};
+  std::size_t pageBudget{}; // Maximum number of cached pages.
+
+  std::vector<uint32_t> entries{};     // Whole table, eager mode only.
+  const uint32_t *mapped{nullptr};     // Table inside the mapping, lazy mode on memory-mapped sources only.
+
+  // LRU page cache, lazy mode on other sources only. Most recently used page at the front of lru.
+  struct CachedPage
+  {
+    std::vector<uint32_t> entries{};
+    std::list<uint32_t>::iterator lruPosition{};
+  };
+  mutable std::mutex cacheMutex{};
+  mutable std::list<uint32_t> lru{};
+  mutable std::unordered_map<uint32_t, CachedPage> pages{};
+  mutable uint64_t pageFaults{};
+
+public:
+  // Default constructor, an empty table.
+  FatTable() = default;
+
+  // Disabled copy and move semantics.
+  FatTable(const FatTable &) = delete;
+  FatTable &operator=(const FatTable &) = delete;
+
+  // Public method attaching the table to byteSize bytes of source starting at offset.
+  // Eager mode reads the whole table now, lazy mode reads nothing yet.
+  void open(BlockSource &blockSource, const uint64_t offset, const uint64_t byteSize, const Mode accessMode, const std::size_t cacheBudget = defaultCacheBudget);
+
+  // Public method returning FAT entry of a cluster as stored (including reserved upper 4 bits).
+  uint32_t operator[](const uint32_t cluster) const;
+
+  // Public method copying entries [first, first + out.size()) into out, for whole-table passes.
+  // Bypasses the page cache so such passes do not evict pages of chains being walked.
+  void copyEntries(const uint32_t first, std::span<uint32_t> out) const;
+
+  // Public getters.
+  std::size_t size() const { return entryCount; }
+  Mode getMode() const { return mode; }
+  uint64_t getPageFaults() const; // Pages read into the cache so far (lazy mode on non-mapped sources).
+};
@@ -0,0 +1,386 @@
+#include "FileCarver.h"
+#include <array>
+#include <bit>
+#include <cctype>
+#if defined(__SSE2__)
+#include <emmintrin.h>
+#endif
+
+namespace
+{
+  // Most bytes read at once while searching a stream.
+  constexpr std::size_t searchBlockSize{1 << 20};
+
+  // Signature bytes at an offset of a cluster's start, as a value and a mask over the first headerSize bytes.
+  struct Signature
+  {
+    FileCarver::Type type{};
+    std::array<uint8_t, FileCarver::headerSize> value{};
+    std::array<uint8_t, FileCarver::headerSize> mask{};
+  };
+
+  constexpr Signature makeSignature(const FileCarver::Type type, const std::size_t offset, const std::string_view bytes)
+  {
+    Signature signature{type, {}, {}};
+    for (std::size_t i{0}; i < bytes.size(); ++i)
+    {
+      signature.value[offset + i] = static_cast<uint8_t>(bytes[i]);
+      signature.mask[offset + i] = 0xFF;
+    }
+    return signature;
+  }
+
+  // QuickTime movies may start with other atoms than "ftyp".
+  constexpr std::array<Signature, 7> signatures{
+      makeSignature(FileCarver::Type::Jpeg, 0, "\xFF\xD8\xFF"),
+      makeSignature(FileCarver::Type::Png, 0, "\x89PNG\r\n\x1A\n"),
+      makeSignature(FileCarver::Type::Mp4, 4, "ftyp"),
+      makeSignature(FileCarver::Type::Mp4, 4, "moov"),
+      makeSignature(FileCarver::Type::Mp4, 4, "wide"),
+      makeSignature(FileCarver::Type::Pdf, 0, "%PDF-"),
+      makeSignature(FileCarver::Type::Zip, 0, "PK\x03\x04"),
+  };
+
+  uint16_t readBigEndian16(const uint8_t *bytes)
+  {
+    return static_cast<uint16_t>((bytes[0] << 8) | bytes[1]);
+  }
+
+  uint32_t readBigEndian32(const uint8_t *bytes)
+  {
+    return (static_cast<uint32_t>(bytes[0]) << 24) | (static_cast<uint32_t>(bytes[1]) << 16) | (static_cast<uint32_t>(bytes[2]) << 8) | bytes[3];
+  }
+
+  uint32_t readLittleEndian32(const uint8_t *bytes)
+  {
+    return bytes[0] | (static_cast<uint32_t>(bytes[1]) << 8) | (static_cast<uint32_t>(bytes[2]) << 16) | (static_cast<uint32_t>(bytes[3]) << 24);
+  }
+
+  // Offset of the first match of pattern in data at or after from, npos if none.
+  // Candidates are the positions where pattern's first two bytes match, found 16 at a time.
+  std::size_t findPattern(std::span<const uint8_t> data, const std::string_view pattern, std::size_t from)
+  {
+    if (pattern.empty() || data.size() < pattern.size())
+      return std::string_view::npos;
+    const std::size_t last{data.size() - pattern.size()}; // Last position a match can start at.
+    auto matchesAt{[&](const std::size_t position)
+                   { return std::memcmp(data.data() + position, pattern.data(), pattern.size()) == 0; }};
+
+#if defined(__SSE2__)
+    const __m128i first{_mm_set1_epi8(pattern[0])};
+    const __m128i second{_mm_set1_epi8(pattern.size() > 1 ? pattern[1] : 0)};
+    while (from + 16 + (pattern.size() > 1) <= data.size())
+    {
+      __m128i candidates{_mm_cmpeq_epi8(_mm_loadu_si128(reinterpret_cast<const __m128i *>(data.data() + from)), first)};
+      if (pattern.size() > 1)
+        candidates = _mm_and_si128(candidates, _mm_cmpeq_epi8(_mm_loadu_si128(reinterpret_cast<const __m128i *>(data.data() + from + 1)), second));
+      for (unsigned bits{static_cast<unsigned>(_mm_movemask_epi8(candidates))}; bits != 0; bits &= bits - 1)
+      {
+        std::size_t position{from + static_cast<std::size_t>(std::countr_zero(bits))};
+        if (position <= last && matchesAt(position))
+          return position;
+      }
+      from += 16;
+    }
+#endif
+    for (; from <= last; ++from)
+      if (data[from] == static_cast<uint8_t>(pattern[0]) && matchesAt(from))
+        return from;
+    return std::string_view::npos;
+  }
+
+  // Top-level atoms of MP4 and QuickTime files, a carved movie ends at the first atom not among them.
+  bool isTopLevelAtom(std::span<const uint8_t> type)
+  {
+    static constexpr std::array<std::string_view, 15> atoms{"ftyp", "moov", "mdat", "free", "skip", "wide", "uuid", "meta",
+                                                            "pdin", "moof", "mfra", "styp", "sidx", "pnot", "prfl"};
+    std::string_view name{reinterpret_cast<const char *>(type.data()), 4};
+    return std::find(atoms.begin(), atoms.end(), name) != atoms.end();
+  }
+}
+
+FileCarver::FileCarver(Fat32Device &fat32Device, std::vector<ClusterExtent> clusterExtents) : device{fat32Device}, extents{std::move(clusterExtents)}
+{
+  extentOffsets.reserve(extents.size() + 1);
+  extentOffsets.push_back(0);
+  for (const auto &extent : extents)
+    extentOffsets.push_back(extentOffsets.back() + static_cast<uint64_t>(extent.clusterCount) * device.getBytesPerCluster());
+}
+
+std::optional<FileCarver::Type> FileCarver::matchHeader(std::span<const uint8_t> clusterStart)
+{
+  if (clusterStart.size() < headerSize)
+    return std::nullopt;
+
+#if defined(__SSE2__)
+  const __m128i data{_mm_loadu_si128(reinterpret_cast<const __m128i *>(clusterStart.data()))};
+  for (const auto &signature : signatures)
+  {
+    __m128i masked{_mm_and_si128(data, _mm_loadu_si128(reinterpret_cast<const __m128i *>(signature.mask.data())))};
+    if (_mm_movemask_epi8(_mm_cmpeq_epi8(masked, _mm_loadu_si128(reinterpret_cast<const __m128i *>(signature.value.data())))) == 0xFFFF)
+      return signature.type;
+  }
+#else
+  for (const auto &signature : signatures)
+  {
+    bool matches{true};
+    for (std::size_t i{0}; i < headerSize && matches; ++i)
+      matches = (clusterStart[i] & signature.mask[i]) == signature.value[i];
+    if (matches)
+      return signature.type;
+  }
+#endif
+  return std::nullopt;
+}
+
+std::span<const uint8_t> FileCarver::read(const uint64_t offset, const std::size_t length)
+{
+  if (offset >= extentOffsets.back())
+    return {};
+  std::size_t size{static_cast<std::size_t>(std::min<uint64_t>(length, extentOffsets.back() - offset))};
+
+  uint32_t bytesPerCluster{device.getBytesPerCluster()};
+  std::size_t extent{static_cast<std::size_t>(std::upper_bound(extentOffsets.begin(), extentOffsets.end(), offset) - extentOffsets.begin() - 1)};
+  std::size_t skip{static_cast<std::size_t>(offset % bytesPerCluster)}; // Extents start at cluster boundaries of the stream.
+  uint32_t firstCluster{extents[extent].firstCluster + static_cast<uint32_t>((offset - extentOffsets[extent]) / bytesPerCluster)};
+  uint64_t clusterCount{(skip + size + bytesPerCluster - 1) / bytesPerCluster};
+
+  // Within one extent, the clusters can be viewed in place.
+  if (offset + size <= extentOffsets[extent + 1])
+    return device.viewClusters(firstCluster, static_cast<uint32_t>(clusterCount), scratch).subspan(skip, size);
+
+  std::vector<ClusterExtent> parts{};
+  for (uint32_t cluster{firstCluster}; clusterCount > 0; ++extent)
+  {
+    uint32_t count{static_cast<uint32_t>(std::min<uint64_t>(clusterCount, extents[extent].firstCluster + extents[extent].clusterCount - cluster))};
+    parts.push_back({cluster, count});
+    clusterCount -= count;
+    if (extent + 1 < extents.size())
+      cluster = extents[extent + 1].firstCluster;
+  }
+  return device.readExtents(parts, scratch).subspan(skip, size);
+}
+
+uint64_t FileCarver::findForward(const std::string_view pattern, uint64_t from, const uint64_t limit)
+{
+  // Consecutive blocks overlap by pattern.size() - 1 bytes, so matches across them are found.
+  while (from < limit)
+  {
+    std::span<const uint8_t> data{read(from, static_cast<std::size_t>(std::min<uint64_t>(searchBlockSize, limit - from + pattern.size() - 1)))};
+    if (data.size() < pattern.size())
+      return 0;
+    std::size_t position{findPattern(data, pattern, 0)};
+    if (position != std::string_view::npos)
+      return from + position < limit ? from + position : 0;
+    from += data.size() - pattern.size() + 1;
+  }
+  return 0;
+}
+
+uint64_t FileCarver::findJpegEnd(const uint64_t limit)
+{
+  // Segments are walked by their length, thumbnails inside them are skipped along.
+  uint64_t position{2};
+  while (position < limit)
+  {
+    std::span<const uint8_t> bytes{read(position, 4)};
+    if (bytes.size() < 2 || bytes[0] != 0xFF)
+      return 0;
+
+    uint8_t marker{bytes[1]};
+    if (marker == 0xFF) // Fill byte.
+    {
+      ++position;
+      continue;
+    }
+    if (marker == 0xD9)
+      return position + 2 <= limit ? position + 2 : 0;
+    if (marker == 0xD8 || marker == 0x00)
+      return 0;
+    if (marker == 0x01 || (marker >= 0xD0 && marker <= 0xD7))
+    {
+      position += 2;
+      continue;
+    }
+
+    if (bytes.size() < 4 || readBigEndian16(bytes.data() + 2) < 2)
+      return 0;
+    position += 2 + readBigEndian16(bytes.data() + 2);
+    if (marker != 0xDA)
+      continue;
+
+    // Entropy-coded data follows a start of scan, up to the next 0xFF that is neither stuffed (0xFF00) nor a restart marker.
+    bool markerFound{false};
+    while (!markerFound && position < limit)
+    {
+      std::span<const uint8_t> data{read(position, static_cast<std::size_t>(std::min<uint64_t>(searchBlockSize, limit - position + 1)))};
+      if (data.size() < 2)
+        return 0;
+
+      std::size_t index{0};
+      while ((index = findPattern(data.first(data.size() - 1), "\xFF", index)) != std::string_view::npos)
+      {
+        uint8_t next{data[index + 1]};
+        if (next != 0x00 && next != 0xFF && (next < 0xD0 || next > 0xD7))
+        {
+          markerFound = true;
+          break;
+        }
+        ++index;
+      }
+      position += markerFound ? index : data.size() - 1;
+    }
+  }
+  return 0;
+}
+
+uint64_t FileCarver::findPngEnd(const uint64_t limit)
+{
+  // Chunks are length, type, data and CRC, the first one IHDR and the last one IEND.
+  uint64_t position{8};
+  while (position < limit)
+  {
+    std::span<const uint8_t> bytes{read(position, 8)};
+    if (bytes.size() < 8)
+      return 0;
+
+    uint32_t length{readBigEndian32(bytes.data())};
+    std::string_view type{reinterpret_cast<const char *>(bytes.data()) + 4, 4};
+    if (length > 0x7FFFFFFF || !std::all_of(type.begin(), type.end(), [](const char character)
+                                            { return std::isalpha(static_cast<unsigned char>(character)) != 0; }))
+      return 0;
+    if (position == 8 && type != "IHDR")
+      return 0;
+
+    position += 12 + static_cast<uint64_t>(length);
+    if (type == "IEND")
+      return position <= limit ? position : 0;
+  }
+  return 0;
+}
+
+uint64_t FileCarver::findMp4End(const uint64_t limit)
+{
+  // Atoms are size (64-bit when it's 1) and type, a movie needs its metadata (moov) and its media (mdat).
+  uint64_t position{0};
+  bool hasMovie{false};
+  bool hasMedia{false};
+  while (position < limit)
+  {
+    std::span<const uint8_t> bytes{read(position, 16)};
+    if (bytes.size() < 8 || !isTopLevelAtom(bytes.subspan(4, 4)))
+      break;
+
+    uint64_t size{readBigEndian32(bytes.data())};
+    if (size == 1)
+    {
+      if (bytes.size() < 16)
+        break;
+      size = (static_cast<uint64_t>(readBigEndian32(bytes.data() + 8)) << 32) | readBigEndian32(bytes.data() + 12);
+    }
+    // Size 0 runs to the end of the file, which is unknown here.
+    if (size < 8 || size > limit - position)
+      return 0;
+
+    hasMovie = hasMovie || std::memcmp(bytes.data() + 4, "moov", 4) == 0;
+    hasMedia = hasMedia || std::memcmp(bytes.data() + 4, "mdat", 4) == 0;
+    position += size;
+  }
+  return hasMovie && hasMedia ? position : 0;
+}
+
+uint64_t FileCarver::findPdfEnd(const uint64_t limit)
+{
+  // Linearized and incrementally updated files have several %%EOF, more objects or an xref table follow each but the last.
+  uint64_t end{0};
+  for (uint64_t position{findForward("%%EOF", 5, limit)}; position != 0; position = findForward("%%EOF", end, limit))
+  {
+    end = position + 5;
+    std::span<const uint8_t> next{read(end, 64)};
+    std::size_t index{0};
+    while (index < next.size() && (next[index] == '\r' || next[index] == '\n'))
+      ++index;
+    end += std::min<std::size_t>(index, 2);
+    while (index < next.size() && std::isspace(next[index]))
+      ++index;
+
+    bool continues{index < next.size() && (std::isdigit(next[index]) || (next.size() - index >= 4 && std::memcmp(next.data() + index, "xref", 4) == 0))};
+    if (!continues)
+      break;
+  }
+  return end <= limit ? end : 0;
+}
+
+uint64_t FileCarver::findZipEnd(const uint64_t limit)
+{
+  // The end of central directory record says where its central directory is, which tells it from one of a nested archive.
+  for (uint64_t position{findForward("PK\x05\x06", 4, limit)}; position != 0; position = findForward("PK\x05\x06", position + 4, limit))
+  {
+    std::span<const uint8_t> record{read(position, 22)};
+    if (record.size() < 22)
+      return 0;
+
+    uint32_t directorySize{readLittleEndian32(record.data() + 12)};
+    uint32_t directoryOffset{readLittleEndian32(record.data() + 16)};
+    uint64_t end{position + 22 + (record[20] | (static_cast<uint32_t>(record[21]) << 8))};
+
+    // ZIP64 archives keep the real offset elsewhere, and a locator right before the record.
+    bool matches{static_cast<uint64_t>(directoryOffset) + directorySize == position};
+    if (directoryOffset == 0xFFFFFFFF && position >= 20)
+    {
+      std::span<const uint8_t> locator{read(position - 20, 4)};
+      matches = locator.size() == 4 && std::memcmp(locator.data(), "PK\x06\x07", 4) == 0;
+    }
+    if (matches && end <= limit)
+      return end;
+  }
+  return 0;
+}
+
+uint64_t FileCarver::findEnd(const Type type)
+{
+  uint64_t limit{std::min(getMaxSize(type), extentOffsets.back())};
+  switch (type)
+  {
+  case Type::Jpeg:
+    return findJpegEnd(limit);
+  case Type::Png:
+    return findPngEnd(limit);
+  case Type::Mp4:
+    return findMp4End(limit);
+  case Type::Pdf:
+    return findPdfEnd(limit);
+  case Type::Zip:
+    return findZipEnd(limit);
+  }
+  return 0;
+}
+
+uint64_t FileCarver::getMaxSize(const Type type)
+{
+  switch (type)
+  {
+  case Type::Jpeg:
+  case Type::Png:
+    return uint64_t{64} << 20;
+  case Type::Pdf:
+    return uint64_t{256} << 20;
+  case Type::Zip:
+    return uint64_t{1} << 30;
+  case Type::Mp4:
+    return UINT32_MAX; // Largest file FAT32 can hold.
+  }
+  return 0;
+}
+
+std::string_view FileCarver::getTypeName(const Type type)
+{
+  static constexpr std::array<std::string_view, typeCount> names{"jpeg", "png", "mp4", "pdf", "zip"};
+  return names[static_cast<std::size_t>(type)];
+}
+
+std::string_view FileCarver::getExtension(const Type type)
+{
+  static constexpr std::array<std::string_view, typeCount> extensions{"jpg", "png", "mp4", "pdf", "zip"};
+  return extensions[static_cast<std::size_t>(type)];
+}
@@ -0,0 +1,70 @@
+#pragma once
+#include "Fat32.h"
+#include <optional>
+
+// Carves files out of clusters by their content alone, for data whose directory entries are gone.
+// Files are assumed to start at a cluster boundary and to go on over the following free clusters,
+// the same guess reconstructClusterChain makes for a zeroed chain.
+// Headers are matched at cluster starts against every signature at once, SIMD when available;
+// the end of a file is then found by walking its format's structure (JPEG markers, PNG chunks, MP4/MOV atoms)
+// or searching for its footer (PDF %%EOF, ZIP end of central directory).
+class FileCarver
+{
+public:
+  enum class Type
+  {
+    Jpeg,
+    Png,
+    Mp4,
+    Pdf,
+    Zip,
+  };
+
+  static constexpr std::size_t typeCount{5};
+
+  // Bytes of a cluster's start matchHeader looks at, clusters are never smaller.
+  static constexpr std::size_t headerSize{16};
+
+private:
+  Fat32Device &device;
+  std::vector<ClusterExtent> extents{};  // Clusters the file may span, in order.
+  std::vector<uint64_t> extentOffsets{}; // Byte offset of extent #i in the stream, one past the end last.
+  std::vector<uint8_t> scratch{};        // Bytes of the last read, unless viewed in place.
+
+  // Private method returning up to length bytes of the stream from offset, fewer at its end.
+  // The span stays valid until the next read.
+  std::span<const uint8_t> read(const uint64_t offset, const std::size_t length);
+
+  // Private method returning the offset of the first match of pattern in the stream within [from, limit), 0 if none.
+  uint64_t findForward(const std::string_view pattern, uint64_t from, const uint64_t limit);
+
+  // Private methods returning a file's size given its format, 0 when no valid end is found below limit.
+  uint64_t findJpegEnd(const uint64_t limit);
+  uint64_t findPngEnd(const uint64_t limit);
+  uint64_t findMp4End(const uint64_t limit);
+  uint64_t findPdfEnd(const uint64_t limit);
+  uint64_t findZipEnd(const uint64_t limit);
+
+public:
+  // Take the device and the clusters a carved file may span (starting with the cluster its header is in).
+  FileCarver(Fat32Device &fat32Device, std::vector<ClusterExtent> clusterExtents);
+
+  // Disabled copy and move semantics.
+  FileCarver(const FileCarver &) = delete;
+  FileCarver &operator=(const FileCarver &) = delete;
+
+  // Destructor.
+  ~FileCarver() = default;
+
+  // Public method matching the first headerSize bytes of a cluster against every file signature.
+  static std::optional<Type> matchHeader(std::span<const uint8_t> clusterStart);
+
+  // Public method returning the size of the file of type starting the stream, 0 when it has no valid end.
+  uint64_t findEnd(const Type type);
+
+  // Public getters of each type's largest size carved (bounds the search for its end),
+  // name and file name extension.
+  static uint64_t getMaxSize(const Type type);
+  static std::string_view getTypeName(const Type type);
+  static std::string_view getExtension(const Type type);
+};
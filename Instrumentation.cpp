@@ -0,0 +1,235 @@
+#include "Instrumentation.h"
+#include <iomanip>
+#include <memory>
+#include <mutex>
+#include <vector>
+
+namespace
+{
+  struct TraceEvent
+  {
+    Instrumentation::Phase phase{};
+    int64_t startNanoseconds{}; // Since epoch.
+    int64_t durationNanoseconds{};
+  };
+
+  // One thread's counters and timers. Only the owning thread writes them (a relaxed load and store, no locked add),
+  // reports read them from another thread, hence the atomics. Records outlive their threads, so counts from
+  // finished thread pools still show up.
+  struct ThreadRecord
+  {
+    uint32_t index{};
+    std::array<std::atomic<uint64_t>, Instrumentation::counterCount> counters{};
+    std::array<std::atomic<uint64_t>, Instrumentation::phaseCount> phaseRuns{};
+    std::array<std::atomic<uint64_t>, Instrumentation::phaseCount> phaseNanoseconds{};
+    uint64_t lastReadEnd{}; // Owning thread only.
+    bool hasRead{false};
+    uint64_t sampledRuns{}; // Owning thread only.
+    std::mutex eventsMutex{};
+    std::vector<TraceEvent> events{};
+    uint64_t droppedEvents{};
+  };
+
+  const std::chrono::steady_clock::time_point epoch{std::chrono::steady_clock::now()};
+  std::atomic<int64_t> statsStart{0}; // Nanoseconds since epoch when counting last started.
+  std::atomic<bool> tracing{false};
+
+  std::mutex &registryMutex()
+  {
+    static std::mutex mutex{};
+    return mutex;
+  }
+
+  std::vector<std::unique_ptr<ThreadRecord>> &registry()
+  {
+    static std::vector<std::unique_ptr<ThreadRecord>> records{};
+    return records;
+  }
+
+  ThreadRecord &threadRecord()
+  {
+    thread_local ThreadRecord *record{nullptr};
+    if (record == nullptr)
+    {
+      std::lock_guard lock{registryMutex()};
+      registry().push_back(std::make_unique<ThreadRecord>());
+      record = registry().back().get();
+      record->index = static_cast<uint32_t>(registry().size() - 1);
+    }
+    return *record;
+  }
+
+  void bump(std::atomic<uint64_t> &value, const uint64_t amount)
+  {
+    value.store(value.load(std::memory_order_relaxed) + amount, std::memory_order_relaxed);
+  }
+
+  int64_t sinceEpoch(const std::chrono::steady_clock::time_point time)
+  {
+    return std::chrono::duration_cast<std::chrono::nanoseconds>(time - epoch).count();
+  }
+
+  // Counters then phases of one record (or of the totals) as JSON members, no braces.
+  void writeMembers(std::ostream &out, const std::array<uint64_t, Instrumentation::counterCount> &counters,
+                    const std::array<uint64_t, Instrumentation::phaseCount> &runs, const std::array<uint64_t, Instrumentation::phaseCount> &nanoseconds)
+  {
+    for (std::size_t counter{0}; counter < Instrumentation::counterCount; ++counter)
+      out << '"' << Instrumentation::getCounterName(static_cast<Instrumentation::Counter>(counter)) << "\":" << counters[counter] << ',';
+
+    out << "\"phases\":{";
+    for (std::size_t phase{0}; phase < Instrumentation::phaseCount; ++phase)
+      out << (phase == 0 ? "" : ",") << '"' << Instrumentation::getPhaseName(static_cast<Instrumentation::Phase>(phase))
+          << "\":{\"runs\":" << runs[phase] << ",\"micros\":" << nanoseconds[phase] / 1000 << '}';
+    out << '}';
+  }
+}
+
+const char *Instrumentation::getCounterName(const Counter counter)
+{
+  static constexpr std::array<const char *, counterCount> names{"bytesRead", "readCalls", "seeks", "cacheHits", "cacheMisses",
+                                                                "clustersDecoded", "namesDecoded", "bytesWritten", "writeCalls"};
+  return names[static_cast<std::size_t>(counter)];
+}
+
+const char *Instrumentation::getPhaseName(const Phase phase)
+{
+  static constexpr std::array<const char *, phaseCount> names{"bootSector", "fatTable", "directoryScan", "nameDecode",
+                                                              "clusterRead", "recovery", "outputWrite", "carve"};
+  return names[static_cast<std::size_t>(phase)];
+}
+
+void Instrumentation::add(const Counter counter, const uint64_t value)
+{
+  bump(threadRecord().counters[static_cast<std::size_t>(counter)], value);
+}
+
+void Instrumentation::noteRead(const uint64_t offset, const uint64_t length)
+{
+  ThreadRecord &record{threadRecord()};
+  bump(record.counters[static_cast<std::size_t>(Counter::BytesRead)], length);
+  bump(record.counters[static_cast<std::size_t>(Counter::ReadCalls)], 1);
+  if (record.hasRead && offset != record.lastReadEnd)
+    bump(record.counters[static_cast<std::size_t>(Counter::Seeks)], 1);
+  record.lastReadEnd = offset + length;
+  record.hasRead = true;
+}
+
+bool Instrumentation::takeSample()
+{
+  return ++threadRecord().sampledRuns % sampleInterval == 0; // Not the first run, usually a cold one.
+}
+
+void Instrumentation::addPhase(const Phase phase, const std::chrono::steady_clock::time_point start, const std::chrono::steady_clock::time_point end, const uint64_t runs)
+{
+  ThreadRecord &record{threadRecord()};
+  int64_t nanoseconds{std::chrono::duration_cast<std::chrono::nanoseconds>(end - start).count()};
+  bump(record.phaseRuns[static_cast<std::size_t>(phase)], runs);
+  bump(record.phaseNanoseconds[static_cast<std::size_t>(phase)], static_cast<uint64_t>(nanoseconds) * runs);
+
+  if (!tracing.load(std::memory_order_relaxed) || phase == Phase::NameDecode || phase == Phase::ClusterRead)
+    return;
+
+  std::lock_guard lock{record.eventsMutex};
+  if (record.events.size() < maxTraceEvents)
+    record.events.push_back({phase, sinceEpoch(start), nanoseconds});
+  else
+    ++record.droppedEvents;
+}
+
+void Instrumentation::setTracing(const bool enabled)
+{
+  tracing.store(enabled, std::memory_order_relaxed);
+}
+
+void Instrumentation::reset()
+{
+  std::lock_guard lock{registryMutex()};
+  for (const auto &record : registry())
+  {
+    for (auto &counter : record->counters)
+      counter.store(0, std::memory_order_relaxed);
+    for (auto &runs : record->phaseRuns)
+      runs.store(0, std::memory_order_relaxed);
+    for (auto &nanoseconds : record->phaseNanoseconds)
+      nanoseconds.store(0, std::memory_order_relaxed);
+    std::lock_guard eventsLock{record->eventsMutex};
+    record->events.clear();
+    record->droppedEvents = 0;
+  }
+  statsStart.store(sinceEpoch(std::chrono::steady_clock::now()), std::memory_order_relaxed);
+}
+
+void Instrumentation::writeStats(std::ostream &out)
+{
+  std::lock_guard lock{registryMutex()};
+
+  std::array<uint64_t, counterCount> totalCounters{};
+  std::array<uint64_t, phaseCount> totalRuns{};
+  std::array<uint64_t, phaseCount> totalNanoseconds{};
+  std::vector<std::array<uint64_t, counterCount>> counters(registry().size());
+  std::vector<std::array<uint64_t, phaseCount>> runs(registry().size());
+  std::vector<std::array<uint64_t, phaseCount>> nanoseconds(registry().size());
+  for (std::size_t index{0}; index < registry().size(); ++index)
+  {
+    const ThreadRecord &record{*registry()[index]};
+    for (std::size_t counter{0}; counter < counterCount; ++counter)
+      totalCounters[counter] += counters[index][counter] = record.counters[counter].load(std::memory_order_relaxed);
+    for (std::size_t phase{0}; phase < phaseCount; ++phase)
+    {
+      totalRuns[phase] += runs[index][phase] = record.phaseRuns[phase].load(std::memory_order_relaxed);
+      totalNanoseconds[phase] += nanoseconds[index][phase] = record.phaseNanoseconds[phase].load(std::memory_order_relaxed);
+    }
+  }
+
+  int64_t elapsed{sinceEpoch(std::chrono::steady_clock::now()) - statsStart.load(std::memory_order_relaxed)};
+  out << "{\"event\":\"stats\",\"instrumented\":" << (isCompiledIn() ? "true" : "false") << ",\"elapsedMicros\":" << elapsed / 1000 << ",\"totals\":{";
+  writeMembers(out, totalCounters, totalRuns, totalNanoseconds);
+  out << "},\"threads\":[";
+
+  // Threads that never counted nor timed anything (idle pool workers, ...) are left out.
+  bool first{true};
+  for (std::size_t index{0}; index < registry().size(); ++index)
+  {
+    bool used{false};
+    for (const auto value : counters[index])
+      used = used || value != 0;
+    for (const auto value : runs[index])
+      used = used || value != 0;
+    if (!used)
+      continue;
+
+    out << (first ? "" : ",") << "{\"thread\":" << index << ',';
+    writeMembers(out, counters[index], runs[index], nanoseconds[index]);
+    out << '}';
+    first = false;
+  }
+  out << "]}\n";
+}
+
+void Instrumentation::writeTrace(std::ostream &out)
+{
+  std::lock_guard lock{registryMutex()};
+
+  // Complete ("X") events with microsecond timestamps, one track per thread.
+  out << "{\"displayTimeUnit\":\"ms\",\"traceEvents\":[";
+  bool first{true};
+  uint64_t dropped{0};
+  std::ios::fmtflags flags{out.flags()};
+  out << std::fixed << std::setprecision(3);
+  for (const auto &record : registry())
+  {
+    std::lock_guard eventsLock{record->eventsMutex};
+    dropped += record->droppedEvents;
+    if (record->events.empty())
+      continue;
+
+    out << (first ? "" : ",") << "\n{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":1,\"tid\":" << record->index
+        << ",\"args\":{\"name\":\"thread " << record->index << "\"}}";
+    first = false;
+    for (const auto &event : record->events)
+      out << ",\n{\"name\":\"" << getPhaseName(event.phase) << "\",\"cat\":\"fat32r\",\"ph\":\"X\",\"pid\":1,\"tid\":" << record->index
+          << ",\"ts\":" << static_cast<double>(event.startNanoseconds) / 1000 << ",\"dur\":" << static_cast<double>(event.durationNanoseconds) / 1000 << '}';
+  }
+  out.flags(flags);
+  out << "\n],\"otherData\":{\"droppedEvents\":" << dropped << "}}\n";
+}
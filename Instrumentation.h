@@ -0,0 +1,149 @@
+#pragma once
+#include <array>
+#include <atomic>
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <ostream>
+
+// Hot-path instrumentation: counters (bytes read, read calls, seeks, cache hits, ...) and per-phase timers,
+// kept per thread so hot paths never share a cache line, summed up by writeStats (--stats)
+// and optionally recorded as Chrome trace events by writeTrace (--trace, open in chrome://tracing or Perfetto).
+// Hooks go through the FAT32R_COUNT, FAT32R_NOTE_READ, FAT32R_TIME_PHASE and FAT32R_SAMPLE_PHASE macros,
+// which compile to nothing unless built with FAT32R_INSTRUMENTATION (CMake option FAT32R_WITH_INSTRUMENTATION).
+class Instrumentation
+{
+public:
+  enum class Counter
+  {
+    BytesRead,
+    ReadCalls,
+    Seeks,           // Reads not starting where the same thread's previous read ended.
+    CacheHits,       // Cluster cache, see ClusterCache.
+    CacheMisses,
+    ClustersDecoded, // Directory clusters walked for entries.
+    NamesDecoded,
+    BytesWritten,
+    WriteCalls,
+  };
+  static constexpr std::size_t counterCount{9};
+
+  // Phases nest (cluster reads happen inside directory scans, ...), their times are inclusive.
+  enum class Phase
+  {
+    BootSector,
+    FatTable,
+    DirectoryScan,
+    NameDecode,  // Sampled (see SampledPhase) and not traced, one event per name would drown the trace.
+    ClusterRead, // Not traced either, one event per cluster.
+    Recovery,
+    OutputWrite,
+    Carve,
+  };
+  static constexpr std::size_t phaseCount{8};
+
+  // Times one run of a phase on the calling thread, from construction to destruction.
+  class ScopedPhase
+  {
+  private:
+    Phase phase{};
+    std::chrono::steady_clock::time_point start{};
+
+  public:
+    explicit ScopedPhase(const Phase timedPhase) : phase{timedPhase}, start{std::chrono::steady_clock::now()} {}
+
+    // Disabled copy and move semantics.
+    ScopedPhase(const ScopedPhase &) = delete;
+    ScopedPhase &operator=(const ScopedPhase &) = delete;
+
+    // Destructor, adds the time spent to the phase.
+    ~ScopedPhase() { addPhase(phase, start, std::chrono::steady_clock::now()); }
+  };
+
+  // Times one run in sampleInterval of a phase too short and frequent for reading the clock twice every run
+  // (tens of nanoseconds), the timed run standing for the sampleInterval runs around it.
+  class SampledPhase
+  {
+  private:
+    Phase phase{};
+    bool timed{false};
+    std::chrono::steady_clock::time_point start{};
+
+  public:
+    explicit SampledPhase(const Phase timedPhase) : phase{timedPhase}, timed{takeSample()}
+    {
+      if (timed)
+        start = std::chrono::steady_clock::now();
+    }
+
+    // Disabled copy and move semantics.
+    SampledPhase(const SampledPhase &) = delete;
+    SampledPhase &operator=(const SampledPhase &) = delete;
+
+    // Destructor, adds the time spent sampleInterval times to the phase when this run was timed,
+    // unless it took longer than sampleLimit: the thread was preempted, weighting that would swamp the estimate.
+    ~SampledPhase()
+    {
+      if (!timed)
+        return;
+      std::chrono::steady_clock::time_point end{std::chrono::steady_clock::now()};
+      if (end - start <= sampleLimit)
+        addPhase(phase, start, end, sampleInterval);
+    }
+  };
+  static constexpr uint64_t sampleInterval{64};
+  static constexpr std::chrono::microseconds sampleLimit{50};
+
+  // Public method telling whether the calling thread's next run of a sampled phase is timed.
+  static bool takeSample();
+
+  // Public method adding value to one of the calling thread's counters.
+  static void add(const Counter counter, const uint64_t value);
+
+  // Public method counting one read of length bytes at offset, and a seek when it does not follow the thread's previous one.
+  static void noteRead(const uint64_t offset, const uint64_t length);
+
+  // Public method adding runs of a phase (each lasting from start to end) to the calling thread's timers,
+  // and one event to the trace when tracing.
+  static void addPhase(const Phase phase, const std::chrono::steady_clock::time_point start, const std::chrono::steady_clock::time_point end, const uint64_t runs = 1);
+
+  // Public method turning trace event recording on or off, off by default.
+  // At most maxTraceEvents are kept per thread, later ones are only counted as dropped.
+  static void setTracing(const bool enabled);
+  static constexpr std::size_t maxTraceEvents{1 << 20};
+
+  // Public method zeroing every counter and timer and dropping trace events, for when no other thread is working.
+  static void reset();
+
+  // Public method writing the counters and phase timers as one JSON object on one line,
+  // totals first then each thread that counted anything.
+  static void writeStats(std::ostream &out);
+
+  // Public method writing the recorded trace events in Chrome's trace event format.
+  static void writeTrace(std::ostream &out);
+
+  // Public method telling whether the hooks were compiled in.
+  static constexpr bool isCompiledIn()
+  {
+#if defined(FAT32R_INSTRUMENTATION)
+    return true;
+#else
+    return false;
+#endif
+  }
+
+  static const char *getCounterName(const Counter counter);
+  static const char *getPhaseName(const Phase phase);
+};
+
+#if defined(FAT32R_INSTRUMENTATION)
+#define FAT32R_COUNT(counter, value) Instrumentation::add(Instrumentation::Counter::counter, (value))
+#define FAT32R_NOTE_READ(offset, length) Instrumentation::noteRead((offset), (length))
+#define FAT32R_TIME_PHASE(phase) Instrumentation::ScopedPhase fat32rPhaseTimer { Instrumentation::Phase::phase }
+#define FAT32R_SAMPLE_PHASE(phase) Instrumentation::SampledPhase fat32rPhaseTimer { Instrumentation::Phase::phase }
+#else
+#define FAT32R_COUNT(counter, value) ((void)0)
+#define FAT32R_NOTE_READ(offset, length) ((void)0)
+#define FAT32R_TIME_PHASE(phase) ((void)0)
+#define FAT32R_SAMPLE_PHASE(phase) ((void)0)
+#endif
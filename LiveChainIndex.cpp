@@ -0,0 +1,53 @@
+#include "LiveChainIndex.h"
+
+void LiveChainIndex::build(std::vector<ClusterExtent> extents)
+{
+  std::sort(extents.begin(), extents.end(), [](const ClusterExtent &left, const ClusterExtent &right)
+            { return left.firstCluster < right.firstCluster; });
+
+  // Merge extents overlapping or touching the previous run (cross-linked chains may share clusters).
+  runs.clear();
+  for (const auto &extent : extents)
+  {
+    if (extent.clusterCount == 0)
+      continue;
+    uint64_t end{static_cast<uint64_t>(extent.firstCluster) + extent.clusterCount};
+    if (!runs.empty() && extent.firstCluster <= static_cast<uint64_t>(runs.back().firstCluster) + runs.back().clusterCount)
+      runs.back().clusterCount = static_cast<uint32_t>(std::max<uint64_t>(static_cast<uint64_t>(runs.back().firstCluster) + runs.back().clusterCount, end) - runs.back().firstCluster);
+    else
+      runs.push_back(extent);
+  }
+
+  claimedBefore.clear();
+  uint32_t claimed{0};
+  for (const auto &run : runs)
+  {
+    claimedBefore.push_back(claimed);
+    claimed += run.clusterCount;
+  }
+}
+
+void LiveChainIndex::assign(std::span<const ClusterExtent> savedRuns)
+{
+  for (std::size_t i{1}; i < savedRuns.size(); ++i)
+    if (static_cast<uint64_t>(savedRuns[i - 1].firstCluster) + savedRuns[i - 1].clusterCount >= savedRuns[i].firstCluster)
+      throw std::runtime_error{"Live chain runs not sorted"};
+  build({savedRuns.begin(), savedRuns.end()});
+}
+
+uint32_t LiveChainIndex::countClaimedBelow(const uint32_t cluster) const
+{
+  // Last run starting before cluster, runs before it are wholly below cluster.
+  auto run{std::lower_bound(runs.begin(), runs.end(), cluster, [](const ClusterExtent &extent, const uint32_t value)
+                            { return extent.firstCluster < value; })};
+  if (run == runs.begin())
+    return 0;
+  --run;
+  return claimedBefore[static_cast<std::size_t>(run - runs.begin())] + std::min(run->clusterCount, cluster - run->firstCluster);
+}
+
+uint32_t LiveChainIndex::countClaimed(const uint32_t first, const uint32_t count) const
+{
+  uint32_t last{static_cast<uint32_t>(std::min<uint64_t>(static_cast<uint64_t>(first) + count, UINT32_MAX))};
+  return countClaimedBelow(last) - countClaimedBelow(first);
+}
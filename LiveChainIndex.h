@@ -0,0 +1,32 @@
+#pragma once
+#include "Fat32.h"
+
+// Interval index over the cluster chains of every live (not deleted) file and directory of a volume:
+// their extents sorted and merged into disjoint runs, with a running count of clusters before each run.
+// Tells how many clusters of any range are claimed by live entries in O(log runs), so every deleted entry
+// of a scan can be checked against all live chains at once instead of walking them per entry.
+class LiveChainIndex
+{
+private:
+  std::vector<ClusterExtent> runs{};      // Sorted by firstCluster, disjoint and never adjacent to each other.
+  std::vector<uint32_t> claimedBefore{};  // Clusters in the runs before run #i.
+
+  // Private method counting the claimed clusters below cluster.
+  uint32_t countClaimedBelow(const uint32_t cluster) const;
+
+public:
+  // Default constructor, an empty index where no cluster is claimed.
+  LiveChainIndex() = default;
+
+  // Public method (re)building the index from chain extents in any order, overlapping or not.
+  void build(std::vector<ClusterExtent> extents);
+
+  // Public method (re)building the index from saved runs (see getRuns), throws if they are not sorted and disjoint.
+  void assign(std::span<const ClusterExtent> savedRuns);
+
+  // Public method counting the claimed clusters among count clusters from first.
+  uint32_t countClaimed(const uint32_t first, const uint32_t count) const;
+
+  // Public getter.
+  const std::vector<ClusterExtent> &getRuns() const { return runs; }
+};
@@ -0,0 +1,408 @@
+#include "PartitionTable.h"
+#include "ThreadPool.h"
+#include <array>
+#include <map>
+#include <mutex>
+#include <set>
+
+namespace
+{
+  constexpr uint64_t mbrSectorSize{512};
+
+  uint16_t readLittleEndian16(const uint8_t *bytes)
+  {
+    return static_cast<uint16_t>(bytes[0] | bytes[1] << 8);
+  }
+
+  uint32_t readLittleEndian32(const uint8_t *bytes)
+  {
+    return static_cast<uint32_t>(bytes[0]) | static_cast<uint32_t>(bytes[1]) << 8 | static_cast<uint32_t>(bytes[2]) << 16 | static_cast<uint32_t>(bytes[3]) << 24;
+  }
+
+  uint64_t readLittleEndian64(const uint8_t *bytes)
+  {
+    return static_cast<uint64_t>(readLittleEndian32(bytes)) | static_cast<uint64_t>(readLittleEndian32(bytes + 4)) << 32;
+  }
+
+  // CRC-32 (IEEE, reflected) as GPT uses it over its header and partition entry array.
+  uint32_t crc32(std::span<const uint8_t> bytes)
+  {
+    static constexpr std::array<uint32_t, 256> crcTable{[]
+                                                        {
+                                                          std::array<uint32_t, 256> table{};
+                                                          for (uint32_t i{0}; i < 256; ++i)
+                                                          {
+                                                            uint32_t crc{i};
+                                                            for (int bit{0}; bit < 8; ++bit)
+                                                              crc = (crc & 1) != 0 ? 0xEDB88320 ^ (crc >> 1) : crc >> 1;
+                                                            table[i] = crc;
+                                                          }
+                                                          return table;
+                                                        }()};
+
+    uint32_t crc{0xFFFFFFFF};
+    for (const uint8_t byte : bytes)
+      crc = crcTable[(crc ^ byte) & 0xFF] ^ (crc >> 8);
+    return crc ^ 0xFFFFFFFF;
+  }
+
+  // GPT partition name (UTF-16LE, up to 36 units, NUL-terminated when shorter) to UTF-8.
+  std::string gptName(std::span<const uint8_t> bytes)
+  {
+    std::string name{};
+    for (std::size_t i{0}; i + 1 < bytes.size(); i += 2)
+    {
+      uint32_t unit{readLittleEndian16(bytes.data() + i)};
+      if (unit == 0)
+        break;
+      uint32_t codePoint{unit};
+      if (unit >= 0xD800 && unit <= 0xDBFF && i + 3 < bytes.size())
+      {
+        uint32_t low{readLittleEndian16(bytes.data() + i + 2)};
+        if (low >= 0xDC00 && low <= 0xDFFF)
+        {
+          codePoint = 0x10000 + ((unit - 0xD800) << 10) + (low - 0xDC00);
+          i += 2;
+        }
+      }
+      if (codePoint >= 0xD800 && codePoint <= 0xDFFF)
+        codePoint = 0xFFFD;
+
+      if (codePoint < 0x80)
+        name.push_back(static_cast<char>(codePoint));
+      else if (codePoint < 0x800)
+      {
+        name.push_back(static_cast<char>(0xC0 | codePoint >> 6));
+        name.push_back(static_cast<char>(0x80 | (codePoint & 0x3F)));
+      }
+      else if (codePoint < 0x10000)
+      {
+        name.push_back(static_cast<char>(0xE0 | codePoint >> 12));
+        name.push_back(static_cast<char>(0x80 | (codePoint >> 6 & 0x3F)));
+        name.push_back(static_cast<char>(0x80 | (codePoint & 0x3F)));
+      }
+      else
+      {
+        name.push_back(static_cast<char>(0xF0 | codePoint >> 18));
+        name.push_back(static_cast<char>(0x80 | (codePoint >> 12 & 0x3F)));
+        name.push_back(static_cast<char>(0x80 | (codePoint >> 6 & 0x3F)));
+        name.push_back(static_cast<char>(0x80 | (codePoint & 0x3F)));
+      }
+    }
+    return name;
+  }
+
+  // Volume label of a boot sector, when its extended boot signature says there is one.
+  std::string volumeLabel(const FAT32BootSector &bootSector)
+  {
+    if (bootSector.bootSignature != 0x29)
+      return {};
+
+    std::string label{reinterpret_cast<const char *>(bootSector.volumeLabel), sizeof(bootSector.volumeLabel)};
+    for (auto &character : label)
+      if (static_cast<unsigned char>(character) < 0x20 || static_cast<unsigned char>(character) >= 0x7F)
+        character = '_';
+    label.erase(label.find_last_not_of(' ') + 1);
+    return label;
+  }
+
+  // Boot sector at byteOffset on source, if it fits and is a FAT32 one.
+  bool readFat32BootSector(BlockSource &source, const uint64_t byteOffset, FAT32BootSector &bootSector)
+  {
+    if (byteOffset > source.size() || source.size() - byteOffset < mbrSectorSize)
+      return false;
+
+    std::array<uint8_t, mbrSectorSize> sector{};
+    source.read(byteOffset, sector);
+    bootSector = parseBootSector(sector);
+    return isFat32BootSector(bootSector);
+  }
+
+  // Whether a volume described by bootSector really starts at start: its first FAT entry holds the media descriptor.
+  bool fatMatches(BlockSource &source, const uint64_t start, const FAT32BootSector &bootSector)
+  {
+    uint64_t fatOffset{start + static_cast<uint64_t>(bootSector.reservedSectorCount) * bootSector.bytesPerSector};
+    if (fatOffset > source.size() || source.size() - fatOffset < sizeof(uint32_t))
+      return false;
+
+    std::array<uint8_t, sizeof(uint32_t)> entry{};
+    source.read(fatOffset, entry);
+    return (readLittleEndian32(entry.data()) & 0x0FFFFFFF) == (0x0FFFFF00u | bootSector.mediaDescriptor);
+  }
+}
+
+const char *PartitionTable::getSchemeName(const Scheme scheme)
+{
+  switch (scheme)
+  {
+  case Scheme::Mbr:
+    return "mbr";
+  case Scheme::Gpt:
+    return "gpt";
+  case Scheme::Probed:
+    return "probed";
+  case Scheme::None:
+  default:
+    return "none";
+  }
+}
+
+void PartitionTable::read(BlockSource &source, const std::size_t threadCount)
+{
+  try
+  {
+    partitions.clear();
+    if (source.size() < mbrSectorSize)
+      return;
+
+    // A volume starting right at byte #0 has no table, and its boot code would read as garbage partition entries.
+    std::array<uint8_t, mbrSectorSize> sector{};
+    source.read(0, sector);
+    if (isFat32BootSector(parseBootSector(sector)))
+      partitions.push_back({1, Scheme::None, 0, source.size()});
+    else if (!readGpt(source) && sector[510] == 0x55 && sector[511] == 0xAA)
+      readMbr(source, sector);
+
+    validate(source, threadCount);
+  }
+  catch (const std::runtime_error &)
+  {
+    throw;
+  }
+  catch (...)
+  {
+    throw std::runtime_error{"Error reading partition table"};
+  }
+}
+
+void PartitionTable::readMbr(BlockSource &source, std::span<const uint8_t> sector)
+{
+  // Boot status is 0x00 or 0x80 in every used entry of a real table, anything else is boot code or garbage.
+  for (std::size_t slot{0}; slot < 4; ++slot)
+  {
+    const uint8_t *entry{sector.data() + 446 + slot * 16};
+    if (entry[4] != 0 && entry[0] != 0x00 && entry[0] != 0x80)
+      return;
+  }
+
+  for (uint32_t slot{0}; slot < 4; ++slot)
+  {
+    const uint8_t *entry{sector.data() + 446 + slot * 16};
+    uint8_t type{entry[4]};
+    uint64_t byteOffset{readLittleEndian32(entry + 8) * mbrSectorSize};
+    uint64_t byteSize{readLittleEndian32(entry + 12) * mbrSectorSize};
+    // Empty entries, and GPT protective ones when GPT itself could not be read.
+    if (type == 0 || type == 0xEE || byteSize == 0 || byteOffset >= source.size())
+      continue;
+
+    byteSize = std::min(byteSize, source.size() - byteOffset);
+    if (type == 0x05 || type == 0x0F || type == 0x85)
+      readExtended(source, byteOffset, byteSize);
+    else
+      partitions.push_back({slot + 1, Scheme::Mbr, byteOffset, byteSize, type});
+  }
+}
+
+void PartitionTable::readExtended(BlockSource &source, const uint64_t extendedOffset, const uint64_t extendedSize)
+{
+  // Extended boot records form a chain: each one's first entry is a logical partition (relative to the record),
+  // its second entry the next record (relative to the extended partition). A damaged chain looping back stops.
+  std::set<uint64_t> visited{};
+  std::array<uint8_t, mbrSectorSize> sector{};
+  uint32_t number{5};
+  for (uint64_t recordOffset{extendedOffset}; visited.insert(recordOffset).second && recordOffset + mbrSectorSize <= source.size();)
+  {
+    source.read(recordOffset, sector);
+    if (sector[510] != 0x55 || sector[511] != 0xAA)
+      return;
+
+    const uint8_t *logical{sector.data() + 446};
+    uint64_t byteOffset{recordOffset + readLittleEndian32(logical + 8) * mbrSectorSize};
+    uint64_t byteSize{readLittleEndian32(logical + 12) * mbrSectorSize};
+    if (logical[4] != 0 && byteSize != 0 && byteOffset < source.size())
+      partitions.push_back({number++, Scheme::Mbr, byteOffset, std::min(byteSize, source.size() - byteOffset), logical[4]});
+
+    const uint8_t *next{sector.data() + 462};
+    uint64_t nextOffset{readLittleEndian32(next + 8) * mbrSectorSize};
+    if (next[4] == 0 || nextOffset == 0 || nextOffset >= extendedSize)
+      return;
+    recordOffset = extendedOffset + nextOffset;
+  }
+}
+
+bool PartitionTable::readGpt(BlockSource &source)
+{
+  // Header at LBA #1, or its backup at the last LBA, checked with its own CRC and its entry array's.
+  auto readHeader{[&](const uint64_t headerOffset, const uint64_t lbaSize)
+                  {
+                    if (headerOffset + lbaSize > source.size())
+                      return false;
+
+                    std::vector<uint8_t> header(lbaSize);
+                    source.read(headerOffset, header);
+                    uint32_t headerSize{readLittleEndian32(header.data() + 12)};
+                    if (std::memcmp(header.data(), "EFI PART", 8) != 0 || headerSize < 92 || headerSize > lbaSize)
+                      return false;
+
+                    uint32_t headerCrc{readLittleEndian32(header.data() + 16)};
+                    std::memset(header.data() + 16, 0, 4);
+                    if (crc32(std::span<const uint8_t>{header.data(), headerSize}) != headerCrc)
+                      return false;
+
+                    uint64_t entriesOffset{readLittleEndian64(header.data() + 72) * lbaSize};
+                    uint32_t entryCount{readLittleEndian32(header.data() + 80)};
+                    uint32_t entrySize{readLittleEndian32(header.data() + 84)};
+                    if (entrySize < 128 || entrySize % 8 != 0 || entryCount > 16384)
+                      return false;
+                    uint64_t entriesSize{static_cast<uint64_t>(entryCount) * entrySize};
+                    if (entriesOffset > source.size() || entriesSize > source.size() - entriesOffset)
+                      return false;
+
+                    std::vector<uint8_t> entries(entriesSize);
+                    source.read(entriesOffset, entries);
+                    if (crc32(entries) != readLittleEndian32(header.data() + 88))
+                      return false;
+
+                    static constexpr uint8_t unusedType[16]{};
+                    for (uint32_t index{0}; index < entryCount; ++index)
+                    {
+                      const uint8_t *entry{entries.data() + static_cast<std::size_t>(index) * entrySize};
+                      uint64_t firstLba{readLittleEndian64(entry + 32)};
+                      uint64_t lastLba{readLittleEndian64(entry + 40)};
+                      if (std::memcmp(entry, unusedType, sizeof(unusedType)) == 0 || lastLba < firstLba || firstLba * lbaSize >= source.size())
+                        continue;
+
+                      uint64_t byteOffset{firstLba * lbaSize};
+                      uint64_t byteSize{std::min((lastLba - firstLba + 1) * lbaSize, source.size() - byteOffset)};
+                      partitions.push_back({index + 1, Scheme::Gpt, byteOffset, byteSize, 0, gptName(std::span<const uint8_t>{entry + 56, 72})});
+                    }
+                    return true;
+                  }};
+
+  for (const uint64_t lbaSize : {512, 4096})
+  {
+    if (source.size() < 2 * lbaSize)
+      break;
+    if (readHeader(lbaSize, lbaSize) || readHeader(source.size() / lbaSize * lbaSize - lbaSize, lbaSize))
+      return true;
+  }
+  return false;
+}
+
+void PartitionTable::validate(BlockSource &source, const std::size_t threadCount)
+{
+  ThreadPool pool{threadCount};
+
+  // Each task only touches its own partition.
+  for (auto &partition : partitions)
+    pool.submit([&source, &partition]()
+                {
+                  FAT32BootSector bootSector{};
+                  if (readFat32BootSector(source, partition.byteOffset, bootSector))
+                    partition.bootSector = BootSector::Primary;
+                  else
+                  {
+                    for (const uint64_t sectorSize : {512, 4096})
+                      if (readFat32BootSector(source, partition.byteOffset + 6 * sectorSize, bootSector) && bootSector.bytesPerSector == sectorSize)
+                      {
+                        partition.bootSector = BootSector::Backup;
+                        break;
+                      }
+                  }
+                  if (partition.bootSector != BootSector::None)
+                    partition.volumeLabel = volumeLabel(bootSector);
+                });
+  pool.wait();
+}
+
+void PartitionTable::probe(BlockSource &source, const std::size_t threadCount)
+{
+  try
+  {
+    constexpr uint64_t chunkSize{8 << 20};
+    uint64_t deviceSize{source.size() / mbrSectorSize * mbrSectorSize};
+
+    // Every sector closing with the boot signature and opening with a jump instruction is parsed, FAT32 ones are kept.
+    std::mutex candidatesMutex{};
+    std::map<uint64_t, FAT32BootSector> candidates{};
+    {
+      ThreadPool pool{threadCount};
+      for (uint64_t chunkOffset{0}; chunkOffset < deviceSize; chunkOffset += chunkSize)
+        pool.submit([&, chunkOffset]()
+                    {
+                      std::size_t length{static_cast<std::size_t>(std::min(chunkSize, deviceSize - chunkOffset))};
+                      std::vector<uint8_t> scratch{};
+                      std::span<const uint8_t> chunk{source.view(chunkOffset, length)};
+                      if (chunk.empty())
+                      {
+                        scratch.resize(length);
+                        source.read(chunkOffset, scratch);
+                        chunk = scratch;
+                      }
+
+                      for (std::size_t position{0}; position < length; position += mbrSectorSize)
+                      {
+                        std::span<const uint8_t> sector{chunk.subspan(position, mbrSectorSize)};
+                        if (sector[510] != 0x55 || sector[511] != 0xAA || (sector[0] != 0xEB && sector[0] != 0xE9))
+                          continue;
+                        FAT32BootSector bootSector{parseBootSector(sector)};
+                        if (!isFat32BootSector(bootSector))
+                          continue;
+                        std::lock_guard lock{candidatesMutex};
+                        candidates.emplace(chunkOffset + position, bootSector);
+                      }
+                    });
+      pool.wait();
+    }
+
+    uint32_t number{0};
+    for (const auto &partition : partitions)
+      number = std::max(number, partition.number);
+
+    for (const auto &[offset, bootSector] : candidates)
+    {
+      // A backup copy whose boot sector was found as well adds nothing.
+      uint64_t backupDistance{bootSector.backupBootSector != 0 && bootSector.backupBootSector != 0xFFFF ? static_cast<uint64_t>(bootSector.backupBootSector) * bootSector.bytesPerSector : 0};
+      bool backupReachable{backupDistance != 0 && offset >= backupDistance};
+      if (backupReachable)
+      {
+        auto primary{candidates.find(offset - backupDistance)};
+        if (primary != candidates.end() && primary->second.volumeId == bootSector.volumeId)
+          continue;
+      }
+
+      // A lone copy is either a backup whose boot sector is gone, or a boot sector whose backup is.
+      // The backup reading comes first: taken as a boot sector, a backup puts the FAT a few sectors into the real one,
+      // where chains of end markers can look like a first FAT entry, while the reserved sectors ahead of a real boot sector are blank.
+      uint64_t start{};
+      BootSector kind{};
+      if (backupReachable && fatMatches(source, offset - backupDistance, bootSector))
+      {
+        start = offset - backupDistance;
+        kind = BootSector::Backup;
+      }
+      else if (fatMatches(source, offset, bootSector))
+      {
+        start = offset;
+        kind = BootSector::Primary;
+      }
+      else
+        continue;
+
+      if (std::any_of(partitions.begin(), partitions.end(), [start](const Partition &partition)
+                      { return partition.byteOffset == start; }))
+        continue;
+
+      uint64_t byteSize{std::min(static_cast<uint64_t>(bootSector.sectorTotal) * bootSector.bytesPerSector, source.size() - start)};
+      partitions.push_back({++number, Scheme::Probed, start, byteSize, 0, {}, kind, volumeLabel(bootSector)});
+    }
+  }
+  catch (const std::runtime_error &)
+  {
+    throw;
+  }
+  catch (...)
+  {
+    throw std::runtime_error{"Error probing for FAT32 volumes"};
+  }
+}
@@ -0,0 +1,81 @@
+#pragma once
+#include "Fat32.h"
+#include <string>
+
+// Partitions of a whole-disk device/image, read from its MBR (extended partitions included) or GPT,
+// each checked for a FAT32 boot sector (or its backup) so a Fat32Device can be opened at its offset.
+// When the table is damaged, probe() scans the device sector by sector for FAT32 boot sectors left behind.
+// Sectors are taken as 512 bytes for MBR, GPT is also looked for on 4096-byte sector disks.
+class PartitionTable
+{
+public:
+  // Where a partition was found.
+  enum class Scheme
+  {
+    None,   // No partition table, the whole device is one volume.
+    Mbr,
+    Gpt,
+    Probed, // Found by probe(), not listed by any table.
+  };
+
+  // Which FAT32 boot sector a partition has.
+  enum class BootSector
+  {
+    None,
+    Primary,
+    Backup, // The boot sector is damaged but its backup copy at sector #6 is good.
+  };
+
+  struct Partition
+  {
+    uint32_t number{};      // 1 to 4 for primary MBR partitions, 5 on for logical ones, GPT entry number, after all of those when probed.
+    Scheme scheme{};
+    uint64_t byteOffset{};
+    uint64_t byteSize{};
+    uint8_t type{};         // MBR partition type, 0 for others.
+    std::string name{};     // GPT partition name, UTF-8.
+    BootSector bootSector{BootSector::None};
+    std::string volumeLabel{}; // From the boot sector, trailing spaces removed.
+  };
+
+private:
+  std::vector<Partition> partitions{};
+
+  // Private methods reading each kind of table, used by read. readGpt returns false when no valid GPT header is found.
+  void readMbr(BlockSource &source, std::span<const uint8_t> sector);
+  void readExtended(BlockSource &source, const uint64_t extendedOffset, const uint64_t extendedSize);
+  bool readGpt(BlockSource &source);
+
+  // Private method checking every partition for a FAT32 boot sector, one task per partition.
+  void validate(BlockSource &source, const std::size_t threadCount);
+
+public:
+  // Default constructor.
+  PartitionTable() = default;
+
+  // Disabled copy and move semantics.
+  PartitionTable(const PartitionTable &) = delete;
+  PartitionTable &operator=(const PartitionTable &) = delete;
+
+  // Destructor.
+  ~PartitionTable() = default;
+
+  // Public method reading the partitions of source, GPT first (behind its protective MBR, backup header as fallback),
+  // MBR otherwise, and checking every one of them for a FAT32 boot sector on threadCount threads (0: one per hardware thread).
+  // A device starting with a FAT32 boot sector has no table, it's listed as one partition (Scheme::None).
+  void read(BlockSource &source, const std::size_t threadCount = 0);
+
+  // Public method scanning all of source at sector granularity for FAT32 boot sectors, on threadCount threads,
+  // adding the volumes found that no partition listed yet (Scheme::Probed). A volume whose boot sector is gone
+  // is still found through its backup copy, each candidate is confirmed by the media descriptor at the start of its FAT.
+  void probe(BlockSource &source, const std::size_t threadCount = 0);
+
+  // Public getter for the partitions found, in table order then probing order.
+  const std::vector<Partition> &getPartitions() const { return partitions; }
+
+  // Public method telling whether a partition holds a FAT32 volume.
+  static bool isFat32(const Partition &partition) { return partition.bootSector != BootSector::None; }
+
+  // Public method returning the lowercase name of a scheme, "none", "mbr", "gpt" or "probed".
+  static const char *getSchemeName(const Scheme scheme);
+};
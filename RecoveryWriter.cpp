@@ -0,0 +1,76 @@
+#include "RecoveryWriter.h"
+#include "Instrumentation.h"
+
+RecoveryWriter::RecoveryWriter(const std::string_view path, const std::size_t bufferSize)
+    : outputPath{path}, buffer(bufferSize)
+{
+  // The buffer has to be installed before opening for libstdc++ to use it.
+  file.rdbuf()->pubsetbuf(buffer.data(), static_cast<std::streamsize>(buffer.size()));
+  file.open(outputPath, std::ios::binary | std::ios::out | std::ios::trunc);
+
+  if (!file)
+    throw std::runtime_error{"Failed to open output file for writing"};
+}
+
+void RecoveryWriter::setValidator(std::unique_ptr<ContentValidator> contentValidator, const bool abortOnFailure)
+{
+  validator = std::move(contentValidator);
+  abortOnInvalid = abortOnFailure;
+}
+
+void RecoveryWriter::write(std::span<const uint8_t> data)
+{
+  if (data.empty())
+    return;
+
+  FAT32R_TIME_PHASE(OutputWrite);
+  FAT32R_COUNT(WriteCalls, 1);
+
+  if (validator != nullptr && validator->isValid() && !validator->update(data) && abortOnInvalid)
+  {
+    // Keep what came before the invalid byte, it's still the file's content.
+    uint64_t validBytes{std::max(validator->getFailureOffset(), bytesWritten) - bytesWritten};
+    data = data.first(static_cast<std::size_t>(std::min<uint64_t>(validBytes, data.size())));
+    if (file.write(reinterpret_cast<const char *>(data.data()), static_cast<std::streamsize>(data.size())))
+    {
+      bytesWritten += data.size();
+      FAT32R_COUNT(BytesWritten, data.size());
+    }
+    file.flush();
+    throw std::runtime_error{"Invalid content at byte " + std::to_string(validator->getFailureOffset()) + ": " + validator->getFailureReason()};
+  }
+
+  if (!file.write(reinterpret_cast<const char *>(data.data()), static_cast<std::streamsize>(data.size())))
+    throw std::runtime_error{"Error writing data to file"};
+
+  bytesWritten += data.size();
+  FAT32R_COUNT(BytesWritten, data.size());
+}
+
+void RecoveryWriter::finish()
+{
+  FAT32R_TIME_PHASE(OutputWrite);
+  try
+  {
+    file.flush();
+
+    if (!file)
+      throw std::runtime_error{"Error occurred during file write operation"};
+
+    file.close();
+
+    if (!std::filesystem::exists(outputPath) || std::filesystem::file_size(outputPath) != bytesWritten)
+      throw std::runtime_error{"File verification failed after writing"};
+
+    if (validator != nullptr && !validator->finish() && abortOnInvalid)
+      throw std::runtime_error{"Invalid content at byte " + std::to_string(validator->getFailureOffset()) + ": " + validator->getFailureReason()};
+  }
+  catch (const std::runtime_error &)
+  {
+    throw;
+  }
+  catch (...)
+  {
+    throw std::runtime_error{"File verification failed after writing"};
+  }
+}
@@ -0,0 +1,55 @@
+#pragma once
+#include "ContentValidator.h"
+#include <cstdint>
+#include <cstddef>
+#include <span>
+#include <string>
+#include <string_view>
+#include <vector>
+#include <fstream>
+#include <filesystem>
+#include <stdexcept>
+
+// Class for streaming a recovered file to a path cluster by cluster,
+// memory use is bounded by its fixed-size write buffer no matter how big the file is.
+class RecoveryWriter
+{
+private:
+  std::string outputPath{};
+  std::vector<char> buffer{}; // Reused as the output stream's buffer, allocated once.
+  std::ofstream file{};
+  uint64_t bytesWritten{};
+  std::unique_ptr<ContentValidator> validator{}; // Checks content as it's written, when set.
+  bool abortOnInvalid{false};
+
+public:
+  // Default size of the write buffer.
+  static constexpr std::size_t defaultBufferSize{1 << 20};
+
+  // Take an output file path, open (truncate) it for writing immediately.
+  RecoveryWriter(const std::string_view path, const std::size_t bufferSize = defaultBufferSize);
+
+  // Disabled copy and move semantics.
+  RecoveryWriter(const RecoveryWriter &) = delete;
+  RecoveryWriter &operator=(const RecoveryWriter &) = delete;
+
+  // Destructor.
+  ~RecoveryWriter() = default;
+
+  // Public method setting a validator the content is fed through as it's written. With abortOnFailure,
+  // writing stops at the first invalid byte: write throws once it has written the bytes before it.
+  // Otherwise the whole file is written and the failure only recorded in the validator.
+  void setValidator(std::unique_ptr<ContentValidator> contentValidator, const bool abortOnFailure);
+
+  // Public method appending data (typically a view of a cluster) to the output file.
+  void write(std::span<const uint8_t> data);
+
+  // Public method flushing and closing the output file,
+  // then checking that the file on disk has exactly the bytes written.
+  // Also checks a validator's end of content, throws when it's invalid and set to abort.
+  void finish();
+
+  uint64_t getBytesWritten() const { return bytesWritten; }
+  const std::string &getPath() const { return outputPath; }
+  const ContentValidator *getValidator() const { return validator.get(); }
+};
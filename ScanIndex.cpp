@@ -0,0 +1,239 @@
+#include "ScanIndex.h"
+#include <map>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+namespace
+{
+  // Every section starts 8-byte aligned, so the mapped arrays are properly aligned.
+  uint64_t alignSection(const uint64_t offset)
+  {
+    return (offset + 7) & ~uint64_t{7};
+  }
+
+  // Hash of FAT entries, FNV-1a over 64-bit words with a final avalanche.
+  uint64_t hashEntries(std::span<const uint32_t> entries)
+  {
+    uint64_t hash{0xcbf29ce484222325};
+    std::size_t i{0};
+    for (; i + 2 <= entries.size(); i += 2)
+    {
+      hash ^= static_cast<uint64_t>(entries[i]) | (static_cast<uint64_t>(entries[i + 1]) << 32);
+      hash *= 0x100000001b3;
+    }
+    if (i < entries.size())
+    {
+      hash ^= entries[i];
+      hash *= 0x100000001b3;
+    }
+    hash ^= hash >> 33;
+    hash *= 0xff51afd7ed558ccd;
+    hash ^= hash >> 33;
+    return hash;
+  }
+}
+
+ScanIndex::~ScanIndex()
+{
+  close();
+}
+
+void ScanIndex::close()
+{
+  if (mapping != nullptr)
+    munmap(mapping, mappingSize);
+  mapping = nullptr;
+  mappingSize = 0;
+  header = nullptr;
+}
+
+bool ScanIndex::open(const std::string &path)
+{
+  close();
+
+  int fd{::open(path.c_str(), O_RDONLY | O_CLOEXEC)};
+  if (fd < 0)
+    return false;
+
+  struct stat status{};
+  if (fstat(fd, &status) != 0 || static_cast<uint64_t>(status.st_size) < sizeof(Header))
+  {
+    ::close(fd);
+    return false;
+  }
+
+  mappingSize = static_cast<std::size_t>(status.st_size);
+  mapping = mmap(nullptr, mappingSize, PROT_READ, MAP_PRIVATE, fd, 0);
+  ::close(fd);
+  if (mapping == MAP_FAILED)
+  {
+    mapping = nullptr;
+    mappingSize = 0;
+    return false;
+  }
+
+  header = static_cast<const Header *>(mapping);
+  if (std::memcmp(header->magic, magic, sizeof(magic)) != 0 || header->version != version)
+  {
+    close();
+    return false;
+  }
+
+  // Every section has to lie within the file, every record has to point inside its sections.
+  auto fits{[this](const Section &location, const std::size_t elementSize)
+            {
+              return location.offset % 8 == 0 && location.offset <= mappingSize &&
+                     location.count <= (mappingSize - location.offset) / elementSize;
+            }};
+  bool valid{fits(header->fatChunkHashes, sizeof(uint64_t)) && fits(header->freeBitmap, sizeof(uint64_t)) &&
+             fits(header->directoryCandidates, sizeof(DirectoryCandidate)) && fits(header->liveChains, sizeof(ClusterExtent)) &&
+             fits(header->entryRecords, sizeof(EntryRecord)) && fits(header->entrySlots, sizeof(FAT32Entry)) && fits(header->paths, sizeof(PathRecord)) && fits(header->strings, 1)};
+
+  if (valid)
+  {
+    for (const auto &record : getEntryRecords())
+      valid = valid && record.slotCount != 0 && record.firstSlot <= header->entrySlots.count &&
+              record.slotCount <= header->entrySlots.count - record.firstSlot && record.pathIndex < header->paths.count;
+    for (const auto &pathRecord : section<PathRecord>(header->paths))
+      valid = valid && pathRecord.offset <= header->strings.count && pathRecord.length <= header->strings.count - pathRecord.offset;
+    uint64_t endCluster{static_cast<uint64_t>(header->clusterCount) + 2};
+    for (const auto &candidate : getDirectoryCandidates())
+      valid = valid && candidate.cluster >= 2 && candidate.cluster < endCluster &&
+              (candidate.kind == DirectoryClusterKind::FirstCluster || candidate.kind == DirectoryClusterKind::Continuation);
+    std::span<const ClusterExtent> liveChains{getLiveChains()};
+    for (std::size_t i{1}; i < liveChains.size(); ++i)
+      valid = valid && static_cast<uint64_t>(liveChains[i - 1].firstCluster) + liveChains[i - 1].clusterCount < liveChains[i].firstCluster;
+  }
+
+  if (!valid)
+    close();
+  return valid;
+}
+
+std::string_view ScanIndex::getPath(const std::size_t index) const
+{
+  const PathRecord &pathRecord{section<PathRecord>(header->paths)[index]};
+  return {section<char>(header->strings).data() + pathRecord.offset, static_cast<std::size_t>(pathRecord.length)};
+}
+
+void ScanIndex::write(const std::string &path, const Contents &contents)
+{
+  try
+  {
+    if (contents.entries == nullptr)
+      throw std::runtime_error{"No entries to write to scan index"};
+    const DeletedEntryCatalogue &entries{*contents.entries};
+
+    // Paths repeat when several scanned directories share one, store each path once per directory.
+    std::vector<PathRecord> pathRecords{};
+    std::string strings{};
+    std::map<std::pair<std::string_view, uint32_t>, uint32_t> pathIndices{};
+    std::vector<uint32_t> pathRemap(entries.getPathCount());
+    for (uint32_t i{0}; i < entries.getPathCount(); ++i)
+    {
+      auto [position, inserted]{pathIndices.try_emplace({entries.getPathAt(i), entries.getPathClusterAt(i)}, static_cast<uint32_t>(pathRecords.size()))};
+      if (inserted)
+      {
+        pathRecords.push_back({strings.size(), entries.getPathAt(i).size(), entries.getPathClusterAt(i), 0});
+        strings += entries.getPathAt(i);
+      }
+      pathRemap[i] = position->second;
+    }
+
+    std::vector<EntryRecord> entryRecords{};
+    entryRecords.reserve(entries.size());
+    for (std::size_t i{0}; i < entries.size(); ++i)
+      entryRecords.push_back({entries.getSlotOffsets()[i], entries.getSlotCounts()[i], pathRemap[entries.getPathIndex(i)]});
+    uint64_t slotCount{entries.getAllSlots().size()};
+
+    Header header{};
+    std::memcpy(header.magic, magic, sizeof(magic));
+    header.version = version;
+    header.volumeId = contents.volumeId;
+    header.bytesPerCluster = contents.bytesPerCluster;
+    header.clusterCount = contents.clusterCount;
+    header.flags = contents.flags;
+
+    // Lay sections out one after another.
+    uint64_t offset{alignSection(sizeof(Header))};
+    auto place{[&offset](Section &location, const uint64_t count, const std::size_t elementSize)
+               {
+                 location = {offset, count};
+                 offset = alignSection(offset + count * elementSize);
+               }};
+    place(header.fatChunkHashes, contents.fatChunkHashes.size(), sizeof(uint64_t));
+    place(header.freeBitmap, contents.freeBitmap.size(), sizeof(uint64_t));
+    place(header.directoryCandidates, contents.directoryCandidates.size(), sizeof(DirectoryCandidate));
+    place(header.liveChains, contents.liveChains.size(), sizeof(ClusterExtent));
+    place(header.entryRecords, entryRecords.size(), sizeof(EntryRecord));
+    place(header.entrySlots, slotCount, sizeof(FAT32Entry));
+    place(header.paths, pathRecords.size(), sizeof(PathRecord));
+    place(header.strings, strings.size(), 1);
+
+    std::string temporaryPath{path + ".tmp"};
+    {
+      std::ofstream file{temporaryPath, std::ios::binary | std::ios::trunc};
+      if (!file)
+        throw std::runtime_error{"Failed to create scan index file"};
+
+      auto writeBytes{[&file](const void *data, const std::size_t size)
+                      { file.write(static_cast<const char *>(data), static_cast<std::streamsize>(size)); }};
+      auto pad{[&file]()
+               {
+                 static constexpr char zeros[8]{};
+                 uint64_t position{static_cast<uint64_t>(file.tellp())};
+                 file.write(zeros, static_cast<std::streamsize>(alignSection(position) - position));
+               }};
+
+      writeBytes(&header, sizeof(header));
+      pad();
+      writeBytes(contents.fatChunkHashes.data(), contents.fatChunkHashes.size_bytes());
+      pad();
+      writeBytes(contents.freeBitmap.data(), contents.freeBitmap.size_bytes());
+      pad();
+      writeBytes(contents.directoryCandidates.data(), contents.directoryCandidates.size_bytes());
+      pad();
+      writeBytes(contents.liveChains.data(), contents.liveChains.size_bytes());
+      pad();
+      writeBytes(entryRecords.data(), entryRecords.size() * sizeof(EntryRecord));
+      pad();
+      writeBytes(entries.getAllSlots().data(), entries.getAllSlots().size_bytes());
+      pad();
+      writeBytes(pathRecords.data(), pathRecords.size() * sizeof(PathRecord));
+      pad();
+      writeBytes(strings.data(), strings.size());
+
+      file.close();
+      if (!file)
+        throw std::runtime_error{"Failed to write scan index file"};
+    }
+
+    std::filesystem::rename(temporaryPath, path);
+  }
+  catch (const std::runtime_error &)
+  {
+    throw;
+  }
+  catch (...)
+  {
+    throw std::runtime_error{"Error writing scan index file"};
+  }
+}
+
+std::vector<uint64_t> ScanIndex::hashFatChunks(const FatTable &fatTable, const std::size_t entryCount)
+{
+  std::size_t count{std::min(entryCount, fatTable.size())};
+  std::vector<uint64_t> hashes{};
+  hashes.reserve((count + fatChunkEntries - 1) / fatChunkEntries);
+
+  std::vector<uint32_t> chunk(fatChunkEntries);
+  for (std::size_t first{0}; first < count; first += fatChunkEntries)
+  {
+    std::span<uint32_t> entries{chunk.data(), std::min(fatChunkEntries, count - first)};
+    fatTable.copyEntries(static_cast<uint32_t>(first), entries);
+    hashes.push_back(hashEntries(entries));
+  }
+  return hashes;
+}
@@ -0,0 +1,129 @@
+#pragma once
+#include "Fat32.h"
+#include "DirectoryClassifier.h"
+#include "DeletedEntryCatalogue.h"
+#include "LiveChainIndex.h"
+#include <string>
+
+// Scan results of a volume saved to a file, so later runs can list deleted entries without scanning again.
+// An index is keyed by volume ID, geometry and scan options, plus one hash per chunk of FAT table entries:
+// it's fresh when every chunk hash still matches, otherwise the chunks that changed tell which clusters
+// were allocated or freed since, and only those need sweeping again.
+// The file is a header followed by fixed-layout sections, memory-mapped on load and read in place.
+class ScanIndex
+{
+public:
+  static constexpr uint32_t version{3};
+  static constexpr std::size_t fatChunkEntries{64 * 1024};
+
+  // Scan options an index was built with, the listing differs with them.
+  static constexpr uint32_t orphanScanFlag{1};
+  static constexpr uint32_t fatCrossCheckFlag{2};
+
+  // Where the slots of a deleted entry (long file name entries, main entry last) and its path are in the index.
+  struct EntryRecord
+  {
+    uint64_t firstSlot{};
+    uint32_t slotCount{};
+    uint32_t pathIndex{};
+  };
+
+  // Everything saved in an index file.
+  struct Contents
+  {
+    uint32_t volumeId{};
+    uint32_t bytesPerCluster{};
+    uint32_t clusterCount{};
+    uint32_t flags{};
+    std::span<const uint64_t> fatChunkHashes{};
+    std::span<const uint64_t> freeBitmap{};
+    std::span<const DirectoryCandidate> directoryCandidates{};
+    std::span<const ClusterExtent> liveChains{};
+    const DeletedEntryCatalogue *entries{nullptr};
+  };
+
+private:
+  struct Section
+  {
+    uint64_t offset{};
+    uint64_t count{};
+  };
+
+  struct PathRecord
+  {
+    uint64_t offset{};
+    uint64_t length{};
+    uint32_t directoryCluster{};
+    uint32_t reserved{};
+  };
+
+  struct Header
+  {
+    char magic[8]{};
+    uint32_t version{};
+    uint32_t volumeId{};
+    uint32_t bytesPerCluster{};
+    uint32_t clusterCount{};
+    uint32_t flags{};
+    uint32_t reserved{};
+    Section fatChunkHashes{};
+    Section freeBitmap{};
+    Section directoryCandidates{};
+    Section liveChains{};
+    Section entryRecords{};
+    Section entrySlots{};
+    Section paths{};
+    Section strings{};
+  };
+
+  static constexpr char magic[8]{'F', '3', '2', 'R', 'I', 'D', 'X', '\0'};
+
+  void *mapping{nullptr};
+  std::size_t mappingSize{};
+  const Header *header{nullptr};
+
+  // Private method returning a section of the mapping as an array of T, bounds are checked by open.
+  template <typename T>
+  std::span<const T> section(const Section &location) const
+  {
+    return {reinterpret_cast<const T *>(static_cast<const uint8_t *>(mapping) + location.offset), static_cast<std::size_t>(location.count)};
+  }
+
+  // Private method unmapping the file.
+  void close();
+
+public:
+  // Default constructor, no index opened.
+  ScanIndex() = default;
+
+  // Disabled copy and move semantics.
+  ScanIndex(const ScanIndex &) = delete;
+  ScanIndex &operator=(const ScanIndex &) = delete;
+
+  // Destructor.
+  ~ScanIndex();
+
+  // Public method mapping an index file, returns false when it's missing, damaged or of another version.
+  bool open(const std::string &path);
+
+  // Public method writing contents as an index file, through a temporary file renamed over path.
+  static void write(const std::string &path, const Contents &contents);
+
+  // Public method hashing the first entryCount entries of FAT table, one hash per fatChunkEntries entries.
+  static std::vector<uint64_t> hashFatChunks(const FatTable &fatTable, const std::size_t entryCount);
+
+  // Public getters, only valid after open returned true.
+  uint32_t getVolumeId() const { return header->volumeId; }
+  uint32_t getBytesPerCluster() const { return header->bytesPerCluster; }
+  uint32_t getClusterCount() const { return header->clusterCount; }
+  uint32_t getFlags() const { return header->flags; }
+  std::span<const uint64_t> getFatChunkHashes() const { return section<uint64_t>(header->fatChunkHashes); }
+  std::span<const uint64_t> getFreeBitmap() const { return section<uint64_t>(header->freeBitmap); }
+  std::span<const DirectoryCandidate> getDirectoryCandidates() const { return section<DirectoryCandidate>(header->directoryCandidates); }
+  std::span<const ClusterExtent> getLiveChains() const { return section<ClusterExtent>(header->liveChains); }
+  std::span<const EntryRecord> getEntryRecords() const { return section<EntryRecord>(header->entryRecords); }
+  std::span<const FAT32Entry> getEntrySlots() const { return section<FAT32Entry>(header->entrySlots); }
+  std::size_t getPathCount() const { return static_cast<std::size_t>(header->paths.count); }
+  std::string_view getPath(const std::size_t index) const;
+  uint32_t getPathCluster(const std::size_t index) const { return section<PathRecord>(header->paths)[index].directoryCluster; }
+};
@@ -0,0 +1,415 @@
+#include "SyntheticImage.h"
+#include <array>
+#include <random>
+
+namespace
+{
+  constexpr uint32_t sectorSize{512};
+  constexpr uint32_t reservedSectorCount{32};
+  constexpr uint32_t fatCount{2};
+  constexpr std::size_t unitsPerLongEntry{13};
+  constexpr uint16_t entryDate{((2024 - 1980) << 9) | (1 << 5) | 1}; // 2024-01-01
+  constexpr uint16_t entryTime{12 << 11};                             // 12:00:00
+
+  // Words long file names are made of, in UTF-16 and UTF-8, some of them outside ASCII
+  // (surrogate pair included) so name decoding leaves its fast path.
+  struct NameWord
+  {
+    std::u16string_view utf16{};
+    std::string_view utf8{};
+  };
+  constexpr std::array<NameWord, 6> nameWords{{
+      {u"report", "report"},
+      {u"résumé", "r\xC3\xA9sum\xC3\xA9"},
+      {u"holiday photo", "holiday photo"},
+      {u"日本", "\xE6\x97\xA5\xE6\x9C\xAC"},
+      {u"backup", "backup"},
+      {u"notes \U0001F600", "notes \xF0\x9F\x98\x80"},
+  }};
+  constexpr std::array<std::string_view, 4> extensions{"TXT", "BIN", "JPG", "DAT"};
+
+  // SplitMix64 finalizer, spreads consecutive inputs over the whole 64 bits.
+  uint64_t mix(uint64_t value)
+  {
+    value = (value ^ (value >> 30)) * 0xBF58476D1CE4E5B9ULL;
+    value = (value ^ (value >> 27)) * 0x94D049BB133111EBULL;
+    return value ^ (value >> 31);
+  }
+
+  void put16(uint8_t *out, const uint16_t value)
+  {
+    std::memcpy(out, &value, sizeof(value));
+  }
+
+  void put32(uint8_t *out, const uint32_t value)
+  {
+    std::memcpy(out, &value, sizeof(value));
+  }
+
+  FAT32Entry makeShortEntry(const uint8_t (&name)[11], const uint8_t attributes, const uint32_t firstCluster, const uint32_t size)
+  {
+    FAT32Entry entry{};
+    std::memcpy(entry.name, name, sizeof(name));
+    entry.attributes = attributes;
+    entry.creationDate = entryDate;
+    entry.lastAccessedDate = entryDate;
+    entry.firstClusterHigh = static_cast<uint16_t>(firstCluster >> 16);
+    entry.lastWrittenTime = entryTime;
+    entry.lastWrittenDate = entryDate;
+    entry.firstClusterLow = static_cast<uint16_t>(firstCluster & 0xFFFF);
+    entry.size = size;
+    return entry;
+  }
+
+  std::size_t longEntryCount(const std::u16string &longName)
+  {
+    return (longName.size() + unitsPerLongEntry - 1) / unitsPerLongEntry;
+  }
+}
+
+SyntheticImage::SyntheticImage(const Options &imageOptions)
+try
+    : options{imageOptions}
+{
+  layOut();
+}
+catch (const std::runtime_error &)
+{
+  throw;
+}
+
+void SyntheticImage::layOut()
+{
+  if (options.bytesPerCluster == 0 || options.bytesPerCluster % sectorSize != 0 || options.bytesPerCluster > 128 * sectorSize)
+    throw std::runtime_error{"Invalid synthetic image cluster size"};
+  if (options.maxFileSize > UINT32_MAX)
+    throw std::runtime_error{"Synthetic image files cannot exceed 4 GiB"};
+
+  // std::mt19937_64's sequence is fixed by the standard, distributions are not, so draws are reduced by hand.
+  std::mt19937_64 random{options.seed};
+  auto pick{[&random](const uint64_t bound)
+            { return bound == 0 ? 0 : random() % bound; }};
+  auto chance{[&random](const double probability)
+              { return static_cast<double>(random() >> 11) * 0x1.0p-53 < probability; }};
+
+  files.clear();
+  files.reserve(options.fileCount);
+  for (uint32_t index{0}; index < options.fileCount; ++index)
+  {
+    File file{};
+    file.directory = static_cast<uint32_t>(pick(static_cast<uint64_t>(options.directoryCount) + 1));
+    file.size = pick(options.maxFileSize + 1);
+    file.deleted = chance(options.deletedRatio);
+
+    std::string_view extension{extensions[pick(extensions.size())]};
+    std::string number{std::to_string(10000000 + index % 10000000).substr(1)};
+    std::memcpy(file.shortName, "F", 1);
+    std::memcpy(file.shortName + 1, number.data(), 7);
+    std::memcpy(file.shortName + 8, extension.data(), 3);
+
+    if (chance(options.longNameRatio))
+    {
+      const NameWord &word{nameWords[pick(nameWords.size())]};
+      std::string suffix{" " + std::to_string(index) + "."};
+      for (const char character : extension)
+        suffix += static_cast<char>(character - 'A' + 'a');
+      file.name = std::string{word.utf8} + suffix;
+      file.longName = std::u16string{word.utf16};
+      for (const char character : suffix)
+        file.longName += static_cast<char16_t>(character);
+    }
+    else
+      file.name = (file.deleted ? "_" : "F") + number + "." + std::string{extension};
+
+    files.push_back(std::move(file));
+  }
+
+  // Directories first, each in one run: the root directory holds an entry per subdirectory,
+  // subdirectories their "." and ".." entries, then every directory an entry per file plus its long file name entries.
+  std::vector<uint64_t> slots(static_cast<std::size_t>(options.directoryCount) + 1, 2);
+  slots[0] = options.directoryCount;
+  for (const auto &file : files)
+    slots[file.directory] += 1 + longEntryCount(file.longName);
+
+  uint64_t next{2};
+  directoryExtents.clear();
+  for (const uint64_t slotCount : slots)
+  {
+    uint64_t clusters{std::max<uint64_t>(1, (slotCount * sizeof(FAT32Entry) + options.bytesPerCluster - 1) / options.bytesPerCluster)};
+    directoryExtents.push_back({static_cast<uint32_t>(next), static_cast<uint32_t>(clusters)});
+    next += clusters;
+    if (next > 0x0FFFFFF0)
+      throw std::runtime_error{"Synthetic image too large"};
+  }
+
+  // Then files, in order, a fragment break skipping 1 to 8 clusters that stay free.
+  next = std::max<uint64_t>(next, options.firstFileCluster);
+  for (auto &file : files)
+  {
+    uint64_t fileClusters{(file.size + options.bytesPerCluster - 1) / options.bytesPerCluster};
+    for (uint64_t i{0}; i < fileClusters; ++i)
+    {
+      if (i != 0 && chance(options.fragmentation))
+        next += 1 + pick(8);
+      if (next > 0x0FFFFFF0)
+        throw std::runtime_error{"Synthetic image too large"};
+
+      if (!file.extents.empty() && file.extents.back().firstCluster + file.extents.back().clusterCount == next)
+        ++file.extents.back().clusterCount;
+      else
+        file.extents.push_back({static_cast<uint32_t>(next), 1});
+      ++next;
+    }
+  }
+
+  // Deleting a directory deletes what's in it first. Drawn last, so images without deleted directories stay the same.
+  deletedDirectories.assign(static_cast<std::size_t>(options.directoryCount) + 1, false);
+  for (uint32_t directory{1}; directory <= options.directoryCount; ++directory)
+    deletedDirectories[directory] = chance(options.deletedDirectoryRatio);
+  for (auto &file : files)
+    if (deletedDirectories[file.directory] && !file.deleted)
+    {
+      file.deleted = true;
+      if (file.longName.empty())
+        file.name[0] = '_';
+    }
+
+  uint64_t dataClusters{next - 2 + options.freeClusters};
+  uint64_t fatSectors{((dataClusters + 2) * sizeof(uint32_t) + sectorSize - 1) / sectorSize};
+  uint64_t totalSectors{reservedSectorCount + fatCount * fatSectors + dataClusters * (options.bytesPerCluster / sectorSize)};
+  if (dataClusters > 0x0FFFFFF5 - 2 || totalSectors > UINT32_MAX)
+    throw std::runtime_error{"Synthetic image too large"};
+
+  clusterCount = static_cast<uint32_t>(dataClusters);
+  sectorsPerFat = static_cast<uint32_t>(fatSectors);
+}
+
+std::vector<uint32_t> SyntheticImage::buildFatTable() const
+{
+  std::vector<uint32_t> table(static_cast<std::size_t>(sectorsPerFat) * sectorSize / sizeof(uint32_t), 0);
+  table[0] = 0x0FFFFFF8;
+  table[1] = 0x0FFFFFFF;
+
+  auto link{[&table](const std::vector<ClusterExtent> &extents)
+            {
+              uint32_t previous{0};
+              for (const auto &extent : extents)
+                for (uint32_t cluster{extent.firstCluster}; cluster < extent.firstCluster + extent.clusterCount; ++cluster)
+                {
+                  if (previous != 0)
+                    table[previous] = cluster;
+                  previous = cluster;
+                }
+              if (previous != 0)
+                table[previous] = 0x0FFFFFFF;
+            }};
+
+  for (uint32_t directory{0}; directory < directoryExtents.size(); ++directory)
+    if (!deletedDirectories[directory])
+      link({directoryExtents[directory]});
+  // Deleting a file frees its chain, only its directory entry is left.
+  for (const auto &file : files)
+    if (!file.deleted)
+      link(file.extents);
+
+  return table;
+}
+
+std::vector<FAT32Entry> SyntheticImage::buildDirectory(const uint32_t directory) const
+{
+  std::vector<FAT32Entry> entries{};
+
+  if (directory == 0)
+  {
+    for (uint32_t subdirectory{1}; subdirectory <= options.directoryCount; ++subdirectory)
+    {
+      uint8_t name[11]{};
+      std::string number{std::to_string(10000000 + subdirectory % 10000000).substr(1)};
+      std::memcpy(name, "D", 1);
+      std::memcpy(name + 1, number.data(), 7);
+      std::memcpy(name + 8, "   ", 3);
+      entries.push_back(makeShortEntry(name, 0x10, directoryExtents[subdirectory].firstCluster, 0));
+      if (deletedDirectories[subdirectory])
+        entries.back().name[0] = 0xE5;
+    }
+  }
+  else
+  {
+    entries.push_back(makeShortEntry({'.', ' ', ' ', ' ', ' ', ' ', ' ', ' ', ' ', ' ', ' '}, 0x10, directoryExtents[directory].firstCluster, 0));
+    entries.push_back(makeShortEntry({'.', '.', ' ', ' ', ' ', ' ', ' ', ' ', ' ', ' ', ' '}, 0x10, 0, 0));
+  }
+
+  for (const auto &file : files)
+  {
+    if (file.directory != directory)
+      continue;
+
+    // Long file name entries come in reverse order, the last one (flagged 0x40) first.
+    // The name is terminated by a null unit unless it fills its entries exactly, then padded with 0xFFFF.
+    std::size_t longCount{longEntryCount(file.longName)};
+    std::u16string units{file.longName};
+    if (units.size() < longCount * unitsPerLongEntry)
+      units += u'\0';
+    units.resize(longCount * unitsPerLongEntry, u'\xFFFF');
+    uint8_t checksum{shortNameChecksum(file.shortName)};
+
+    for (std::size_t ordinal{longCount}; ordinal >= 1; --ordinal)
+    {
+      FAT32Entry entry{};
+      auto *raw{reinterpret_cast<uint8_t *>(&entry)};
+      const char16_t *part{units.data() + (ordinal - 1) * unitsPerLongEntry};
+      raw[0] = file.deleted ? 0xE5 : static_cast<uint8_t>(ordinal | (ordinal == longCount ? 0x40 : 0));
+      std::memcpy(raw + 1, part, 5 * sizeof(char16_t));
+      raw[11] = 0x0F;
+      raw[13] = checksum;
+      std::memcpy(raw + 14, part + 5, 6 * sizeof(char16_t));
+      std::memcpy(raw + 28, part + 11, 2 * sizeof(char16_t));
+      entries.push_back(entry);
+    }
+
+    FAT32Entry entry{makeShortEntry(file.shortName, 0x20, file.extents.empty() ? 0 : file.extents.front().firstCluster, static_cast<uint32_t>(file.size))};
+    if (file.deleted)
+      entry.name[0] = 0xE5;
+    entries.push_back(entry);
+  }
+
+  return entries;
+}
+
+void SyntheticImage::write(const std::string &path) const
+{
+  try
+  {
+    std::ofstream out{path, std::ios::binary | std::ios::trunc};
+    if (!out)
+      throw std::runtime_error{"Error creating synthetic image"};
+
+    auto writeAt{[&out](const uint64_t offset, const void *data, const std::size_t size)
+                 {
+                   out.seekp(static_cast<std::streamoff>(offset));
+                   out.write(static_cast<const char *>(data), static_cast<std::streamsize>(size));
+                 }};
+
+    // Boot sector (and its backup at sector #6), then FSInfo with free counts left unknown.
+    std::array<uint8_t, sectorSize> sector{};
+    std::memcpy(sector.data(), "\xEB\x58\x90" "FAT32R  ", 11);
+    put16(&sector[11], sectorSize);
+    sector[13] = static_cast<uint8_t>(options.bytesPerCluster / sectorSize);
+    put16(&sector[14], reservedSectorCount);
+    sector[16] = fatCount;
+    sector[21] = 0xF8;
+    put16(&sector[24], 63);
+    put16(&sector[26], 255);
+    put32(&sector[32], static_cast<uint32_t>(getImageSize() / sectorSize));
+    put32(&sector[36], sectorsPerFat);
+    put32(&sector[44], directoryExtents.front().firstCluster);
+    put16(&sector[48], 1);
+    put16(&sector[50], 6);
+    sector[64] = 0x80;
+    sector[66] = 0x29;
+    put32(&sector[67], static_cast<uint32_t>(mix(options.seed)));
+    std::memcpy(&sector[71], "SYNTHETIC  FAT32   ", 19);
+    sector[510] = 0x55;
+    sector[511] = 0xAA;
+    writeAt(0, sector.data(), sector.size());
+    writeAt(6 * sectorSize, sector.data(), sector.size());
+
+    sector.fill(0);
+    put32(&sector[0], 0x41615252);
+    put32(&sector[484], 0x61417272);
+    put32(&sector[488], 0xFFFFFFFF);
+    put32(&sector[492], 0xFFFFFFFF);
+    put32(&sector[508], 0xAA550000);
+    writeAt(sectorSize, sector.data(), sector.size());
+
+    std::vector<uint32_t> fatTable{buildFatTable()};
+    for (uint32_t copy{0}; copy < fatCount; ++copy)
+      writeAt((reservedSectorCount + static_cast<uint64_t>(copy) * sectorsPerFat) * sectorSize, fatTable.data(), fatTable.size() * sizeof(uint32_t));
+
+    uint64_t dataOffset{(reservedSectorCount + static_cast<uint64_t>(fatCount) * sectorsPerFat) * sectorSize};
+    auto clusterOffset{[&](const uint32_t cluster)
+                       { return dataOffset + static_cast<uint64_t>(cluster - 2) * options.bytesPerCluster; }};
+
+    for (uint32_t directory{0}; directory < directoryExtents.size(); ++directory)
+    {
+      std::vector<FAT32Entry> entries{buildDirectory(directory)};
+      entries.resize(static_cast<std::size_t>(directoryExtents[directory].clusterCount) * options.bytesPerCluster / sizeof(FAT32Entry));
+      writeAt(clusterOffset(directoryExtents[directory].firstCluster), entries.data(), entries.size() * sizeof(FAT32Entry));
+    }
+
+    std::vector<uint8_t> buffer(1 << 20);
+    for (std::size_t index{0}; index < files.size(); ++index)
+    {
+      uint64_t position{0};
+      for (const auto &extent : files[index].extents)
+      {
+        uint64_t extentBytes{std::min(files[index].size - position, static_cast<uint64_t>(extent.clusterCount) * options.bytesPerCluster)};
+        out.seekp(static_cast<std::streamoff>(clusterOffset(extent.firstCluster)));
+        for (uint64_t done{0}; done < extentBytes;)
+        {
+          std::size_t chunk{static_cast<std::size_t>(std::min<uint64_t>(buffer.size(), extentBytes - done))};
+          fillContent(index, position + done, std::span<uint8_t>{buffer.data(), chunk});
+          out.write(reinterpret_cast<const char *>(buffer.data()), static_cast<std::streamsize>(chunk));
+          done += chunk;
+        }
+        position += extentBytes;
+      }
+    }
+
+    out.close();
+    if (!out)
+      throw std::runtime_error{"Error writing synthetic image"};
+
+    // Free clusters at the end were never written, extend the file over them without allocating anything.
+    std::filesystem::resize_file(path, getImageSize());
+  }
+  catch (const std::runtime_error &)
+  {
+    throw;
+  }
+  catch (...)
+  {
+    throw std::runtime_error{"Error writing synthetic image"};
+  }
+}
+
+void SyntheticImage::fillContent(const std::size_t index, const uint64_t offset, std::span<uint8_t> out) const
+{
+  // Every 8 bytes of a file come from one hash of (seed, file, position), wherever the chunk starts.
+  uint64_t fileKey{mix(options.seed + 0x9E3779B97F4A7C15ULL * (index + 1))};
+  uint64_t word{mix(fileKey ^ (offset / 8))};
+  for (std::size_t i{0}; i < out.size(); ++i)
+  {
+    uint64_t position{offset + i};
+    if (i != 0 && position % 8 == 0)
+      word = mix(fileKey ^ (position / 8));
+    out[i] = static_cast<uint8_t>(word >> (8 * (position % 8)));
+  }
+}
+
+std::string SyntheticImage::getDirectoryName(const uint32_t directory) const
+{
+  if (directory == 0)
+    return {};
+  return (deletedDirectories[directory] ? "_" : "D") + std::to_string(10000000 + directory % 10000000).substr(1);
+}
+
+uint64_t SyntheticImage::getImageSize() const
+{
+  return (reservedSectorCount + static_cast<uint64_t>(fatCount) * sectorsPerFat) * sectorSize + static_cast<uint64_t>(clusterCount) * options.bytesPerCluster;
+}
+
+std::size_t SyntheticImage::getDeletedFileCount() const
+{
+  return static_cast<std::size_t>(std::count_if(files.begin(), files.end(), [](const File &file)
+                                                { return file.deleted; }));
+}
+
+uint64_t SyntheticImage::getDeletedBytes() const
+{
+  uint64_t bytes{0};
+  for (const auto &file : files)
+    if (file.deleted)
+      bytes += file.size;
+  return bytes;
+}
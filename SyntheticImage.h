@@ -0,0 +1,86 @@
+#pragma once
+#include "Fat32.h"
+#include <string>
+
+// Deterministic synthetic FAT32 image, for benchmarks and hand checks: the same options (seed included)
+// always give the same image, byte for byte. Files are spread over the root directory and its subdirectories,
+// some with long file names, some deleted (entries marked, chains zeroed in both FAT copies, data left in place).
+// Free clusters left between fragments and at the end of the volume are never written, so large images stay sparse.
+class SyntheticImage
+{
+public:
+  struct Options
+  {
+    uint32_t bytesPerCluster{4096};    // Multiple of 512, at most 64 KiB.
+    uint32_t fileCount{1000};
+    uint32_t directoryCount{8};        // Subdirectories of the root directory, files go to any of them or the root.
+    uint64_t maxFileSize{64 << 10};    // File sizes are picked uniformly in [0, maxFileSize].
+    double deletedRatio{0.25};         // Chance of a file being deleted.
+    double deletedDirectoryRatio{0.0}; // Chance of a subdirectory being deleted, every file in it along.
+    double fragmentation{0.0};         // Chance of a file's next cluster not following its previous one.
+    double longNameRatio{0.5};         // Chance of a file having a long file name.
+    uint32_t firstFileCluster{0};      // Files are placed from this cluster on when past the directories, e.g. beyond 4 GiB.
+    uint32_t freeClusters{1024};       // Free clusters at the end of the volume.
+    uint64_t seed{1};
+  };
+
+  struct File
+  {
+    std::string name{};      // UTF-8, the long name when the file has one, otherwise the short one as recovery names it.
+    std::u16string longName{};
+    uint8_t shortName[11]{};
+    uint32_t directory{};    // 0 for the root directory, #n for subdirectory #n.
+    uint64_t size{};
+    bool deleted{false};
+    std::vector<ClusterExtent> extents{};
+  };
+
+private:
+  Options options{};
+  std::vector<File> files{};
+  std::vector<ClusterExtent> directoryExtents{}; // Clusters of the root directory (#0) and of each subdirectory.
+  std::vector<bool> deletedDirectories{};
+  uint32_t clusterCount{};
+  uint32_t sectorsPerFat{};
+
+  // Private method laying out directories and files from options, used by constructor.
+  void layOut();
+
+  // Private methods building the FAT table and the entries of a directory.
+  std::vector<uint32_t> buildFatTable() const;
+  std::vector<FAT32Entry> buildDirectory(const uint32_t directory) const;
+
+public:
+  // Take the options and lay the image out in memory, nothing is written yet.
+  // Throws if the options cannot make a valid volume.
+  SyntheticImage(const Options &imageOptions);
+
+  // Disabled copy and move semantics.
+  SyntheticImage(const SyntheticImage &) = delete;
+  SyntheticImage &operator=(const SyntheticImage &) = delete;
+
+  // Destructor.
+  ~SyntheticImage() = default;
+
+  // Public method writing the image to path, replacing any file there.
+  void write(const std::string &path) const;
+
+  // Public method filling out with the content of file #index starting at offset,
+  // a pure function of the seed, so recovered files can be checked without keeping the content around.
+  void fillContent(const std::size_t index, const uint64_t offset, std::span<uint8_t> out) const;
+
+  // Public method returning the entries of directory #directory as written, long file name entries included.
+  std::vector<FAT32Entry> getDirectoryEntries(const uint32_t directory) const { return buildDirectory(directory); }
+
+  // Public method returning the name recovery gives directory #directory, empty for the root directory.
+  std::string getDirectoryName(const uint32_t directory) const;
+
+  // Public getters.
+  const Options &getOptions() const { return options; }
+  const std::vector<File> &getFiles() const { return files; }
+  uint32_t getClusterCount() const { return clusterCount; }
+  uint64_t getFatByteSize() const { return static_cast<uint64_t>(sectorsPerFat) * 512; }
+  uint64_t getImageSize() const;
+  std::size_t getDeletedFileCount() const;
+  uint64_t getDeletedBytes() const;
+};
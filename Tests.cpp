@@ -0,0 +1,349 @@
+#include "EntryName.h"
+#include "Fat32Recoverer.h"
+#include "SyntheticImage.h"
+#include <algorithm>
+#include <array>
+#include <cstring>
+#include <filesystem>
+#include <fstream>
+#include <functional>
+#include <iostream>
+#include <set>
+#include <vector>
+#include <unistd.h>
+
+// Unit tests run by ctest, no framework: each test returns whether it passed and says what went wrong otherwise.
+
+namespace
+{
+  FAT32Entry mainEntry(const char (&shortName)[12], const uint8_t attributes)
+  {
+    FAT32Entry entry{};
+    std::memcpy(entry.name, shortName, sizeof(entry.name));
+    entry.attributes = attributes;
+    return entry;
+  }
+
+  // One long file name entry (ordinal #1, the last one) holding name, for mainEntry's short name.
+  FAT32Entry longNameEntry(const std::u16string &name, const FAT32Entry &mainEntry)
+  {
+    std::array<char16_t, 13> units{};
+    units.fill(0xFFFF);
+    std::copy(name.begin(), name.end(), units.begin());
+    if (name.size() < units.size())
+      units[name.size()] = 0;
+
+    FAT32Entry entry{};
+    uint8_t *bytes{reinterpret_cast<uint8_t *>(&entry)};
+    bytes[0] = 0x41;
+    entry.attributes = 0x0F;
+    bytes[13] = shortNameChecksum(mainEntry.name);
+    std::memcpy(bytes + 1, units.data(), 10);
+    std::memcpy(bytes + 14, units.data() + 5, 12);
+    std::memcpy(bytes + 28, units.data() + 11, 4);
+    return entry;
+  }
+
+  FAT32Entry mainEntry(const char (&shortName)[12], const uint8_t attributes, const uint32_t firstCluster, const uint32_t size)
+  {
+    FAT32Entry entry{mainEntry(shortName, attributes)};
+    entry.firstClusterHigh = static_cast<uint16_t>(firstCluster >> 16);
+    entry.firstClusterLow = static_cast<uint16_t>(firstCluster & 0xFFFF);
+    entry.size = size;
+    return entry;
+  }
+
+  // Where tests write images and recovered files, removed once they all ran.
+  std::filesystem::path scratchDirectory()
+  {
+    static const std::filesystem::path directory{std::filesystem::temp_directory_path() / ("FAT32R_tests_" + std::to_string(getpid()))};
+    std::filesystem::create_directories(directory);
+    return directory;
+  }
+
+  // Tiny FAT32 volume made by hand: 512-byte sectors and clusters, one FAT sector per copy, 64 data clusters.
+  // Root directory is cluster #2, every other cluster is left free (as deleted entries' chains are).
+  class TestVolume
+  {
+  private:
+    static constexpr std::size_t sectorSize{512};
+    static constexpr std::size_t reservedSectors{32};
+    static constexpr std::size_t dataClusters{64};
+    std::vector<uint8_t> bytes{std::vector<uint8_t>((reservedSectors + 2 + dataClusters) * sectorSize)};
+
+    uint8_t *cluster(const uint32_t number) { return bytes.data() + (reservedSectors + 2 + number - 2) * sectorSize; }
+
+  public:
+    TestVolume()
+    {
+      uint8_t *boot{bytes.data()};
+      std::memcpy(boot, "\xEB\x58\x90" "FAT32R  ", 11);
+      boot[11] = 0x00, boot[12] = 0x02; // 512 bytes per sector.
+      boot[13] = 1;                     // One sector per cluster.
+      boot[14] = reservedSectors;
+      boot[16] = 2;
+      boot[21] = 0xF8;
+      uint32_t sectorTotal{static_cast<uint32_t>(bytes.size() / sectorSize)};
+      std::memcpy(boot + 32, &sectorTotal, 4);
+      boot[36] = 1; // Sectors per FAT.
+      boot[44] = 2; // Root directory cluster.
+      boot[50] = 6; // Backup boot sector.
+      boot[510] = 0x55, boot[511] = 0xAA;
+      std::memcpy(bytes.data() + 6 * sectorSize, boot, sectorSize);
+
+      const uint32_t fat[3]{0x0FFFFFF8, 0x0FFFFFFF, 0x0FFFFFFF};
+      for (std::size_t copy{0}; copy < 2; ++copy)
+        std::memcpy(bytes.data() + (reservedSectors + copy) * sectorSize, fat, sizeof(fat));
+    }
+
+    void putEntries(const uint32_t number, const std::vector<FAT32Entry> &entries) { std::memcpy(cluster(number), entries.data(), entries.size() * sizeof(FAT32Entry)); }
+    void putData(const uint32_t number, const std::string_view data) { std::memcpy(cluster(number), data.data(), data.size()); }
+
+    void write(const std::filesystem::path &path) const
+    {
+      std::ofstream out{path, std::ios::binary | std::ios::trunc};
+      out.write(reinterpret_cast<const char *>(bytes.data()), static_cast<std::streamsize>(bytes.size()));
+    }
+  };
+
+  // Regular files under directory, relative to it.
+  std::set<std::string> filesUnder(const std::filesystem::path &directory)
+  {
+    std::set<std::string> files{};
+    for (const auto &entry : std::filesystem::recursive_directory_iterator{directory})
+      if (entry.is_regular_file())
+        files.insert(std::filesystem::relative(entry.path(), directory).string());
+    return files;
+  }
+
+  bool expectName(std::span<const FAT32Entry> entry, const std::string &expected)
+  {
+    std::string name{};
+    appendEntryName(entry, name);
+    if (name == expected)
+      return true;
+    std::cerr << "  name \"" << name << "\", expected \"" << expected << "\"\n";
+    return false;
+  }
+
+  bool testLongName()
+  {
+    FAT32Entry file{mainEntry("NOTES1~1TXT", 0x20)};
+    std::vector<FAT32Entry> entry{longNameEntry(u"notes 1.txt", file), file};
+    return expectName(entry, "notes 1.txt");
+  }
+
+  bool testDotDotLongNameFallsBackToShortName()
+  {
+    FAT32Entry directory{mainEntry("DOTDOT~1   ", 0x10)};
+    std::vector<FAT32Entry> entry{longNameEntry(u"..", directory), directory};
+    return expectName(entry, "DOTDOT~1");
+  }
+
+  bool testDotLongNameFallsBackToShortName()
+  {
+    FAT32Entry file{mainEntry("DOT~1      ", 0x20)};
+    std::vector<FAT32Entry> entry{longNameEntry(u".", file), file};
+    return expectName(entry, "DOT~1");
+  }
+
+  bool testDotShortNameBecomesUnderscores()
+  {
+    FAT32Entry directory{mainEntry("..         ", 0x10)};
+    std::vector<FAT32Entry> entry{longNameEntry(u"..", directory), directory};
+    return expectName(entry, "__") && expectName(std::span<const FAT32Entry>{&directory, 1}, "__");
+  }
+
+  bool testSlashLeadByteBecomesUnderscore()
+  {
+    FAT32Entry directory{mainEntry("/ETC       ", 0x10)};
+    FAT32Entry file{mainEntry("\001CTRL   TXT", 0x20)};
+    return expectName(std::span<const FAT32Entry>{&directory, 1}, "_ETC") && expectName(std::span<const FAT32Entry>{&file, 1}, "_CTRL.TXT");
+  }
+
+  bool testEscapedLeadByteIsNotDeleted()
+  {
+    // 0x05 stands for a first character of 0xE5 (not printable here), the entry is not deleted.
+    // Its long file name still belongs to it, the checksum being the one of the name as stored.
+    FAT32Entry file{mainEntry("\005ABC    TXT", 0x20)};
+    std::vector<FAT32Entry> entry{longNameEntry(u"\u00E5bc.txt", file), file};
+    return expectName(std::span<const FAT32Entry>{&file, 1}, "_ABC.TXT") && expectName(entry, "\u00E5bc.txt");
+  }
+
+  bool testLongNameBeforeVolumeLabelIsDropped()
+  {
+    // A stale long file name whose checksum fits the deleted file's short name, a volume label in between.
+    FAT32Entry file{mainEntry("\xE5" "ILE    TXT", 0x20, 3, 4)};
+    FAT32Entry longName{longNameEntry(u"volume.txt", mainEntry("FILE    TXT", 0x20))};
+    reinterpret_cast<uint8_t *>(&longName)[0] = 0xE5;
+    TestVolume volume{};
+    volume.putEntries(2, {longName, mainEntry("MYVOLUME   ", 0x08), file});
+    volume.putData(3, "file");
+    std::filesystem::path image{scratchDirectory() / "label.img"};
+    volume.write(image);
+
+    Fat32Recoverer recoverer{image.string()};
+    const DeletedEntryCatalogue &entries{recoverer.getDeletedEntries()};
+    if (entries.size() == 1 && entries.getName(0) == "_ILE.TXT")
+      return true;
+    std::cerr << "  " << entries.size() << " entries";
+    for (std::size_t index{0}; index < entries.size(); ++index)
+      std::cerr << ", \"" << entries.getName(index) << '"';
+    std::cerr << '\n';
+    return false;
+  }
+
+  bool testFilesPastFourGiB()
+  {
+    // Deleted files placed past the 4 GiB mark, the image stays sparse below them.
+    SyntheticImage::Options options{};
+    options.fileCount = 16;
+    options.directoryCount = 0;
+    options.deletedRatio = 1.0;
+    options.firstFileCluster = static_cast<uint32_t>((4ULL << 30) / options.bytesPerCluster);
+    options.freeClusters = 16;
+    SyntheticImage image{options};
+    std::filesystem::path path{scratchDirectory() / "large.img"};
+    image.write(path.string());
+    if (image.getImageSize() <= (4ULL << 30))
+      throw std::runtime_error{"Image not larger than 4 GiB"};
+
+    // Offsets worked out from the boot sector by hand, then the bytes there checked against each file's content.
+    uint8_t boot[512]{};
+    std::ifstream in{path, std::ios::binary};
+    in.read(reinterpret_cast<char *>(boot), sizeof(boot));
+    uint16_t bytesPerSector{}, reservedSectors{};
+    uint32_t sectorsPerFat{};
+    std::memcpy(&bytesPerSector, boot + 11, 2);
+    std::memcpy(&reservedSectors, boot + 14, 2);
+    std::memcpy(&sectorsPerFat, boot + 36, 4);
+    const uint64_t dataOffset{(reservedSectors + static_cast<uint64_t>(boot[16]) * sectorsPerFat) * bytesPerSector};
+
+    Fat32Device device{path.string(), BlockSource::Mode::File};
+    std::vector<uint8_t> expected(options.bytesPerCluster);
+    std::vector<uint8_t> actual(options.bytesPerCluster);
+    for (std::size_t index{0}; index < image.getFiles().size(); ++index)
+    {
+      const auto &file{image.getFiles()[index]};
+      if (file.size == 0)
+        continue;
+      const uint32_t cluster{file.extents.front().firstCluster};
+      const uint64_t offset{dataOffset + static_cast<uint64_t>(cluster - 2) * options.bytesPerCluster};
+      if (offset <= (4ULL << 30) || device.clusterByteOffset(cluster) != offset)
+      {
+        std::cerr << "  cluster #" << cluster << " at " << device.clusterByteOffset(cluster) << ", expected " << offset << '\n';
+        return false;
+      }
+
+      const std::size_t chunk{static_cast<std::size_t>(std::min<uint64_t>(file.size, options.bytesPerCluster))};
+      image.fillContent(index, 0, std::span<uint8_t>{expected.data(), chunk});
+      in.seekg(static_cast<std::streamoff>(offset));
+      in.read(reinterpret_cast<char *>(actual.data()), static_cast<std::streamsize>(chunk));
+      if (in.gcount() != static_cast<std::streamsize>(chunk) || std::memcmp(expected.data(), actual.data(), chunk) != 0)
+      {
+        std::cerr << "  " << file.name << " not found at cluster #" << cluster << '\n';
+        return false;
+      }
+    }
+
+    // Then every file recovered whole, byte for byte.
+    Fat32Recoverer recoverer{path.string()};
+    std::filesystem::path output{scratchDirectory() / "large"};
+    std::filesystem::create_directories(output);
+    std::vector<std::size_t> failed{recoverer.recoverDeletedEntries([](const DeletedEntryCatalogue &, const std::size_t)
+                                                                    { return true; },
+                                                                    output.string())};
+    std::size_t mismatches{0};
+    for (std::size_t index{0}; index < image.getFiles().size(); ++index)
+    {
+      const auto &file{image.getFiles()[index]};
+      std::ifstream recovered{output / file.name, std::ios::binary};
+      std::vector<uint8_t> content(file.size);
+      image.fillContent(index, 0, content);
+      std::string bytes{std::istreambuf_iterator<char>{recovered}, std::istreambuf_iterator<char>{}};
+      if (!recovered.good() && !recovered.eof())
+        ++mismatches;
+      else if (bytes.size() != content.size() || std::memcmp(bytes.data(), content.data(), content.size()) != 0)
+        ++mismatches;
+    }
+    std::filesystem::remove(path);
+    if (failed.empty() && mismatches == 0)
+      return true;
+    std::cerr << "  " << failed.size() << " failed, " << mismatches << " mismatching\n";
+    return false;
+  }
+
+  bool testRecoverNestedDirectoriesChildFirst()
+  {
+    // A deleted directory at root level holding a deleted file and a deleted directory, itself holding a deleted file.
+    TestVolume volume{};
+    volume.putEntries(2, {mainEntry("\xE5" "ARENT     ", 0x10, 3, 0)});
+    volume.putEntries(3, {mainEntry(".          ", 0x10, 3, 0), mainEntry("..         ", 0x10, 0, 0),
+                          mainEntry("\xE5" "HILD      ", 0x10, 4, 0), mainEntry("\xE5" "UTER   TXT", 0x20, 5, 5)});
+    volume.putEntries(4, {mainEntry(".          ", 0x10, 4, 0), mainEntry("..         ", 0x10, 3, 0), mainEntry("\xE5" "NNER   TXT", 0x20, 6, 5)});
+    volume.putData(5, "outer");
+    volume.putData(6, "inner");
+    std::filesystem::path image{scratchDirectory() / "nested.img"};
+    volume.write(image);
+
+    Fat32Recoverer recoverer{image.string()};
+    const DeletedEntryCatalogue &entries{recoverer.getDeletedEntries()};
+    auto indexOf{[&entries](const std::string_view name)
+                 {
+                   for (std::size_t index{0}; index < entries.size(); ++index)
+                     if (entries.getName(index) == name)
+                       return index;
+                   throw std::runtime_error{"Entry " + std::string{name} + " not found"};
+                 }};
+
+    // Child before parent, the parent's subtree has to be written once all the same.
+    std::filesystem::path output{scratchDirectory() / "nested"};
+    std::filesystem::create_directories(output);
+    std::vector<std::size_t> failed{recoverer.recoverDeletedEntries({indexOf("_HILD"), indexOf("_ARENT"), indexOf("_NNER.TXT")}, output.string())};
+
+    std::set<std::string> expected{"_ARENT/_HILD/_NNER.TXT", "_ARENT/_UTER.TXT"};
+    std::set<std::string> files{filesUnder(output)};
+    if (failed.empty() && files == expected)
+      return true;
+    std::cerr << "  " << failed.size() << " failed, files:";
+    for (const auto &file : files)
+      std::cerr << ' ' << file;
+    std::cerr << '\n';
+    return false;
+  }
+}
+
+int main()
+{
+  const std::vector<std::pair<const char *, std::function<bool()>>> tests{
+      {"long name", testLongName},
+      {"\"..\" long name falls back to short name", testDotDotLongNameFallsBackToShortName},
+      {"\".\" long name falls back to short name", testDotLongNameFallsBackToShortName},
+      {"dot short name becomes underscores", testDotShortNameBecomesUnderscores},
+      {"'/' short name lead byte becomes '_'", testSlashLeadByteBecomesUnderscore},
+      {"0x05 short name lead byte", testEscapedLeadByteIsNotDeleted},
+      {"long name before a volume label is dropped", testLongNameBeforeVolumeLabelIsDropped},
+      {"files past 4 GiB", testFilesPastFourGiB},
+      {"nested deleted directories requested child first", testRecoverNestedDirectoriesChildFirst},
+  };
+
+  int failures{0};
+  for (const auto &[name, test] : tests)
+  {
+    bool passed{false};
+    try
+    {
+      passed = test();
+    }
+    catch (const std::exception &error)
+    {
+      std::cerr << "  " << error.what() << '\n';
+    }
+    std::cout << (passed ? "PASS " : "FAIL ") << name << '\n';
+    failures += passed ? 0 : 1;
+  }
+
+  std::error_code error{};
+  std::filesystem::remove_all(scratchDirectory(), error);
+  return failures == 0 ? 0 : 1;
+}
@@ -0,0 +1,148 @@
+#include "ThreadPool.h"
+#include <algorithm>
+
+namespace
+{
+  // Identifies the pool and queue of the current worker thread, so nested submits stay local.
+  thread_local const ThreadPool *currentPool{nullptr};
+  thread_local std::size_t currentQueue{0};
+}
+
+ThreadPool::ThreadPool(std::size_t threadCount)
+{
+  if (threadCount == 0)
+    threadCount = std::max(1u, std::thread::hardware_concurrency());
+
+  for (std::size_t i{0}; i < threadCount; ++i)
+    queues.push_back(std::make_unique<WorkerQueue>());
+
+  for (std::size_t i{0}; i < threadCount; ++i)
+    workers.emplace_back([this, i]
+                         { workerLoop(i); });
+}
+
+ThreadPool::~ThreadPool()
+{
+  {
+    std::unique_lock lock{stateMutex};
+    allDone.wait(lock, [this]
+                 { return pendingTasks == 0; });
+    stopping = true;
+  }
+  taskAvailable.notify_all();
+
+  for (auto &worker : workers)
+    worker.join();
+}
+
+void ThreadPool::submit(std::function<void()> task)
+{
+  std::size_t target{currentPool == this ? currentQueue : nextQueue.fetch_add(1, std::memory_order_relaxed) % queues.size()};
+
+  // Counted before queueing, so the task cannot finish (or be picked up) before it's counted.
+  pendingTasks.fetch_add(1);
+  queuedTasks.fetch_add(1);
+  {
+    std::lock_guard queueLock{queues[target]->mutex};
+    queues[target]->tasks.push_back(std::move(task));
+  }
+
+  // A worker going to sleep counts itself before checking queuedTasks, so either it sees this task or it's seen here.
+  // Taking stateMutex then makes sure it's waiting already when notified.
+  if (sleepingWorkers.load() > 0)
+  {
+    {
+      std::lock_guard lock{stateMutex};
+    }
+    taskAvailable.notify_one();
+  }
+}
+
+void ThreadPool::wait()
+{
+  std::unique_lock lock{stateMutex};
+  allDone.wait(lock, [this]
+               { return pendingTasks == 0; });
+
+  if (firstError != nullptr)
+  {
+    std::exception_ptr error{firstError};
+    firstError = nullptr;
+    std::rethrow_exception(error);
+  }
+}
+
+bool ThreadPool::popTask(const std::size_t index, std::function<void()> &task)
+{
+  // Own queue first, newest task (LIFO).
+  {
+    std::lock_guard queueLock{queues[index]->mutex};
+    if (!queues[index]->tasks.empty())
+    {
+      task = std::move(queues[index]->tasks.back());
+      queues[index]->tasks.pop_back();
+      --queuedTasks;
+      return true;
+    }
+  }
+
+  // Then steal the oldest task of another worker (FIFO), which tends to be the biggest piece of work.
+  for (std::size_t offset{1}; offset < queues.size(); ++offset)
+  {
+    WorkerQueue &victim{*queues[(index + offset) % queues.size()]};
+    std::lock_guard queueLock{victim.mutex};
+    if (!victim.tasks.empty())
+    {
+      task = std::move(victim.tasks.front());
+      victim.tasks.pop_front();
+      --queuedTasks;
+      return true;
+    }
+  }
+
+  return false;
+}
+
+void ThreadPool::workerLoop(const std::size_t index)
+{
+  currentPool = this;
+  currentQueue = index;
+
+  while (true)
+  {
+    std::function<void()> task{};
+
+    if (!popTask(index, task))
+    {
+      // A task counted but not queued yet only makes this worker look again, see submit() for missed wakeups.
+      std::unique_lock lock{stateMutex};
+      sleepingWorkers.fetch_add(1);
+      taskAvailable.wait(lock, [this]
+                         { return stopping || queuedTasks.load() > 0; });
+      sleepingWorkers.fetch_sub(1);
+      if (stopping && queuedTasks.load() == 0)
+        return;
+      continue;
+    }
+
+    try
+    {
+      task();
+    }
+    catch (...)
+    {
+      std::lock_guard lock{stateMutex};
+      if (firstError == nullptr)
+        firstError = std::current_exception();
+    }
+
+    // wait() checks pendingTasks under stateMutex, taking it before notifying means it cannot miss this.
+    if (pendingTasks.fetch_sub(1) == 1)
+    {
+      {
+        std::lock_guard lock{stateMutex};
+      }
+      allDone.notify_all();
+    }
+  }
+}
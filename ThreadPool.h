@@ -0,0 +1,63 @@
+#pragma once
+#include <cstddef>
+#include <deque>
+#include <functional>
+#include <mutex>
+#include <condition_variable>
+#include <thread>
+#include <vector>
+#include <memory>
+#include <atomic>
+#include <exception>
+
+// Fixed-size pool of worker threads with one task queue per worker.
+// Tasks submitted from a worker go to that worker's own queue (newest first, keeps its caches warm),
+// idle workers steal the oldest tasks from other queues, so recursive work spreads across cores by itself.
+// Queues are only ever locked one at a time and on their own, the pool-wide lock is only taken to sleep, to wake
+// sleeping workers up and to signal that everything finished.
+class ThreadPool
+{
+private:
+  struct WorkerQueue
+  {
+    std::mutex mutex{};
+    std::deque<std::function<void()>> tasks{};
+  };
+
+  std::vector<std::unique_ptr<WorkerQueue>> queues{};
+  std::vector<std::thread> workers{};
+
+  std::mutex stateMutex{}; // Guards stopping and firstError, and sleeping on or signalling the condition variables.
+  std::condition_variable taskAvailable{};
+  std::condition_variable allDone{};
+  std::atomic<std::size_t> pendingTasks{0};    // Submitted but not yet finished.
+  std::atomic<std::size_t> queuedTasks{0};     // Submitted but not yet picked up by a worker.
+  std::atomic<std::size_t> sleepingWorkers{0}; // Waiting on taskAvailable, submit only takes stateMutex to wake one up.
+  std::atomic<std::size_t> nextQueue{0};       // Round-robin target for tasks submitted from outside the pool.
+  bool stopping{false};
+  std::exception_ptr firstError{nullptr};
+
+  // Private methods run by each worker thread.
+  void workerLoop(const std::size_t index);
+  bool popTask(const std::size_t index, std::function<void()> &task);
+
+public:
+  // Take the number of worker threads, 0 means one per hardware thread.
+  explicit ThreadPool(std::size_t threadCount = 0);
+
+  // Disabled copy and move semantics.
+  ThreadPool(const ThreadPool &) = delete;
+  ThreadPool &operator=(const ThreadPool &) = delete;
+
+  // Destructor, waits for queued tasks and joins all workers.
+  ~ThreadPool();
+
+  // Public method queueing a task, can be called from inside other tasks.
+  void submit(std::function<void()> task);
+
+  // Public method blocking until every submitted task (including tasks they submitted) finished.
+  // Rethrows the first exception thrown by a task, if any.
+  void wait();
+
+  std::size_t size() const { return workers.size(); }
+};
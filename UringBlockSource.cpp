@@ -0,0 +1,218 @@
+#include "UringBlockSource.h"
+#include "Instrumentation.h"
+#include <algorithm>
+#include <cerrno>
+#include <climits>
+#include <cstring>
+#include <deque>
+#include <vector>
+#include <fcntl.h>
+#include <linux/io_uring.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+
+UringBlockSource::UringBlockSource(const std::string &path, const unsigned depth)
+{
+  try
+  {
+    fd = open(path.c_str(), O_RDONLY | O_CLOEXEC);
+    if (fd < 0)
+      throw std::runtime_error{"Failed to open device"};
+
+    off_t end{lseek(fd, 0, SEEK_END)};
+    if (end < 0)
+      throw std::runtime_error{"Failed to determine device size"};
+    byteSize = static_cast<uint64_t>(end);
+
+    io_uring_params params{};
+    ringFd = static_cast<int>(syscall(__NR_io_uring_setup, depth, &params));
+    if (ringFd < 0)
+      throw std::runtime_error{"Failed to set up io_uring"};
+    queueDepth = params.sq_entries;
+
+    // Kernels with IORING_FEAT_SINGLE_MMAP share one mapping between both rings.
+    submissionRingSize = params.sq_off.array + params.sq_entries * sizeof(unsigned);
+    completionRingSize = params.cq_off.cqes + params.cq_entries * sizeof(io_uring_cqe);
+    bool singleMapping{(params.features & IORING_FEAT_SINGLE_MMAP) != 0};
+    if (singleMapping)
+      submissionRingSize = completionRingSize = std::max(submissionRingSize, completionRingSize);
+
+    submissionRing = mmap(nullptr, submissionRingSize, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, ringFd, IORING_OFF_SQ_RING);
+    if (submissionRing == MAP_FAILED)
+    {
+      submissionRing = nullptr;
+      throw std::runtime_error{"Failed to map io_uring"};
+    }
+
+    if (singleMapping)
+      completionRing = submissionRing;
+    else
+    {
+      completionRing = mmap(nullptr, completionRingSize, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, ringFd, IORING_OFF_CQ_RING);
+      if (completionRing == MAP_FAILED)
+      {
+        completionRing = nullptr;
+        throw std::runtime_error{"Failed to map io_uring"};
+      }
+    }
+
+    submissionEntriesSize = params.sq_entries * sizeof(io_uring_sqe);
+    submissionEntries = mmap(nullptr, submissionEntriesSize, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, ringFd, IORING_OFF_SQES);
+    if (submissionEntries == MAP_FAILED)
+    {
+      submissionEntries = nullptr;
+      throw std::runtime_error{"Failed to map io_uring"};
+    }
+
+    uint8_t *submissionBase{static_cast<uint8_t *>(submissionRing)};
+    submissionTail = reinterpret_cast<unsigned *>(submissionBase + params.sq_off.tail);
+    submissionMask = reinterpret_cast<unsigned *>(submissionBase + params.sq_off.ring_mask);
+    submissionArray = reinterpret_cast<unsigned *>(submissionBase + params.sq_off.array);
+
+    uint8_t *completionBase{static_cast<uint8_t *>(completionRing)};
+    completionHead = reinterpret_cast<unsigned *>(completionBase + params.cq_off.head);
+    completionTail = reinterpret_cast<unsigned *>(completionBase + params.cq_off.tail);
+    completionMask = reinterpret_cast<unsigned *>(completionBase + params.cq_off.ring_mask);
+    completionEntries = completionBase + params.cq_off.cqes;
+  }
+  catch (const std::runtime_error &)
+  {
+    release();
+    throw;
+  }
+}
+
+UringBlockSource::~UringBlockSource()
+{
+  release();
+}
+
+void UringBlockSource::release()
+{
+  if (submissionEntries != nullptr)
+    munmap(submissionEntries, submissionEntriesSize);
+  if (completionRing != nullptr && completionRing != submissionRing)
+    munmap(completionRing, completionRingSize);
+  if (submissionRing != nullptr)
+    munmap(submissionRing, submissionRingSize);
+  if (ringFd >= 0)
+    close(ringFd);
+  if (fd >= 0)
+    close(fd);
+
+  submissionEntries = completionRing = submissionRing = nullptr;
+  ringFd = fd = -1;
+}
+
+void UringBlockSource::read(const uint64_t offset, std::span<uint8_t> buffer)
+{
+  ReadRequest request{offset, buffer};
+  readBatch(std::span<const ReadRequest>{&request, 1});
+}
+
+void UringBlockSource::readBatch(std::span<const ReadRequest> requests)
+{
+  for ([[maybe_unused]] const auto &request : requests)
+    FAT32R_NOTE_READ(request.offset, request.buffer.size());
+
+  std::lock_guard lock{ringMutex};
+
+  io_uring_sqe *sqes{static_cast<io_uring_sqe *>(submissionEntries)};
+  io_uring_cqe *cqes{static_cast<io_uring_cqe *>(completionEntries)};
+
+  std::vector<std::size_t> bytesDone(requests.size(), 0);
+  std::deque<std::size_t> retries{}; // Requests that came back short and need the rest read.
+  std::size_t nextRequest{0};
+  std::size_t finished{0};
+  unsigned inFlight{0};
+  unsigned unsubmitted{0};
+  bool failed{false};
+
+  while (finished < requests.size() && !(failed && inFlight == 0))
+  {
+    // Queue as many reads as the ring takes, leftovers of short reads first.
+    unsigned tail{*submissionTail};
+    while (!failed && inFlight < queueDepth && (!retries.empty() || nextRequest < requests.size()))
+    {
+      std::size_t index{};
+      if (!retries.empty())
+      {
+        index = retries.front();
+        retries.pop_front();
+      }
+      else
+        index = nextRequest++;
+
+      const ReadRequest &request{requests[index]};
+      if (request.buffer.size() == bytesDone[index])
+      {
+        ++finished;
+        continue;
+      }
+
+      unsigned slot{tail & *submissionMask};
+      io_uring_sqe &sqe{sqes[slot]};
+      std::memset(&sqe, 0, sizeof(sqe));
+      sqe.opcode = IORING_OP_READ;
+      sqe.fd = fd;
+      sqe.off = request.offset + bytesDone[index];
+      sqe.addr = reinterpret_cast<uint64_t>(request.buffer.data() + bytesDone[index]);
+      sqe.len = static_cast<uint32_t>(std::min<std::size_t>(request.buffer.size() - bytesDone[index], INT_MAX));
+      sqe.user_data = index;
+      submissionArray[slot] = slot;
+
+      ++tail;
+      ++unsubmitted;
+      ++inFlight;
+    }
+    __atomic_store_n(submissionTail, tail, __ATOMIC_RELEASE);
+
+    if (inFlight == 0)
+      continue;
+
+    int submitted{static_cast<int>(syscall(__NR_io_uring_enter, ringFd, unsubmitted, 1, IORING_ENTER_GETEVENTS, nullptr, 0))};
+    if (submitted < 0)
+    {
+      if (errno == EINTR)
+        continue;
+      // Nothing new entered the kernel, take the queued entries back and only wait for what already did.
+      failed = true;
+      __atomic_store_n(submissionTail, tail - unsubmitted, __ATOMIC_RELEASE);
+      inFlight -= unsubmitted;
+      unsubmitted = 0;
+      continue;
+    }
+    unsubmitted -= std::min<unsigned>(unsubmitted, static_cast<unsigned>(submitted));
+
+    // Reap every completion available.
+    unsigned head{*completionHead};
+    unsigned completionEnd{__atomic_load_n(completionTail, __ATOMIC_ACQUIRE)};
+    while (head != completionEnd)
+    {
+      const io_uring_cqe &cqe{cqes[head & *completionMask]};
+      std::size_t index{static_cast<std::size_t>(cqe.user_data)};
+      int result{cqe.res};
+      ++head;
+      --inFlight;
+
+      if (result == -EINTR || result == -EAGAIN)
+        retries.push_back(index);
+      else if (result <= 0)
+        failed = true;
+      else
+      {
+        bytesDone[index] += static_cast<std::size_t>(result);
+        if (bytesDone[index] == requests[index].buffer.size())
+          ++finished;
+        else
+          retries.push_back(index);
+      }
+    }
+    __atomic_store_n(completionHead, head, __ATOMIC_RELEASE);
+  }
+
+  // Buffers may only be given back once the kernel is done with every read, hence the drain above.
+  if (failed)
+    throw std::runtime_error{"Error reading device"};
+}
@@ -0,0 +1,55 @@
+#pragma once
+#include "BlockSource.h"
+#include <mutex>
+
+// Block source reading through an io_uring submission queue, so a batch of reads
+// is handed to the kernel at once and up to queueDepth of them are in flight together.
+// Talks to the kernel through the raw io_uring system calls, no liburing needed.
+// Only built when FAT32R_WITH_IO_URING is enabled.
+class UringBlockSource : public BlockSource
+{
+private:
+  int fd{-1};
+  int ringFd{-1};
+  uint64_t byteSize{};
+  unsigned queueDepth{};
+
+  // Mapped submission/completion rings and submission entries.
+  void *submissionRing{nullptr};
+  std::size_t submissionRingSize{};
+  void *completionRing{nullptr};
+  std::size_t completionRingSize{};
+  void *submissionEntries{nullptr};
+  std::size_t submissionEntriesSize{};
+
+  // Pointers into the rings, set up once by the constructor.
+  unsigned *submissionTail{nullptr};
+  unsigned *submissionMask{nullptr};
+  unsigned *submissionArray{nullptr};
+  unsigned *completionHead{nullptr};
+  unsigned *completionTail{nullptr};
+  unsigned *completionMask{nullptr};
+  void *completionEntries{nullptr};
+
+  std::mutex ringMutex{}; // One ring shared by every thread reading through this source.
+
+  // Private method unmapping the rings and closing descriptors, used by destructor and failed construction.
+  void release();
+
+public:
+  // Default number of reads kept in flight.
+  static constexpr unsigned defaultQueueDepth{64};
+
+  UringBlockSource(const std::string &path, const unsigned depth = defaultQueueDepth);
+
+  // Disabled copy and move semantics.
+  UringBlockSource(const UringBlockSource &) = delete;
+  UringBlockSource &operator=(const UringBlockSource &) = delete;
+
+  // Destructor.
+  ~UringBlockSource() override;
+
+  uint64_t size() const override { return byteSize; }
+  void read(const uint64_t offset, std::span<uint8_t> buffer) override;
+  void readBatch(std::span<const ReadRequest> requests) override;
+};
@@ -1,59 +1,791 @@
 #include "Fat32Recoverer.h"
+#include "Instrumentation.h"
+#include "PartitionTable.h"
+#include <charconv>
+#include <cstdio>
+#include <fnmatch.h>
 
-int main()
+namespace
 {
-  try
+  // Exit codes of the command-line front end.
+  constexpr int exitSuccess{0};
+  constexpr int exitError{1};
+  constexpr int exitUsage{2};
+  constexpr int exitPartial{3}; // Recovery or carving finished, but some entries or files failed.
+
+  const char *usage{
+      "Usage:\n"
+      "  FAT32R                                   interactive prompt\n"
+      "  FAT32R scan <device> [options]           report deleted entries as they are found\n"
+      "  FAT32R list <device> [options]           list deleted entries with their index\n"
+      "  FAT32R recover <device> <output directory> (--all | --filter <glob> | --index <n>[,<n>...]) [options]\n"
+      "  FAT32R carve <device> <output directory> [--types <type>[,...]] [options]\n"
+      "                                           carve files with no entry left out of free clusters\n"
+      "  FAT32R partitions <device> [options]     list the partitions of a whole disk and the FAT32 volumes on them\n"
+      "\n"
+      "Options:\n"
+      "  --json               newline-delimited JSON output, one object per line\n"
+      "  --threads <n>        worker threads, 0 (default) means one per hardware thread\n"
+      "  --orphans            also sweep free clusters for orphaned directories\n"
+      "  --mode <mode>        device access: auto (default), mmap, file, uring or direct (O_DIRECT,\n"
+      "                       bypassing the page cache)\n"
+      "  --eager-fat          load the whole FAT table on open instead of paging it in\n"
+      "  --fat-cross-check    compare FAT copies and fall back to a backup on damaged entries\n"
+      "  --cluster-cache <size>  cache this much of the clusters read one at a time (default 32M, 0 for none)\n"
+      "                       and report its hits and misses, unused on memory-mapped devices\n"
+      "  --partition <n>      open partition #n (as numbered by partitions) of a whole disk\n"
+      "  --offset <size>      open the volume starting at this byte offset, e.g. one found by --probe\n"
+      "  --probe              also scan the whole device for FAT32 boot sectors no partition table lists\n"
+      "  --index-file <file>  load the scan from this index file when still valid, save it there otherwise\n"
+      "  --validate <policy>  check JPEG, PNG and ZIP content while recovering: flag (report) or abort (stop the file)\n"
+      "  --stats              report bytes read, seeks, cache hits, decoded clusters and names, writes and time per phase\n"
+      "                       as one JSON object, per thread and in total (on stdout with --json, stderr otherwise)\n"
+      "  --trace <file>       write the phases of every thread to file as a Chrome trace (chrome://tracing, Perfetto)\n"
+      "\n"
+      "Query options, checked while scanning (scan, list and recover):\n"
+      "  --name <glob>        entry name matches glob, case-insensitive\n"
+      "  --regex <regex>      entry name contains a match of regex, case-insensitive\n"
+      "  --ext <ext>[,...]    entry name has one of these extensions\n"
+      "  --type <type>        file or dir\n"
+      "  --min-size <size>    at least size bytes (K, M and G suffixes allowed)\n"
+      "  --max-size <size>    at most size bytes\n"
+      "  --since <date>       last written on or after date (YYYY-MM-DD)\n"
+      "  --until <date>       last written on or before date\n"
+      "  --created            compare creation dates instead of last written dates\n"
+      "\n"
+      "Checked once scanned (list and recover with --all or --filter):\n"
+      "  --min-recoverability <percent>  at least percent of the entry's clusters still free\n"
+      "\n"
+      "A whole disk holding a single FAT32 volume is opened without --partition. When its partition table\n"
+      "lists none, the device is probed for lost boot sectors.\n"
+      "Carved types: jpeg, png, mp4 (MP4 and QuickTime), pdf and zip (all by default).\n"
+      "Indices are the ones printed by list (starting at #1). A glob without '/' matches entry names,\n"
+      "otherwise full paths, case-insensitive.\n"};
+
+  // Command line, parsed.
+  struct Options
   {
-    std::cout << "- Enter device: ";
+    std::string command{};
     std::string device{};
-    std::cin >> device;
+    std::string outputDir{};
+    bool json{false};
+    bool all{false};
+    std::string filter{};
+    std::vector<std::size_t> indices{};
+    std::size_t threads{0};
+    bool orphans{false};
+    BlockSource::Mode mode{BlockSource::Mode::Auto};
+    bool eagerFat{false};
+    bool fatCrossCheck{false};
+    std::optional<uint64_t> clusterCache{};
+    std::optional<uint32_t> partition{};
+    std::optional<uint64_t> offset{};
+    bool probe{false};
+    bool stats{false};
+    std::string traceFile{};
+    std::string indexFile{};
+    EntryQuery query{};
+    unsigned minRecoverability{0};
+    std::vector<FileCarver::Type> carveTypes{};
+    Fat32Recoverer::Validation validation{Fat32Recoverer::Validation::Off};
+  };
 
-    Fat32Recoverer recoverer{device};
+  // Thrown for malformed command lines, reported along with usage.
+  struct UsageError : std::runtime_error
+  {
+    using std::runtime_error::runtime_error;
+  };
 
-    recoverer.printDeletedEntriesConsole();
-    std::cout << "+ Some corrupted (partly-overwritten) files/folders may appear in the list.\n";
-    std::cout << "- Enter index to recover: ";
-    std::size_t index{};
-    std::cin >> index;
+  std::size_t parseNumber(const std::string_view text)
+  {
+    std::size_t value{};
+    auto [end, error]{std::from_chars(text.data(), text.data() + text.size(), value)};
+    if (error != std::errc{} || end != text.data() + text.size())
+      throw UsageError{"Invalid number: " + std::string{text}};
+    return value;
+  }
 
-    std::cout << "+ Writing to output path on current partition can render some deleted files/folders unrecoverable.\n";
-    std::cout << "- Enter output directory: ";
-    std::string outputPath{};
-    std::cin >> outputPath;
+  // Size in bytes, with an optional binary K, M or G suffix.
+  uint64_t parseSize(std::string_view text)
+  {
+    uint64_t multiplier{1};
+    if (!text.empty() && std::string_view{"KMG"}.find(static_cast<char>(std::toupper(static_cast<unsigned char>(text.back())))) != std::string_view::npos)
+    {
+      char suffix{static_cast<char>(std::toupper(static_cast<unsigned char>(text.back())))};
+      multiplier = suffix == 'K' ? uint64_t{1} << 10 : suffix == 'M' ? uint64_t{1} << 20 : uint64_t{1} << 30;
+      text.remove_suffix(1);
+    }
+    return static_cast<uint64_t>(parseNumber(text)) * multiplier;
+  }
 
-    recoverer.recoverDeletedEntry(index - 1, outputPath);
+  // YYYY-MM-DD, FAT-encoded.
+  uint16_t parseDate(const std::string_view text)
+  {
+    if (text.size() != 10 || text[4] != '-' || text[7] != '-')
+      throw UsageError{"Invalid date: " + std::string{text}};
+    try
+    {
+      return EntryQuery::encodeDate(static_cast<unsigned>(parseNumber(text.substr(0, 4))), static_cast<unsigned>(parseNumber(text.substr(5, 2))), static_cast<unsigned>(parseNumber(text.substr(8, 2))));
+    }
+    catch (const UsageError &)
+    {
+      throw UsageError{"Invalid date: " + std::string{text}};
+    }
+    catch (const std::runtime_error &)
+    {
+      throw UsageError{"Date out of FAT range (1980 to 2107): " + std::string{text}};
+    }
   }
-  catch (const std::runtime_error &error)
+
+  Options parseOptions(const int argc, char **argv)
   {
-    std::cerr << error.what() << std::endl;
+    Options options{};
+    std::vector<std::string> positional{};
+    uint64_t minSize{0};
+    uint64_t maxSize{UINT64_MAX};
+    uint16_t firstDate{0};
+    uint16_t lastDate{0xFFFF};
+    bool hasDateRange{false};
+    bool createdDates{false};
 
-    std::cin.ignore();
-    do
+    for (int i{1}; i < argc; ++i)
     {
-      std::cout << "\nPress enter to exit...\n";
-    } while (std::cin.get() != '\n');
+      std::string_view argument{argv[i]};
+      auto value{[&]() -> std::string_view
+                 {
+                   if (i + 1 >= argc)
+                     throw UsageError{"Missing value for " + std::string{argument}};
+                   return argv[++i];
+                 }};
+
+      if (argument == "--json")
+        options.json = true;
+      else if (argument == "--all")
+        options.all = true;
+      else if (argument == "--filter")
+        options.filter = value();
+      else if (argument == "--index")
+      {
+        std::string_view list{value()};
+        while (!list.empty())
+        {
+          std::size_t comma{list.find(',')};
+          std::size_t index{parseNumber(list.substr(0, comma))};
+          if (index == 0)
+            throw UsageError{"Indices start at 1"};
+          options.indices.push_back(index - 1);
+          list = comma == std::string_view::npos ? std::string_view{} : list.substr(comma + 1);
+        }
+      }
+      else if (argument == "--types")
+      {
+        std::string_view list{value()};
+        while (!list.empty())
+        {
+          std::size_t comma{list.find(',')};
+          std::string_view name{list.substr(0, comma)};
+          std::size_t type{0};
+          while (type < FileCarver::typeCount && FileCarver::getTypeName(static_cast<FileCarver::Type>(type)) != name)
+            ++type;
+          if (type == FileCarver::typeCount)
+            throw UsageError{"Unknown carved type: " + std::string{name}};
+          options.carveTypes.push_back(static_cast<FileCarver::Type>(type));
+          list = comma == std::string_view::npos ? std::string_view{} : list.substr(comma + 1);
+        }
+      }
+      else if (argument == "--threads")
+        options.threads = parseNumber(value());
+      else if (argument == "--orphans")
+        options.orphans = true;
+      else if (argument == "--mode")
+      {
+        std::string_view mode{value()};
+        if (mode == "auto")
+          options.mode = BlockSource::Mode::Auto;
+        else if (mode == "mmap")
+          options.mode = BlockSource::Mode::Mmap;
+        else if (mode == "file")
+          options.mode = BlockSource::Mode::File;
+        else if (mode == "uring")
+          options.mode = BlockSource::Mode::Uring;
+        else if (mode == "direct")
+          options.mode = BlockSource::Mode::Direct;
+        else
+          throw UsageError{"Unknown mode: " + std::string{mode}};
+      }
+      else if (argument == "--eager-fat")
+        options.eagerFat = true;
+      else if (argument == "--fat-cross-check")
+        options.fatCrossCheck = true;
+      else if (argument == "--cluster-cache")
+        options.clusterCache = parseSize(value());
+      else if (argument == "--partition")
+        options.partition = static_cast<uint32_t>(parseNumber(value()));
+      else if (argument == "--offset")
+        options.offset = parseSize(value());
+      else if (argument == "--probe")
+        options.probe = true;
+      else if (argument == "--stats")
+        options.stats = true;
+      else if (argument == "--trace")
+        options.traceFile = value();
+      else if (argument == "--index-file")
+        options.indexFile = value();
+      else if (argument == "--validate")
+      {
+        std::string_view policy{value()};
+        if (policy == "flag")
+          options.validation = Fat32Recoverer::Validation::Flag;
+        else if (policy == "abort")
+          options.validation = Fat32Recoverer::Validation::Abort;
+        else
+          throw UsageError{"Unknown validation policy: " + std::string{policy}};
+      }
+      else if (argument == "--name")
+        options.query.setNameGlob(value());
+      else if (argument == "--regex")
+      {
+        try
+        {
+          options.query.setNameRegex(std::string{value()});
+        }
+        catch (const std::runtime_error &)
+        {
+          throw UsageError{"Invalid regex: " + std::string{argv[i]}};
+        }
+      }
+      else if (argument == "--ext")
+      {
+        std::vector<std::string> extensions{};
+        std::string_view list{value()};
+        while (!list.empty())
+        {
+          std::size_t comma{list.find(',')};
+          extensions.emplace_back(list.substr(0, comma));
+          list = comma == std::string_view::npos ? std::string_view{} : list.substr(comma + 1);
+        }
+        options.query.setExtensions(extensions);
+      }
+      else if (argument == "--type")
+      {
+        std::string_view type{value()};
+        if (type == "file")
+          options.query.setType(EntryQuery::Type::File);
+        else if (type == "dir")
+          options.query.setType(EntryQuery::Type::Directory);
+        else
+          throw UsageError{"Unknown type: " + std::string{type}};
+      }
+      else if (argument == "--min-size")
+        minSize = parseSize(value());
+      else if (argument == "--max-size")
+        maxSize = parseSize(value());
+      else if (argument == "--since")
+      {
+        firstDate = parseDate(value());
+        hasDateRange = true;
+      }
+      else if (argument == "--until")
+      {
+        lastDate = parseDate(value());
+        hasDateRange = true;
+      }
+      else if (argument == "--created")
+        createdDates = true;
+      else if (argument == "--min-recoverability")
+      {
+        uint64_t percent{parseNumber(value())};
+        if (percent > 100)
+          throw UsageError{"Recoverability is a percentage: " + std::string{argv[i]}};
+        options.minRecoverability = static_cast<unsigned>(percent);
+      }
+      else if (argument.starts_with("--"))
+        throw UsageError{"Unknown option: " + std::string{argument}};
+      else
+        positional.emplace_back(argument);
+    }
+
+    if (minSize > maxSize)
+      throw UsageError{"Empty size range"};
+    options.query.setSizeRange(minSize, maxSize);
+    if (hasDateRange)
+    {
+      if (firstDate > lastDate)
+        throw UsageError{"Empty date range"};
+      options.query.setDateRange(firstDate, lastDate, createdDates ? EntryQuery::DateField::Created : EntryQuery::DateField::LastWritten);
+    }
+
+    if (positional.empty())
+      throw UsageError{"Missing command"};
+    options.command = positional[0];
+
+    std::size_t expected{options.command == "recover" || options.command == "carve" ? 3u : 2u};
+    if (options.command != "scan" && options.command != "list" && options.command != "recover" && options.command != "carve" && options.command != "partitions")
+      throw UsageError{"Unknown command: " + options.command};
+    if (positional.size() != expected)
+      throw UsageError{"Wrong number of arguments for " + options.command};
+    options.device = positional[1];
+    if (options.command == "carve")
+      options.outputDir = positional[2];
+    if (options.command == "recover")
+    {
+      options.outputDir = positional[2];
+      if (options.all + !options.filter.empty() + !options.indices.empty() != 1)
+        throw UsageError{"recover needs exactly one of --all, --filter and --index"};
+    }
+    if (options.partition && options.offset)
+      throw UsageError{"--partition and --offset cannot be used together"};
+    if ((options.stats || !options.traceFile.empty()) && !Instrumentation::isCompiledIn())
+      throw UsageError{"--stats and --trace need a build with FAT32R_WITH_INSTRUMENTATION"};
+    return options;
+  }
 
-    return 1;
+  // String as a JSON string literal, quotes included.
+  std::string jsonString(const std::string_view text)
+  {
+    std::string quoted{"\""};
+    for (const char character : text)
+    {
+      switch (character)
+      {
+      case '"':
+        quoted += "\\\"";
+        break;
+      case '\\':
+        quoted += "\\\\";
+        break;
+      case '\n':
+        quoted += "\\n";
+        break;
+      case '\t':
+        quoted += "\\t";
+        break;
+      default:
+        if (static_cast<unsigned char>(character) < 0x20)
+        {
+          char escaped[7]{};
+          std::snprintf(escaped, sizeof(escaped), "\\u%04x", static_cast<unsigned char>(character));
+          quoted += escaped;
+        }
+        else
+          quoted += character;
+      }
+    }
+    return quoted + "\"";
   }
-  catch (...)
+
+  std::string fullPath(const std::string_view directory, const std::string_view name)
   {
-    std::cerr << "Unknown error ocurred" << std::endl;
+    std::string path{directory};
+    if (path != "/")
+      path += '/';
+    return path += name;
+  }
+
+  // One line describing a deleted entry, index and recoverability are only known once the scan finished (0 and -1 for none).
+  void printEntry(const Options &options, const std::string_view name, const std::string_view path, const FAT32Entry &mainEntry, const std::size_t index, const int recoverability)
+  {
+    bool isDir{(mainEntry.attributes & 0x10) == 0x10};
+    uint32_t firstCluster{(static_cast<uint32_t>(mainEntry.firstClusterHigh) << 16) | mainEntry.firstClusterLow};
+
+    if (options.json)
+    {
+      std::cout << "{\"event\":\"entry\"";
+      if (index != 0)
+        std::cout << ",\"index\":" << index;
+      std::cout << ",\"path\":" << jsonString(fullPath(path, name))
+                << ",\"name\":" << jsonString(name)
+                << ",\"type\":\"" << (isDir ? "directory" : "file") << "\""
+                << ",\"size\":" << mainEntry.size
+                << ",\"firstCluster\":" << firstCluster;
+      if (recoverability >= 0)
+        std::cout << ",\"recoverability\":" << recoverability;
+      std::cout << "}\n";
+    }
+    else
+    {
+      if (index != 0)
+        std::cout << index << ". ";
+      std::cout << fullPath(path, name) << (isDir ? " (directory" : " (file");
+      if (recoverability >= 0)
+        std::cout << ", " << recoverability << "% recoverable";
+      std::cout << ")\n";
+    }
+    std::cout.flush();
+  }
+
+  // Partitions of the device, probed for lost FAT32 volumes when asked to or when the table lists none.
+  void readPartitions(PartitionTable &table, const Options &options)
+  {
+    std::unique_ptr<BlockSource> source{openBlockSource(options.device, options.mode)};
+    table.read(*source, options.threads);
+    if (options.probe || std::none_of(table.getPartitions().begin(), table.getPartitions().end(), PartitionTable::isFat32))
+      table.probe(*source, options.threads);
+  }
+
+  // Byte range of the volume to open: the one asked for, otherwise the only FAT32 volume of the device.
+  // Falls back to the whole device when none is found, opening it then reports why it's not FAT32.
+  std::pair<uint64_t, uint64_t> selectVolume(const Options &options)
+  {
+    if (options.offset)
+      return {*options.offset, 0};
+
+    PartitionTable table{};
+    readPartitions(table, options);
+    const auto &partitions{table.getPartitions()};
+
+    auto selected{partitions.end()};
+    if (options.partition)
+    {
+      selected = std::find_if(partitions.begin(), partitions.end(), [&options](const PartitionTable::Partition &partition)
+                              { return partition.number == *options.partition; });
+      if (selected == partitions.end())
+        throw UsageError{"No partition #" + std::to_string(*options.partition) + " on " + options.device};
+    }
+    else
+    {
+      std::string candidates{};
+      std::size_t volumeCount{0};
+      for (auto partition{partitions.begin()}; partition != partitions.end(); ++partition)
+      {
+        if (!PartitionTable::isFat32(*partition))
+          continue;
+        candidates += " #" + std::to_string(partition->number);
+        if (volumeCount++ == 0)
+          selected = partition;
+      }
+      if (volumeCount == 0)
+        return {0, 0};
+      if (volumeCount > 1)
+        throw UsageError{"Several FAT32 volumes on " + options.device + ", pick one with --partition:" + candidates};
+    }
+
+    if (selected->scheme != PartitionTable::Scheme::None && !options.json)
+      std::cerr << "- Opening partition #" << selected->number << " at byte " << selected->byteOffset << ".\n";
+    return {selected->byteOffset, selected->byteSize};
+  }
+
+  // Open the device and scan it, streaming entries out as found when asked to.
+  void readDevice(Fat32Recoverer &recoverer, const Options &options, const bool streamEntries)
+  {
+    auto [volumeOffset, volumeSize]{selectVolume(options)};
+    recoverer.setVolume(volumeOffset, volumeSize);
+    recoverer.setThreadCount(options.threads);
+    recoverer.setOrphanScan(options.orphans);
+    recoverer.setFatAccess(options.eagerFat ? FatTable::Mode::Eager : FatTable::Mode::Lazy);
+    recoverer.setFatCrossCheck(options.fatCrossCheck);
+    if (options.clusterCache)
+      recoverer.setClusterCache(static_cast<std::size_t>(*options.clusterCache));
+    recoverer.setIndexPath(options.indexFile);
+    recoverer.setQuery(options.query);
+    if (streamEntries)
+      recoverer.setEntryListener([&recoverer, &options](std::span<const FAT32Entry> entry, std::string_view path)
+                                 { printEntry(options, recoverer.getEntryName(entry), path, entry.back(), 0, -1); });
+
+    recoverer.readDevice(options.device, options.mode);
+    recoverer.setEntryListener({});
+    if (recoverer.usedBackupBootSector() && !options.json)
+      std::cerr << "- Boot sector damaged, read its backup copy instead.\n";
+  }
+
+  // Cluster cache counters, only when asked for a cache size (to tune it).
+  void printClusterCacheStats(const Fat32Recoverer &recoverer, const Options &options)
+  {
+    if (!options.clusterCache)
+      return;
+
+    ClusterCache::Stats stats{recoverer.getClusterCacheStats()};
+    if (options.json)
+      std::cout << "{\"event\":\"cache\",\"hits\":" << stats.hits << ",\"misses\":" << stats.misses
+                << ",\"readAhead\":" << stats.readAhead << ",\"evictions\":" << stats.evictions << "}\n";
+    else
+      std::cerr << "- Cluster cache: " << stats.hits << " hits, " << stats.misses << " misses, "
+                << stats.readAhead << " clusters read ahead, " << stats.evictions << " evictions.\n";
+  }
+
+  int runScan(const Options &options)
+  {
+    Fat32Recoverer recoverer{};
+    readDevice(recoverer, options, true);
+
+    printClusterCacheStats(recoverer, options);
+    if (options.json)
+      std::cout << "{\"event\":\"done\",\"entries\":" << recoverer.getDeletedEntryCount() << "}\n";
+    else
+      std::cout << "- Found " << recoverer.getDeletedEntryCount() << " deleted entries.\n";
+    return exitSuccess;
+  }
+
+  int runList(const Options &options)
+  {
+    Fat32Recoverer recoverer{};
+    readDevice(recoverer, options, false);
 
+    const DeletedEntryCatalogue &entries{recoverer.getDeletedEntries()};
+    for (std::size_t index{0}; index < entries.size(); ++index)
+      if (entries.getRecoverability(index) >= options.minRecoverability)
+        printEntry(options, entries.getName(index), entries.getPath(index), entries.getMainEntry(index), index + 1, entries.getRecoverability(index));
+    printClusterCacheStats(recoverer, options);
+    if (options.json)
+      std::cout << "{\"event\":\"done\",\"entries\":" << recoverer.getDeletedEntryCount() << "}\n";
+    return exitSuccess;
+  }
+
+  int runRecover(const Options &options)
+  {
+    Fat32Recoverer recoverer{};
+    readDevice(recoverer, options, false);
+
+    // An index given twice is recovered once, not written again as "name~1".
+    std::vector<std::size_t> indices{options.indices};
+    std::sort(indices.begin(), indices.end());
+    indices.erase(std::unique(indices.begin(), indices.end()), indices.end());
+    if (options.all || !options.filter.empty())
+    {
+      const DeletedEntryCatalogue &entries{recoverer.getDeletedEntries()};
+      for (std::size_t index{0}; index < recoverer.getDeletedEntryCount(); ++index)
+      {
+        // Entries whose clusters were mostly taken again are not worth reading.
+        if (entries.getRecoverability(index) < options.minRecoverability)
+          continue;
+        if (!options.filter.empty())
+        {
+          std::string subject{options.filter.find('/') == std::string::npos ? std::string{entries.getName(index)} : fullPath(entries.getPath(index), entries.getName(index))};
+          // FAT names are case-insensitive, as --name globs are.
+          if (fnmatch(options.filter.c_str(), subject.c_str(), FNM_CASEFOLD) != 0)
+            continue;
+        }
+        indices.push_back(index);
+      }
+    }
+
+    std::filesystem::create_directories(options.outputDir);
+    recoverer.setValidation(options.validation);
+    std::vector<std::size_t> failed{recoverer.recoverDeletedEntries(indices, options.outputDir)};
+
+    for (const auto &failure : recoverer.getValidationFailures())
+    {
+      if (options.json)
+        std::cout << "{\"event\":\"invalid\",\"path\":" << jsonString(failure.path) << ",\"offset\":" << failure.offset
+                  << ",\"cluster\":" << failure.cluster << ",\"reason\":" << jsonString(failure.reason) << "}\n";
+      else
+        std::cerr << "Content of " << failure.path << " breaks at byte " << failure.offset << " (cluster " << failure.cluster << "): " << failure.reason << '\n';
+    }
+
+    for (const auto index : indices)
+    {
+      bool ok{!std::binary_search(failed.begin(), failed.end(), index)};
+      std::string path{fullPath(recoverer.getDeletedEntries().getPath(index), recoverer.getDeletedEntries().getName(index))};
+      if (options.json)
+        std::cout << "{\"event\":\"recovered\",\"index\":" << index + 1 << ",\"path\":" << jsonString(path) << ",\"ok\":" << (ok ? "true" : "false") << "}\n";
+      else if (!ok)
+        std::cerr << "Failed to recover " << index + 1 << ". " << path << '\n';
+    }
+
+    printClusterCacheStats(recoverer, options);
+    if (options.json)
+      std::cout << "{\"event\":\"done\",\"recovered\":" << indices.size() - failed.size() << ",\"failed\":" << failed.size() << "}\n";
+    else
+      std::cout << "- Recovered " << indices.size() - failed.size() << " of " << indices.size() << " entries.\n";
+    return failed.empty() ? exitSuccess : exitPartial;
+  }
+
+  int runCarve(const Options &options)
+  {
+    Fat32Recoverer recoverer{};
+    readDevice(recoverer, options, false);
+
+    std::filesystem::create_directories(options.outputDir);
+    std::vector<Fat32Recoverer::CarvedFile> carvedFiles{recoverer.carveFreeClusters(options.outputDir, options.carveTypes)};
+
+    std::size_t failed{0};
+    for (const auto &carvedFile : carvedFiles)
+    {
+      failed += carvedFile.written ? 0 : 1;
+      if (options.json)
+        std::cout << "{\"event\":\"carved\",\"path\":" << jsonString(carvedFile.path)
+                  << ",\"type\":\"" << FileCarver::getTypeName(carvedFile.type) << "\""
+                  << ",\"size\":" << carvedFile.size
+                  << ",\"firstCluster\":" << carvedFile.firstCluster
+                  << ",\"ok\":" << (carvedFile.written ? "true" : "false") << "}\n";
+      else if (carvedFile.written)
+        std::cout << carvedFile.path << " (" << FileCarver::getTypeName(carvedFile.type) << ", " << carvedFile.size << " bytes)\n";
+      else
+        std::cerr << "Failed to write " << carvedFile.path << '\n';
+    }
+
+    printClusterCacheStats(recoverer, options);
+    if (options.json)
+      std::cout << "{\"event\":\"done\",\"carved\":" << carvedFiles.size() - failed << ",\"failed\":" << failed << "}\n";
+    else
+      std::cout << "- Carved " << carvedFiles.size() - failed << " of " << carvedFiles.size() << " files.\n";
+    return failed == 0 ? exitSuccess : exitPartial;
+  }
+
+  int runPartitions(const Options &options)
+  {
+    PartitionTable table{};
+    readPartitions(table, options);
+
+    for (const auto &partition : table.getPartitions())
+    {
+      const char *bootSector{partition.bootSector == PartitionTable::BootSector::Primary  ? "primary"
+                             : partition.bootSector == PartitionTable::BootSector::Backup ? "backup"
+                                                                                           : "none"};
+      if (options.json)
+        std::cout << "{\"event\":\"partition\",\"number\":" << partition.number << ",\"scheme\":\"" << PartitionTable::getSchemeName(partition.scheme)
+                  << "\",\"offset\":" << partition.byteOffset << ",\"size\":" << partition.byteSize << ",\"type\":" << static_cast<unsigned>(partition.type)
+                  << ",\"name\":" << jsonString(partition.name) << ",\"bootSector\":\"" << bootSector << "\",\"label\":" << jsonString(partition.volumeLabel) << "}\n";
+      else
+      {
+        std::cout << partition.number << ". " << PartitionTable::getSchemeName(partition.scheme) << " at byte " << partition.byteOffset
+                  << ", " << partition.byteSize << " bytes";
+        if (partition.type != 0)
+          std::cout << ", type 0x" << std::hex << static_cast<unsigned>(partition.type) << std::dec;
+        if (!partition.name.empty())
+          std::cout << ", \"" << partition.name << '"';
+        if (!PartitionTable::isFat32(partition))
+          std::cout << " (not FAT32)\n";
+        else
+          std::cout << " (FAT32" << (partition.volumeLabel.empty() ? "" : " \"" + partition.volumeLabel + '"')
+                    << (partition.bootSector == PartitionTable::BootSector::Backup ? ", backup boot sector only" : "") << ")\n";
+      }
+    }
+
+    if (options.json)
+      std::cout << "{\"event\":\"done\",\"partitions\":" << table.getPartitions().size() << "}\n";
+    else
+      std::cout << "- Found " << table.getPartitions().size() << " partitions.\n";
+    return exitSuccess;
+  }
+
+  int runCommand(const Options &options)
+  {
+    if (options.command == "scan")
+      return runScan(options);
+    if (options.command == "list")
+      return runList(options);
+    if (options.command == "carve")
+      return runCarve(options);
+    if (options.command == "partitions")
+      return runPartitions(options);
+    return runRecover(options);
+  }
+
+  // Counters and phase timers of the run, and its trace, when asked for.
+  void reportInstrumentation(const Options &options)
+  {
+    if (options.stats)
+      Instrumentation::writeStats(options.json ? std::cout : std::cerr);
+
+    if (!options.traceFile.empty())
+    {
+      std::ofstream trace{options.traceFile};
+      if (!trace)
+        throw std::runtime_error{"Failed to open trace file " + options.traceFile};
+      Instrumentation::writeTrace(trace);
+    }
+  }
+
+  // Original prompt-driven flow, used when no arguments are given.
+  int runInteractive()
+  {
+    try
+    {
+      std::cout << "- Enter device: ";
+      std::string device{};
+      std::cin >> device;
+
+      Fat32Recoverer recoverer{device};
+
+      recoverer.printDeletedEntriesConsole();
+      std::cout << "+ Some corrupted (partly-overwritten) files/folders may appear in the list.\n";
+      std::cout << "- Enter index to recover: ";
+      std::size_t index{};
+      std::cin >> index;
+
+      std::cout << "+ Writing to output path on current partition can render some deleted files/folders unrecoverable.\n";
+      std::cout << "- Enter output directory: ";
+      std::string outputPath{};
+      std::cin >> outputPath;
+
+      recoverer.recoverDeletedEntry(index - 1, outputPath);
+    }
+    catch (const std::runtime_error &error)
+    {
+      std::cerr << error.what() << std::endl;
+
+      std::cin.ignore();
+      do
+      {
+        std::cout << "\nPress enter to exit...\n";
+      } while (std::cin.get() != '\n');
+
+      return exitError;
+    }
+    catch (...)
+    {
+      std::cerr << "Unknown error ocurred" << std::endl;
+
+      std::cin.ignore();
+      do
+      {
+        std::cout << "\nPress enter to exit...\n";
+      } while (std::cin.get() != '\n');
+
+      return exitError;
+    }
+
+    std::cout << "- Succesfully recovered.\n";
     std::cin.ignore();
     do
     {
       std::cout << "\nPress enter to exit...\n";
     } while (std::cin.get() != '\n');
 
-    return 1;
+    return exitSuccess;
   }
+}
 
-  std::cout << "- Succesfully recovered.\n";
-  std::cin.ignore();
-  do
+int main(int argc, char **argv)
+{
+  if (argc == 1)
+    return runInteractive();
+
+  bool json{false};
+  try
   {
-    std::cout << "\nPress enter to exit...\n";
-  } while (std::cin.get() != '\n');
+    if (std::string_view{argv[1]} == "--help" || std::string_view{argv[1]} == "-h")
+    {
+      std::cout << usage;
+      return exitSuccess;
+    }
 
-  return 0;
+    Options options{parseOptions(argc, argv)};
+    json = options.json;
+
+    Instrumentation::setTracing(!options.traceFile.empty());
+    Instrumentation::reset();
+    int status{runCommand(options)};
+    reportInstrumentation(options);
+    return status;
+  }
+  catch (const UsageError &error)
+  {
+    std::cerr << error.what() << "\n\n"
+              << usage;
+    return exitUsage;
+  }
+  catch (const std::exception &error)
+  {
+    if (json)
+      std::cout << "{\"event\":\"error\",\"message\":" << jsonString(error.what()) << "}\n";
+    std::cerr << error.what() << std::endl;
+    return exitError;
+  }
+  catch (...)
+  {
+    std::cerr << "Unknown error ocurred" << std::endl;
+    return exitError;
+  }
 }